@@ -5,6 +5,14 @@
 #include <string>
 #include <vector>
 
+/**
+ * View of a walker that has reached an accepted state.
+ *
+ * Only the fields the engine reads from the wrapper itself (states, the
+ * transition walker and pending input) are copied, and those are cheap to
+ * share. History, explored edges and the raw value stay with the accepted
+ * walker and are read through it on demand.
+ */
 class AcceptedState : public Walker
 {
 public:
@@ -31,6 +39,12 @@ public:
 
     nb::object get_current_value() const override;
 
+    // The raw value of the accepted walker, unless one was assigned to this view
+    std::optional<std::string> get_raw_value() const override;
+
+    // Override signature to delegate to accepted walker
+    uint64_t signature() const override;
+
     // Override equality operator
     bool operator==(const Walker &other) const override;
 
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "state_machine.h"
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nb = nanobind;
+
+// Verdict on one document
+struct ValidationResult
+{
+  bool accepted = false;
+  // Byte offset of the first byte no walker could consume or that is not valid
+  // UTF-8, or the document's size if it was accepted or ended before the
+  // grammar allowed it to; never a character index
+  size_t error_offset = 0;
+};
+
+/**
+ * Checks whole documents against a grammar without running a model.
+ *
+ * Each document is fed through the walkers in chunks that end on UTF-8
+ * character boundaries, as StateMachine::consume_text() does; when a chunk
+ * is rejected it is replayed one character at a time to locate the error.
+ * Batches are split across native worker threads that do not hold the GIL,
+ * so Python is only entered by machines implemented in Python. The root is
+ * frozen on construction, since every worker walks it.
+ */
+class DocumentValidator
+{
+public:
+  static constexpr size_t DEFAULT_CHUNK_BYTES = 64;
+
+  /**
+   * @param root The grammar every document must match
+   * @param num_threads Number of worker threads; 0 uses one per hardware thread
+   * @param chunk_bytes Upper bound on the size of each chunk fed to the walkers
+   */
+  explicit DocumentValidator(nb::ref<StateMachine> root,
+                             size_t num_threads = 0,
+                             size_t chunk_bytes = DEFAULT_CHUNK_BYTES);
+
+  ValidationResult validate(std::string_view document) const;
+
+  /**
+   * @brief Validate documents in parallel
+   * @param documents The documents to check
+   * @return One result per document, in order
+   */
+  std::vector<ValidationResult> validate_batch(const std::vector<std::string> &documents) const;
+
+  /**
+   * @brief Validate every line of a newline-delimited file, such as JSON Lines
+   * @param path The file to check; it is memory-mapped rather than read
+   * @return One result per line, in order; offsets are relative to the line
+   *
+   * A trailing "\r" is not part of its line, and a final newline does not
+   * start another document.
+   */
+  std::vector<ValidationResult> validate_file(const std::string &path) const;
+
+  const nb::ref<StateMachine> &root() const { return root_; }
+  size_t num_threads() const { return num_threads_; }
+  size_t chunk_bytes() const { return chunk_bytes_; }
+
+private:
+  std::vector<ValidationResult> validate_all(const std::vector<std::string_view> &documents) const;
+
+  nb::ref<StateMachine> root_;
+  size_t num_threads_;
+  size_t chunk_bytes_;
+};
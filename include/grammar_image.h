@@ -0,0 +1,70 @@
+#pragma once
+
+#include "state_machine.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace nb = nanobind;
+
+/**
+ * Versioned on-disk format for a frozen state machine graph.
+ *
+ * The image is a flat array of fixed-size records (machines, states, edges,
+ * end states) followed by a string table, all addressed by 32-bit indices so
+ * it can be memory-mapped and read in place. Records use the byte order of
+ * the host that wrote them, which the header records; images are rejected on
+ * hosts of the other order. Base `StateMachine` nodes are
+ * rebuilt natively; nodes of any other type are recreated through a resolver
+ * and then receive their graph, end states and flags from the image. The
+ * resolver must return a new, unfrozen machine for every record. The loaded
+ * graph comes back frozen.
+ */
+class GrammarImage
+{
+public:
+  static constexpr char MAGIC[8] = {'P', 'S', 'E', 'G', 'R', 'A', 'M', '\0'};
+  static constexpr uint32_t VERSION = 2;
+  // Written in native byte order; reads back as 0x04030201 on a host of the other order.
+  static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+  // Returns a key stored alongside a machine, e.g. the parameters of a leaf.
+  using Describer = std::function<std::string(nb::ref<StateMachine>)>;
+  // Recreates a non-native machine from its type name and stored key.
+  using Resolver = std::function<nb::ref<StateMachine>(const std::string &, const std::string &)>;
+
+  /**
+   * @brief Serialize the graph reachable from root into an image
+   * @param root The root state machine
+   * @param describe Optional callback producing a key for non-native machines
+   * @return The image bytes
+   */
+  static std::string dump(const nb::ref<StateMachine> &root, const Describer &describe = nullptr);
+
+  /**
+   * @brief Rebuild a state machine graph from image bytes
+   * @param image The image bytes; only read during the call
+   * @param resolve Callback recreating non-native machines
+   * @return The root state machine, frozen
+   * @throws std::runtime_error If the resolver returns a frozen machine
+   * @throws std::invalid_argument If the resolver returns a machine already used
+   */
+  static nb::ref<StateMachine> load_from(std::string_view image, const Resolver &resolve = nullptr);
+
+  /**
+   * @brief Write the image for root to a file
+   * @param root The root state machine
+   * @param path Destination path
+   * @param describe Optional callback producing a key for non-native machines
+   */
+  static void save(const nb::ref<StateMachine> &root, const std::string &path, const Describer &describe = nullptr);
+
+  /**
+   * @brief Memory-map an image file and rebuild its state machine graph
+   * @param path Path of the image file
+   * @param resolve Callback recreating non-native machines
+   * @return The root state machine, frozen
+   */
+  static nb::ref<StateMachine> load(const std::string &path, const Resolver &resolve = nullptr);
+};
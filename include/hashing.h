@@ -0,0 +1,39 @@
+#pragma once
+
+#include "state_machine.h"
+#include <cstdint>
+#include <string_view>
+
+// Stable 64-bit hashing helpers; results do not depend on the standard
+// library, so they can be persisted or compared across processes.
+
+inline uint64_t hash_bytes(std::string_view data)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned char c : data)
+  {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+inline uint64_t hash_combine(uint64_t seed, uint64_t value)
+{
+  uint64_t x = seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+inline uint64_t hash_state(const StateMachine::State &state)
+{
+  if (std::holds_alternative<int>(state))
+  {
+    return hash_combine(1, static_cast<uint64_t>(std::get<int>(state)));
+  }
+  return hash_combine(2, hash_bytes(std::get<std::string>(state)));
+}
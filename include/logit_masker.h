@@ -0,0 +1,51 @@
+#pragma once
+
+#include "token_bitmask.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class LogitType
+{
+  Float32,
+  Float16,
+  BFloat16
+};
+
+/**
+ * In-place masking of logit buffers.
+ *
+ * Disallowed tokens are overwritten with -inf straight from the packed
+ * bitmask, 32 tokens per mask word. Words that allow everything are skipped,
+ * words that allow nothing are filled, and mixed words are blended with
+ * AVX-512, AVX2 or NEON when available, picked once at runtime, with a
+ * scalar fallback. Logits past the end of the mask are disallowed, which
+ * covers models whose output layer is padded past the vocabulary.
+ */
+class LogitMasker
+{
+public:
+  /**
+   * @brief Mask one row of logits in place
+   * @param logits Pointer to the first logit of the row
+   * @param type Element type of the buffer
+   * @param size Number of logits in the row
+   * @param mask Allowed tokens
+   */
+  static void apply(void *logits, LogitType type, size_t size, const TokenBitmask &mask);
+
+  /**
+   * @brief Mask a [batch, vocab] buffer in place, one mask per row
+   * @param logits Pointer to the first logit of the first row
+   * @param type Element type of the buffer
+   * @param rows Number of rows
+   * @param size Number of logits per row
+   * @param row_stride Distance between rows, in elements
+   * @param masks One mask per row, or a single mask shared by every row
+   */
+  static void apply_batch(void *logits, LogitType type, size_t rows, size_t size, size_t row_stride,
+                          const std::vector<const TokenBitmask *> &masks);
+
+  // Name of the kernel selected for this CPU: "avx512", "avx2", "neon" or "scalar"
+  static const char *backend();
+};
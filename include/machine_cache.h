@@ -0,0 +1,95 @@
+#pragma once
+
+#include "state_machine.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace nb = nanobind;
+
+/**
+ * Thread-safe LRU cache of compiled state machines.
+ *
+ * Entries are keyed by a 64-bit key, by default the machine's structural
+ * fingerprint, and evicted least-recently-used first once their estimated
+ * memory exceeds the budget. Cached machines are shared between every caller
+ * that requests the same key, so they are frozen on insertion.
+ *
+ * Lookups match on the 64-bit key alone and never compare structure, so
+ * two different grammars whose fingerprints collide share one entry. Such a
+ * collision is very unlikely, but callers that must never receive another
+ * grammar should key the cache with a verified key of their own.
+ */
+class MachineCache
+{
+public:
+  static constexpr size_t DEFAULT_CAPACITY_BYTES = 256 * 1024 * 1024;
+
+  explicit MachineCache(size_t capacity_bytes = DEFAULT_CAPACITY_BYTES);
+
+  // Process-wide cache instance
+  static MachineCache &instance();
+
+  /**
+   * @brief Return the cached machine structurally identical to machine, inserting it if absent
+   * @param machine The freshly built machine; frozen only if it is inserted
+   * @return The shared machine for machine's fingerprint; see the class
+   *         comment on fingerprint collisions
+   */
+  nb::ref<StateMachine> intern(const nb::ref<StateMachine> &machine);
+
+  /**
+   * @brief Look up a machine by key
+   * @param key The cache key, e.g. a fingerprint or a caller-side schema hash
+   * @return The cached machine, or null if absent; matched on the key alone
+   */
+  nb::ref<StateMachine> get(uint64_t key);
+
+  /**
+   * @brief Insert or replace the machine stored under key
+   * @param key The cache key
+   * @param machine The machine to cache; frozen unless it is already stored under key
+   */
+  void put(uint64_t key, const nb::ref<StateMachine> &machine);
+
+  bool contains(uint64_t key) const;
+  void clear();
+
+  size_t size() const;
+  size_t memory_usage() const;
+  size_t capacity_bytes() const;
+  void set_capacity_bytes(size_t capacity_bytes);
+
+  size_t hits() const;
+  size_t misses() const;
+  size_t evictions() const;
+
+  /**
+   * @brief Estimate the heap footprint of the graph reachable from machine
+   * @param machine The root machine
+   * @return Approximate size in bytes
+   */
+  static size_t estimate_size(const StateMachine &machine);
+
+private:
+  struct Entry
+  {
+    uint64_t key;
+    nb::ref<StateMachine> machine;
+    size_t bytes;
+  };
+
+  // Unlinks entries over budget into evicted; released by the caller after unlocking.
+  void evict_locked(std::list<Entry> &evicted);
+
+  mutable std::mutex mutex_;
+  std::list<Entry> entries_;
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+  size_t capacity_bytes_;
+  size_t memory_usage_ = 0;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+  size_t evictions_ = 0;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/**
+ * Read-only memory mapping of a whole file.
+ *
+ * The pages are mapped shared, so every process reading the same file shares
+ * them. Throws std::runtime_error naming the file if it cannot be mapped.
+ */
+class MappedFile
+{
+public:
+  /**
+   * @param path The file to map
+   * @param what What the file holds, for error messages
+   */
+  MappedFile(const std::string &path, const std::string &what);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // Contents of the file; empty for an empty file
+  std::string_view data() const;
+
+private:
+  void *data_;
+  size_t size_ = 0;
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "token_bitmask.h"
+#include "token_mask_cache.h"
+#include "walker.h"
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nb = nanobind;
+
+// Walkers after a step and the allowed-token mask for the step after it
+struct MaskStep
+{
+  std::vector<nb::ref<Walker>> walkers;
+  std::shared_ptr<const TokenBitmask> mask;
+};
+
+/**
+ * Handle to a step computed in the background.
+ *
+ * Exceptions raised while advancing or computing the mask are rethrown by
+ * wait().
+ */
+class PendingMask
+{
+public:
+  explicit PendingMask(std::shared_future<MaskStep> future)
+      : future_(std::move(future)) {}
+
+  bool done() const;
+
+  /**
+   * @brief Block until the step has been computed
+   * @return The step; valid for as long as this handle
+   */
+  const MaskStep &wait() const;
+
+private:
+  std::shared_future<MaskStep> future_;
+};
+
+/**
+ * Computes token masks on background native threads.
+ *
+ * After sampling, the caller submits the token and gets a PendingMask right
+ * away; the walkers are advanced and the next mask is computed while the
+ * caller runs the next forward pass. Workers do not hold the GIL; walkers
+ * implemented in Python take it only for the duration of each call.
+ * Requests are started in submission order.
+ */
+class MaskPipeline
+{
+public:
+  /**
+   * @param vocabulary The token strings, indexed by token id
+   * @param num_threads Number of worker threads
+   * @param capacity_bytes Memory budget of the shared mask cache
+   */
+  explicit MaskPipeline(std::vector<std::string> vocabulary,
+                        size_t num_threads = 1,
+                        size_t capacity_bytes = TokenMaskCache::DEFAULT_CAPACITY_BYTES);
+  ~MaskPipeline();
+
+  MaskPipeline(const MaskPipeline &) = delete;
+  MaskPipeline &operator=(const MaskPipeline &) = delete;
+
+  /**
+   * @brief Advance the walkers with a sampled token and compute the next mask
+   * @param walkers The walkers before the token
+   * @param token The sampled token
+   * @return A handle to the walkers that consumed the whole token and their mask
+   */
+  PendingMask submit(std::vector<nb::ref<Walker>> walkers, std::string token);
+
+  /**
+   * @brief Compute the mask for the walkers as they are, e.g. before the first token
+   * @param walkers The current walkers
+   * @return A handle to the walkers and their mask
+   */
+  PendingMask submit_walkers(std::vector<nb::ref<Walker>> walkers);
+
+  /**
+   * @brief Finish queued requests and stop the workers
+   *
+   * Must be called without holding the GIL if walkers implemented in Python
+   * are still queued.
+   */
+  void close();
+
+  TokenMaskCache &cache() { return cache_; }
+
+  // Number of requests waiting for a worker
+  size_t pending() const;
+
+private:
+  PendingMask enqueue(std::function<MaskStep()> work);
+  void run();
+
+  TokenMaskCache cache_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<std::packaged_task<MaskStep()>> queue_;
+  std::vector<std::thread> workers_;
+  bool closed_ = false;
+};
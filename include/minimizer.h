@@ -0,0 +1,47 @@
+#pragma once
+
+#include "state_machine.h"
+#include <cstddef>
+
+namespace nb = nanobind;
+
+struct MinimizeStats
+{
+  size_t machines_before = 0;
+  size_t machines_after = 0;
+  size_t states_before = 0;
+  size_t states_after = 0;
+};
+
+/**
+ * Offline minimization of a state machine graph.
+ *
+ * Structurally identical sub-machines are hash-consed so that every edge to
+ * an equivalent machine points at one shared instance, and the states of
+ * deterministic plain StateMachine graphs are merged with partition
+ * refinement. Subclass graphs keep their states, since subclasses may refer
+ * to them by name, and subclasses are only shared when their type and
+ * fingerprint_key() agree, which by default holds for instances of one class
+ * with equal plain-data attributes. Machines on a reference cycle are never
+ * merged.
+ *
+ * The graph is rewritten in place and must not be in use by walkers.
+ * Frozen machines are refused with std::runtime_error; minimize before freezing.
+ */
+class StateMachineMinimizer
+{
+public:
+  /**
+   * @brief Minimize the graph reachable from root in place
+   * @param root The root state machine
+   * @return Machine and state counts before and after minimization
+   */
+  static MinimizeStats minimize(const nb::ref<StateMachine> &root);
+
+  /**
+   * @brief Merge equivalent states of a single deterministic machine
+   * @param machine The machine to rewrite
+   * @return True if any states were merged
+   */
+  static bool merge_equivalent_states(StateMachine &machine);
+};
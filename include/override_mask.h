@@ -0,0 +1,99 @@
+#pragma once
+
+#include <nanobind/nanobind.h>
+#include <nanobind/intrusive/counter.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace nb = nanobind;
+
+/**
+ * Which virtual methods the Python subclass of a trampoline overrides.
+ *
+ * NB_OVERRIDE takes the GIL and looks the method up on every call, even when
+ * the subclass leaves that method alone. Trampolines built with
+ * PSE_OVERRIDE instead resolve the overridden methods once per Python type
+ * into a bitmask, cache it in the instance, and call straight into C++ for
+ * every other method. The mask of a type is computed on the first call
+ * through any of its instances and kept for the life of the process, so
+ * methods assigned to the class after that call, or patched onto single
+ * instances, are never seen.
+ *
+ * The C++ implementation then runs without the GIL, on whatever thread
+ * called it. Only methods whose base implementation never touches the
+ * Python API, or takes the GIL itself where it does, may use PSE_OVERRIDE;
+ * the others keep NB_OVERRIDE, which holds the GIL for the base call too.
+ */
+class OverrideMask
+{
+public:
+  static constexpr size_t MAX_METHODS = 63;
+
+  /**
+   * @brief Whether the Python type of self overrides a method of Base
+   * @param self The trampoline instance
+   * @param names Overridable method names, indexed by slot
+   * @param slot Index of the method in names
+   * @return True if the type overrides it, or if self has no Python object yet
+   */
+  template <typename Base>
+  bool overrides(const nb::intrusive_base *self, std::span<const char *const> names, size_t slot) const
+  {
+    uint64_t mask = mask_.load(std::memory_order_relaxed);
+    if (mask == UNRESOLVED)
+    {
+      PyObject *py_self = self->self_py();
+      if (!py_self)
+      {
+        return true;
+      }
+      mask = resolve(Py_TYPE(py_self), &nb::type<Base>, names);
+      mask_.store(mask, std::memory_order_relaxed);
+    }
+    return (mask >> slot) & 1;
+  }
+
+  // Index of name in names, for use in constant expressions
+  static constexpr size_t slot_of(std::span<const char *const> names, const char *name)
+  {
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+      if (std::string_view(names[i]) == name)
+      {
+        return i;
+      }
+    }
+    throw "unknown override name";
+  }
+
+private:
+  static constexpr uint64_t UNRESOLVED = ~uint64_t(0);
+
+  // Looks the type up in the process-wide cache, computing it under the GIL on first use.
+  // base is only called then, since looking up the bound class needs the GIL too.
+  static uint64_t resolve(PyTypeObject *type, nb::handle (*base)(), std::span<const char *const> names);
+
+  mutable std::atomic<uint64_t> mask_{UNRESOLVED};
+};
+
+/**
+ * Drop-in replacements for NB_OVERRIDE_NAME and NB_OVERRIDE, for methods
+ * whose base implementation is safe to call without the GIL. The trampoline
+ * must declare `static constexpr const char *override_names[]` listing every
+ * such method and an `OverrideMask override_mask_` member.
+ */
+#define PSE_OVERRIDE_NAME(name, func, ...)                                                \
+  do                                                                                      \
+  {                                                                                       \
+    constexpr size_t pse_slot = OverrideMask::slot_of(override_names, name);              \
+    if (override_mask_.overrides<NBBase>(this, override_names, pse_slot))                 \
+    {                                                                                     \
+      NB_OVERRIDE_NAME(name, func, __VA_ARGS__);                                          \
+    }                                                                                     \
+    return NBBase::func(__VA_ARGS__);                                                     \
+  } while (false)
+
+#define PSE_OVERRIDE(func, ...) PSE_OVERRIDE_NAME(#func, func, __VA_ARGS__)
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <set>
+#include <utility>
+
+/**
+ * Copy-on-write std::set.
+ *
+ * Copies share the underlying set until one of them is modified, so cloning
+ * a walker no longer rebuilds its explored edges node by node. An empty set
+ * is just a null pointer. Modifications assume the caller is the only thread
+ * holding this copy, as with any other walker field.
+ */
+template <typename T>
+class SharedSet
+{
+public:
+  using Set = std::set<T>;
+  using const_iterator = typename Set::const_iterator;
+
+  SharedSet() = default;
+  SharedSet(Set values)
+      : values_(values.empty() ? nullptr : std::make_shared<Set>(std::move(values))) {}
+
+  const Set &get() const
+  {
+    static const Set empty;
+    return values_ ? *values_ : empty;
+  }
+
+  const_iterator begin() const { return get().begin(); }
+  const_iterator end() const { return get().end(); }
+  size_t size() const { return values_ ? values_->size() : 0; }
+  bool empty() const { return size() == 0; }
+  size_t count(const T &value) const { return values_ ? values_->count(value) : 0; }
+
+  void insert(const T &value) { mutable_set().insert(value); }
+
+  template <typename... Args>
+  void emplace(Args &&...args) { mutable_set().emplace(std::forward<Args>(args)...); }
+
+  void clear() { values_.reset(); }
+
+private:
+  Set &mutable_set()
+  {
+    if (!values_)
+    {
+      values_ = std::make_shared<Set>();
+    }
+    else if (values_.use_count() > 1)
+    {
+      values_ = std::make_shared<Set>(*values_);
+    }
+    return *values_;
+  }
+
+  std::shared_ptr<Set> values_;
+};
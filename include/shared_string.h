@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+
+/**
+ * Optional immutable string whose copies share one buffer.
+ *
+ * Stands in for std::optional<std::string> on walker fields that are copied
+ * on every clone but rarely change afterwards. Empty values cost nothing
+ * beyond the pointer, and assigning a new value never touches the copies.
+ */
+class SharedString
+{
+public:
+  SharedString() = default;
+  SharedString(std::nullopt_t) {}
+  SharedString(std::string value)
+      : value_(std::make_shared<const std::string>(std::move(value))) {}
+  SharedString(const std::optional<std::string> &value)
+      : value_(value ? std::make_shared<const std::string>(*value) : nullptr) {}
+
+  bool has_value() const { return value_ != nullptr; }
+  explicit operator bool() const { return value_ != nullptr; }
+
+  const std::string &operator*() const { return *value_; }
+  const std::string *operator->() const { return value_.get(); }
+
+  std::optional<std::string> to_optional() const
+  {
+    return value_ ? std::optional<std::string>(*value_) : std::nullopt;
+  }
+  operator std::optional<std::string>() const { return to_optional(); }
+
+  bool operator==(const SharedString &other) const
+  {
+    return value_ == other.value_ || (value_ && other.value_ && *value_ == *other.value_);
+  }
+
+private:
+  std::shared_ptr<const std::string> value_;
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Vector with inline storage for the first N elements.
+ *
+ * Walkers typically hold a handful of history entries and states a handful
+ * of edges, so keeping them inline removes most small heap allocations.
+ * Grows onto the heap past N, like std::vector; iterators are invalidated
+ * by any operation that changes the size. Sizes are 32-bit to keep the
+ * container small.
+ */
+template <typename T, size_t N>
+class SmallVector
+{
+public:
+  using value_type = T;
+  using size_type = size_t;
+  using reference = T &;
+  using const_reference = const T &;
+  using iterator = T *;
+  using const_iterator = const T *;
+
+  SmallVector() = default;
+
+  SmallVector(std::initializer_list<T> values)
+  {
+    reserve(values.size());
+    for (const auto &value : values)
+    {
+      push_back(value);
+    }
+  }
+
+  template <typename It, typename = typename std::iterator_traits<It>::iterator_category>
+  SmallVector(It first, It last)
+  {
+    insert(end(), first, last);
+  }
+
+  SmallVector(const SmallVector &other)
+  {
+    reserve(other.size_);
+    std::uninitialized_copy(other.begin(), other.end(), data());
+    size_ = other.size_;
+  }
+
+  SmallVector(SmallVector &&other) noexcept(std::is_nothrow_move_constructible_v<T>)
+  {
+    take(std::move(other));
+  }
+
+  ~SmallVector()
+  {
+    clear();
+    release_heap();
+  }
+
+  SmallVector &operator=(const SmallVector &other)
+  {
+    if (this != &other)
+    {
+      clear();
+      reserve(other.size_);
+      std::uninitialized_copy(other.begin(), other.end(), data());
+      size_ = other.size_;
+    }
+    return *this;
+  }
+
+  SmallVector &operator=(SmallVector &&other) noexcept(std::is_nothrow_move_constructible_v<T>)
+  {
+    if (this != &other)
+    {
+      clear();
+      release_heap();
+      take(std::move(other));
+    }
+    return *this;
+  }
+
+  T *data() { return heap_ ? heap_ : inline_data(); }
+  const T *data() const { return heap_ ? heap_ : inline_data(); }
+
+  iterator begin() { return data(); }
+  iterator end() { return data() + size_; }
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + size_; }
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return heap_ ? capacity_ : N; }
+  bool empty() const { return size_ == 0; }
+  // True while the elements still live in the inline buffer
+  bool is_inline() const { return heap_ == nullptr; }
+
+  T &operator[](size_t i) { return data()[i]; }
+  const T &operator[](size_t i) const { return data()[i]; }
+  T &front() { return data()[0]; }
+  const T &front() const { return data()[0]; }
+  T &back() { return data()[size_ - 1]; }
+  const T &back() const { return data()[size_ - 1]; }
+
+  void reserve(size_t capacity)
+  {
+    if (capacity > this->capacity())
+    {
+      grow(capacity);
+    }
+  }
+
+  void push_back(const T &value) { emplace_back(value); }
+  void push_back(T &&value) { emplace_back(std::move(value)); }
+
+  template <typename... Args>
+  T &emplace_back(Args &&...args)
+  {
+    if (size_ == capacity())
+    {
+      // The argument may alias an element, so construct it before moving.
+      T value(std::forward<Args>(args)...);
+      grow(capacity() * 2);
+      ::new (static_cast<void *>(data() + size_)) T(std::move(value));
+    }
+    else
+    {
+      ::new (static_cast<void *>(data() + size_)) T(std::forward<Args>(args)...);
+    }
+    return data()[size_++];
+  }
+
+  void pop_back()
+  {
+    data()[--size_].~T();
+  }
+
+  void clear()
+  {
+    std::destroy(begin(), end());
+    size_ = 0;
+  }
+
+  void resize(size_t size)
+  {
+    if (size < size_)
+    {
+      std::destroy(begin() + size, end());
+      size_ = static_cast<uint32_t>(size);
+      return;
+    }
+    reserve(size);
+    std::uninitialized_value_construct(end(), begin() + size);
+    size_ = static_cast<uint32_t>(size);
+  }
+
+  template <typename It>
+  iterator insert(const_iterator position, It first, It last)
+  {
+    size_t offset = static_cast<size_t>(position - begin());
+    size_t old_size = size_;
+    if constexpr (std::is_base_of_v<std::forward_iterator_tag, typename std::iterator_traits<It>::iterator_category>)
+    {
+      size_t count = static_cast<size_t>(std::distance(first, last));
+      if (size_ + count > capacity())
+      {
+        // The range may point into this vector, so copy it into the new
+        // buffer before the old elements move out.
+        size_t new_capacity = std::max(size_ + count, capacity() * 2);
+        T *heap = std::allocator<T>().allocate(new_capacity);
+        std::uninitialized_copy(first, last, heap + size_);
+        adopt(heap, new_capacity);
+        size_ = static_cast<uint32_t>(old_size + count);
+        std::rotate(begin() + offset, begin() + old_size, end());
+        return begin() + offset;
+      }
+    }
+    for (; first != last; ++first)
+    {
+      emplace_back(*first);
+    }
+    std::rotate(begin() + offset, begin() + old_size, end());
+    return begin() + offset;
+  }
+
+  iterator erase(const_iterator first, const_iterator last)
+  {
+    iterator target = begin() + (first - begin());
+    iterator source = begin() + (last - begin());
+    iterator new_end = std::move(source, end(), target);
+    std::destroy(new_end, end());
+    size_ = static_cast<uint32_t>(new_end - begin());
+    return target;
+  }
+
+  iterator erase(const_iterator position) { return erase(position, position + 1); }
+
+  bool operator==(const SmallVector &other) const
+  {
+    return std::equal(begin(), end(), other.begin(), other.end());
+  }
+
+private:
+  T *inline_data() { return std::launder(reinterpret_cast<T *>(storage_)); }
+  const T *inline_data() const { return std::launder(reinterpret_cast<const T *>(storage_)); }
+
+  void grow(size_t capacity)
+  {
+    capacity = std::max<size_t>(capacity, N + 1);
+    adopt(std::allocator<T>().allocate(capacity), capacity);
+  }
+
+  // Moves the elements to the front of heap and makes it the storage.
+  void adopt(T *heap, size_t capacity)
+  {
+    std::uninitialized_move(begin(), end(), heap);
+    std::destroy(begin(), end());
+    release_heap();
+    heap_ = heap;
+    capacity_ = static_cast<uint32_t>(capacity);
+  }
+
+  void release_heap()
+  {
+    if (heap_)
+    {
+      std::allocator<T>().deallocate(heap_, capacity_);
+      heap_ = nullptr;
+      capacity_ = 0;
+    }
+  }
+
+  // Expects this to be empty and inline.
+  void take(SmallVector &&other)
+  {
+    if (other.heap_)
+    {
+      heap_ = std::exchange(other.heap_, nullptr);
+      capacity_ = std::exchange(other.capacity_, 0);
+      size_ = std::exchange(other.size_, 0);
+      return;
+    }
+    std::uninitialized_move(other.begin(), other.end(), inline_data());
+    size_ = other.size_;
+    other.clear();
+  }
+
+  alignas(T) std::byte storage_[N * sizeof(T)];
+  T *heap_ = nullptr;
+  uint32_t size_ = 0;
+  uint32_t capacity_ = 0;
+};
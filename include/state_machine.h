@@ -1,9 +1,18 @@
 #pragma once
 
 #include <tsl/htrie_set.h>
+#include <atomic>
+#include <bitset>
+#include <cstdint>
+#include <functional>
+#include <mutex>
 #include <optional>
+#include <span>
 #include <string>
+#include <tuple>
+#include <typeinfo>
 #include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -11,6 +20,8 @@
 #include <nanobind/intrusive/counter.h>
 #include <nanobind/intrusive/ref.h>
 
+#include "small_vector.h"
+
 // Forward declaration
 class Walker;
 
@@ -23,6 +34,13 @@ public:
   using Edge = std::pair<nb::ref<StateMachine>, State>;
   using VisitedEdge = std::tuple<State, std::optional<State>, std::optional<std::string>>;
   using StateGraph = std::unordered_map<State, std::vector<Edge>>;
+  using Transition = std::tuple<nb::ref<Walker>, State, State>;
+  // Most states have only a few outgoing transitions, so they stay inline
+  using Transitions = SmallVector<Transition, 4>;
+  // One bit per byte value
+  using ByteSet = std::bitset<256>;
+  // Ranks walkers when advance() prunes; higher priorities are kept first
+  using WalkerPriority = std::function<double(const nb::ref<Walker> &)>;
 
   StateGraph state_graph_;
   State start_state_;
@@ -30,17 +48,159 @@ public:
   bool is_optional_;
   bool is_case_sensitive_;
 
+  // Process-unique and never reused, unlike the address, so it is safe to
+  // keep in cache keys that outlive the machine.
+  const uint64_t instance_id_;
+
+  // Upper bound on the walkers one advance() keeps alive; 0 means unbounded
+  size_t max_walkers_ = 0;
+  // Priority used when pruning; default_walker_priority() if empty
+  WalkerPriority walker_priority_;
+  // Walkers dropped by this machine's advance(), to find grammars that blow up
+  mutable std::atomic<size_t> pruned_walkers_{0};
+
+  /**
+   * Strong reference held by walkers and other engine-internal owners.
+   *
+   * Copying an nb::ref to a machine that has a Python object takes the GIL to
+   * adjust the Python refcount, and walkers copy their machine on every
+   * clone. A NativeRef instead bumps a native counter on the machine with a
+   * single atomic operation; the machine keeps one nb::ref to itself while
+   * that counter is nonzero, so Python only sees the first and last owner.
+   */
+  class NativeRef
+  {
+  public:
+    NativeRef() = default;
+    NativeRef(StateMachine *machine) : machine_(machine) { retain(); }
+    NativeRef(const nb::ref<StateMachine> &machine) : NativeRef(const_cast<StateMachine *>(machine.get())) {}
+    NativeRef(const NativeRef &other) : NativeRef(other.machine_) {}
+    NativeRef(NativeRef &&other) noexcept : machine_(std::exchange(other.machine_, nullptr)) {}
+    ~NativeRef() { release(); }
+
+    NativeRef &operator=(NativeRef other) noexcept
+    {
+      std::swap(machine_, other.machine_);
+      return *this;
+    }
+
+    StateMachine *get() const { return machine_; }
+    StateMachine *operator->() const { return machine_; }
+    StateMachine &operator*() const { return *machine_; }
+    explicit operator bool() const { return machine_ != nullptr; }
+    // Hands the machine to code that expects an ordinary reference, e.g. Python
+    nb::ref<StateMachine> ref() const { return nb::ref<StateMachine>(machine_); }
+
+    bool operator==(const NativeRef &other) const { return machine_ == other.machine_; }
+
+  private:
+    void retain()
+    {
+      if (machine_)
+      {
+        machine_->retain_native();
+      }
+    }
+    void release()
+    {
+      if (machine_)
+      {
+        std::exchange(machine_, nullptr)->release_native();
+      }
+    }
+
+    StateMachine *machine_ = nullptr;
+  };
+
+  /**
+   * Overrides max_walkers_ and walker_priority_ for every advance() on this
+   * thread, nested machines included, for as long as it is alive.
+   */
+  class PruneScope
+  {
+  public:
+    explicit PruneScope(size_t max_walkers, WalkerPriority priority = {});
+    ~PruneScope();
+
+    PruneScope(const PruneScope &) = delete;
+    PruneScope &operator=(const PruneScope &) = delete;
+
+    static const PruneScope *current();
+
+    const size_t max_walkers;
+    const WalkerPriority priority;
+
+  private:
+    const PruneScope *previous_;
+  };
+
   StateMachine(StateGraph &&state_graph = StateGraph(),
                State start_state = 0, std::vector<State> &&end_states = {"$"},
                bool is_optional = false, bool is_case_sensitive = true);
 
-  virtual ~StateMachine() = default;
+  StateMachine(const StateMachine &other);
+
+  virtual ~StateMachine();
 
   bool is_optional() const { return is_optional_; }
-  void is_optional(bool value) { is_optional_ = value; }
+  void is_optional(bool value)
+  {
+    check_mutable();
+    is_optional_ = value;
+  }
 
   bool is_case_sensitive() const { return is_case_sensitive_; }
-  void is_case_sensitive(bool value) { is_case_sensitive_ = value; }
+  void is_case_sensitive(bool value)
+  {
+    check_mutable();
+    is_case_sensitive_ = value;
+  }
+
+  /**
+   * @brief Make this machine and every machine reachable from it immutable
+   *
+   * Afterwards the setters and the minimizer raise instead of modifying the
+   * graph, the fingerprint is computed once and memoized, and the machine
+   * can be shared and advanced by many threads at once. Only those setters
+   * check the flag: attributes of Python subclasses stay writable, and the
+   * machine is only safe to share if callers leave them alone as well.
+   * Freezing cannot be undone; copies of a frozen machine start out mutable.
+   */
+  void freeze();
+  bool is_frozen() const { return frozen_.load(std::memory_order_acquire); }
+
+  // Throws std::runtime_error if the machine is frozen
+  void check_mutable() const;
+
+  /**
+   * @brief Bytes a token consumed by this machine can start with
+   * @return Every possible first byte, in any order, or nullopt if unknown
+   *
+   * Plain machines, and subclasses with a graph and the default traversal,
+   * derive the set from their graph. Leaf subclasses should override this
+   * so that branching can skip their edges without creating walkers;
+   * returning more bytes than needed is always safe.
+   */
+  virtual std::optional<std::string> first_bytes() const;
+
+  /**
+   * @brief Whether a token starting with byte can start a transition into this machine
+   *
+   * Answered from the lookahead sets computed on first use, which only
+   * frozen machines keep; mutable machines always answer true.
+   */
+  bool may_start_with(uint8_t byte) const;
+
+  /**
+   * @brief Whether this machine can be skipped or finish without consuming anything
+   *
+   * Taken from the lookahead sets like may_start_with(), so mutable
+   * machines conservatively answer true.
+   */
+  bool is_nullable() const;
+
+  // True for plain StateMachine instances, false for C++ or Python subclasses
+  bool is_native() const { return typeid(*this) == typeid(StateMachine); }
 
   virtual nb::ref<Walker> get_new_walker(std::optional<State> state = std::nullopt);
   virtual std::vector<nb::ref<Walker>> get_walkers(std::optional<State> state = std::nullopt);
@@ -49,6 +209,110 @@ public:
   virtual std::vector<nb::ref<Walker>> branch_walker(nb::ref<Walker> walker, std::optional<std::string> token = std::nullopt);
   virtual std::vector<nb::ref<Walker>> advance(nb::ref<Walker> walker, const std::string &token) const;
 
+  /**
+   * @brief Branch a walker, appending the results to out
+   * @param walker The walker to branch
+   * @param token Optional token to branch on
+   * @param out Receives the branched walkers
+   */
+  void branch_walker_into(nb::ref<Walker> walker, const std::optional<std::string> &token, std::vector<nb::ref<Walker>> &out);
+
+  /**
+   * @brief Outgoing edges of a state, viewed in place in the state graph
+   * @param state The source state
+   * @return A span that stays valid until the state graph is modified
+   *
+   * Unlike get_edges() this neither copies nor dispatches to overrides.
+   */
+  std::span<const Edge> edges_of(State state) const;
+
+  /**
+   * @brief Collect the transitions get_transitions() would return, appending to out
+   * @param walker The walker to transition from
+   * @param state The state to transition from
+   * @param out Receives the transitions
+   * @param first_byte If set, skip edges whose machine cannot start with this byte
+   */
+  void transitions_into(const nb::ref<Walker> &walker, const State &state, Transitions &out,
+                        std::optional<uint8_t> first_byte = std::nullopt) const;
+
+  /**
+   * @brief Advance a walker, appending the results to out
+   * @param walker The walker to advance
+   * @param token The token to consume
+   * @param out Receives the advanced walkers
+   *
+   * The breadth-first search runs in per-thread scratch buffers, one frame
+   * per nesting level, so a steady-state advance allocates nothing but the
+   * walkers it creates.
+   */
+  void advance_into(nb::ref<Walker> walker, const std::string &token, std::vector<nb::ref<Walker>> &out) const;
+
+  /**
+   * @brief Whether advance() would return a walker with no input left over
+   * @param walker The walker to advance
+   * @param token The token to consume
+   *
+   * Runs the same transitions as advance_into(), depth-first, and returns
+   * at the first success without wrapping or keeping any result. Nested
+   * machines still advance in full. When pruning is in effect the answer
+   * depends on the walkers pruning keeps, so it falls back to advance_into().
+   */
+  bool can_advance(nb::ref<Walker> walker, const std::string &token) const;
+
+  /**
+   * @brief Default pruning priority
+   * @param walker The walker to rank
+   * @return Higher for accepted walkers, then for fewer nested transitions, then for less pending input
+   */
+  static double default_walker_priority(const nb::ref<Walker> &walker);
+
+  /**
+   * @brief Enumerate every state machine reachable through the state graph
+   * @return The machines in a deterministic traversal order; this machine is always first
+   */
+  std::vector<StateMachine *> collect_state_machines() const;
+
+  /**
+   * @brief Structural fingerprint of the graph reachable from this machine
+   * @return A stable 64-bit hash of states, edges, sub-machine fingerprints and flags
+   *
+   * Machines with equal fingerprints behave identically, which makes the
+   * fingerprint usable as a cache key where operator== is not. A machine
+   * with a custom walker_priority_ only matches itself.
+   */
+  uint64_t fingerprint() const;
+
+  /**
+   * @brief Identify configuration held outside the state graph
+   * @return A key mixed into fingerprint(); subclasses whose parameters are
+   *         not plain instance attributes should override this
+   *
+   * The default is empty for plain machines. For subclasses it encodes the
+   * class and its instance attributes when they are all plain data (None,
+   * bools, numbers, strings, bytes, and lists or tuples of those), so equal
+   * grammars built twice share a key. Subclasses that override the graph
+   * traversal (see overrides_graph()), use __slots__ or hold any other
+   * attribute fall back to the instance identity and are never conflated.
+   * Returning custom walkers alone keeps the structural key, since the class
+   * decides which walker is created.
+   */
+  virtual std::string fingerprint_key() const;
+
+  /**
+   * @brief Whether walkers may leave this machine's state_graph_ behind
+   * @return True if overrides_graph() holds or get_new_walker is replaced,
+   *         so the graph alone does not describe the input it consumes
+   */
+  virtual bool overrides_traversal() const;
+
+  /**
+   * @brief Whether the graph walk itself is replaced
+   * @return True if get_walkers, get_edges, get_transitions, advance or
+   *         branch_walker are replaced
+   */
+  virtual bool overrides_graph() const;
+
   virtual bool operator==(const StateMachine &other) const;
   virtual std::string to_string() const;
 
@@ -83,6 +347,86 @@ public:
       std::vector<nb::ref<Walker>> &walkers,
       const std::string &token);
 
+  /**
+   * @brief Feed a sequence of tokens through the walkers in one call
+   * @param walkers The starting walkers
+   * @param tokens The tokens, in order
+   * @param steps If set, receives the walkers after each consumed token
+   * @return The final walkers, or none if some token was rejected
+   *
+   * Each step keeps the walkers that consume the whole token, as in
+   * advance_all(), and collapses walkers equal to an earlier one before the
+   * next token, so ambiguity does not compound over long prefixes. Tokens
+   * that end inside a UTF-8 character are joined with the tokens that
+   * complete it, and the walkers of such a step are those of the previous one.
+   * A last token that leaves a character unfinished rejects the sequence.
+   */
+  static std::vector<nb::ref<Walker>> consume_tokens(
+      const std::vector<nb::ref<Walker>> &walkers,
+      const std::vector<std::string> &tokens,
+      std::vector<std::vector<nb::ref<Walker>>> *steps = nullptr);
+
+  /**
+   * @brief consume_tokens() for token ids
+   * @param vocabulary The token strings, indexed by token id
+   *
+   * Throws std::out_of_range if an id is outside the vocabulary.
+   */
+  static std::vector<nb::ref<Walker>> consume_tokens(
+      const std::vector<nb::ref<Walker>> &walkers,
+      const std::vector<uint32_t> &token_ids,
+      const std::vector<std::string> &vocabulary,
+      std::vector<std::vector<nb::ref<Walker>>> *steps = nullptr);
+
+  /**
+   * @brief Feed text through the walkers in chunks of at most chunk_bytes
+   * @param walkers The starting walkers
+   * @param text The text to consume
+   * @param chunk_bytes Upper bound on the chunk size, in bytes; chunks never split a UTF-8 sequence
+   * @return The final walkers, or none if the text was rejected
+   */
+  static std::vector<nb::ref<Walker>> consume_text(
+      const std::vector<nb::ref<Walker>> &walkers,
+      const std::string &text,
+      size_t chunk_bytes = 64);
+
+  /**
+   * @brief Whether any walker can consume the token in full
+   * @param walkers The current walkers
+   * @param token The token to test
+   */
+  static bool can_consume(std::vector<nb::ref<Walker>> &walkers, const std::string &token);
+
+  /**
+   * @brief Whether any walker has reached an accept state, so the sequence may end here
+   * @param walkers The current walkers
+   */
+  static bool can_end(const std::vector<nb::ref<Walker>> &walkers);
+
+  /**
+   * @brief Find the continuation forced by the grammar and advance through it
+   * @param walkers The current walkers
+   * @param max_length Upper bound on the length of the forced string, in bytes
+   * @return The forced string and the walkers after consuming it
+   *
+   * The forced string is the longest common prefix of every walker's valid
+   * continuations, repeated until the walkers diverge, one of them can accept
+   * any token, or one of them could end here.
+   */
+  static std::pair<std::string, std::vector<nb::ref<Walker>>> jump_forward(
+      std::vector<nb::ref<Walker>> &walkers,
+      size_t max_length = 256);
+
+  /**
+   * @brief Check a batch of draft tokens against the walkers
+   * @param walkers The current walkers
+   * @param tokens The draft tokens, in order
+   * @return The number of accepted tokens and the walkers after each accepted token
+   */
+  static std::pair<size_t, std::vector<std::vector<nb::ref<Walker>>>> verify_draft(
+      std::vector<nb::ref<Walker>> &walkers,
+      const std::vector<std::string> &tokens);
+
   /**
    * @brief Convert a state to a string
    * @param state The state to convert
@@ -102,4 +446,29 @@ public:
                         } }, state);
   }
 
+private:
+  struct Lookahead;
+
+  // The lookahead of a frozen machine, computed for its whole graph on first use; null if mutable
+  const Lookahead *lookahead() const;
+
+  // Whether the lookahead follows from state_graph_ rather than from first_bytes()
+  bool derives_lookahead() const;
+
+  // Lookahead of every machine reachable from root, solved as one fixed point
+  static void compute_lookahead(const StateMachine &root, std::unordered_map<const StateMachine *, Lookahead> &out);
+
+  void retain_native();
+  void release_native();
+
+  // Owners holding this machine through NativeRef; self_ref_ is set while nonzero
+  std::atomic<size_t> native_refs_{0};
+  std::mutex native_mutex_;
+  nb::ref<StateMachine> self_ref_;
+
+  std::atomic<bool> frozen_{false};
+  // fingerprint() of a frozen machine, 0 until first computed
+  mutable std::atomic<uint64_t> frozen_fingerprint_{0};
+  // Owned; published once, after which it never changes
+  mutable std::atomic<const Lookahead *> lookahead_{nullptr};
 };
@@ -1,48 +1,89 @@
 #pragma once
 #include <nanobind/trampoline.h>
+#include <initializer_list>
+#include "override_mask.h"
 #include "state_machine.h"
 #include "walker.h"
 
 class PyStateMachine : public StateMachine
 {
-    NB_TRAMPOLINE(StateMachine, 8);
+    NB_TRAMPOLINE(StateMachine, 10);
+
+    // Methods whose base runs without the GIL, by Python name; see OverrideMask
+    static constexpr const char *override_names[] = {
+        "get_new_walker", "get_walkers", "get_edges", "get_transitions", "advance",
+        "branch_walker", "fingerprint_key", "first_bytes", "__eq__"};
+    OverrideMask override_mask_;
 
     nb::ref<Walker> get_new_walker(std::optional<State> state = std::nullopt) override
     {
-        NB_OVERRIDE(get_new_walker, state);
+        PSE_OVERRIDE(get_new_walker, state);
     }
 
     std::vector<nb::ref<Walker>> get_walkers(std::optional<State> state = std::nullopt) override
     {
-        NB_OVERRIDE(get_walkers, state);
+        PSE_OVERRIDE(get_walkers, state);
     }
 
     std::vector<Edge> get_edges(State state) const override
     {
-        NB_OVERRIDE(get_edges, state);
+        PSE_OVERRIDE(get_edges, state);
     }
 
     std::vector<std::tuple<nb::ref<Walker>, State, State>> get_transitions(
         nb::ref<Walker> walker, std::optional<State> state = std::nullopt) const override
     {
-        NB_OVERRIDE(get_transitions, walker, state);
+        PSE_OVERRIDE(get_transitions, walker, state);
     }
 
     std::vector<nb::ref<Walker>> advance(nb::ref<Walker> walker, const std::string &token) const override
     {
-        NB_OVERRIDE(advance, walker, token);
+        PSE_OVERRIDE(advance, walker, token);
     }
 
     std::vector<nb::ref<Walker>> branch_walker(nb::ref<Walker> walker, std::optional<std::string> token = std::nullopt) override
     {
-        NB_OVERRIDE(branch_walker, walker, token);
+        PSE_OVERRIDE(branch_walker, walker, token);
+    }
+
+    std::string fingerprint_key() const override
+    {
+        PSE_OVERRIDE(fingerprint_key);
+    }
+
+    std::optional<std::string> first_bytes() const override
+    {
+        PSE_OVERRIDE(first_bytes);
     }
 
     bool operator==(const StateMachine &other) const override
     {
-        NB_OVERRIDE_NAME("__eq__", operator==, other);
+        PSE_OVERRIDE_NAME("__eq__", operator==, other);
+    }
+
+    bool overrides_traversal() const override
+    {
+        return overrides_graph() || overrides_any({"get_new_walker"});
+    }
+
+    bool overrides_graph() const override
+    {
+        return overrides_any({"get_walkers", "get_edges", "get_transitions", "advance", "branch_walker"});
+    }
+
+    bool overrides_any(std::initializer_list<const char *> names) const
+    {
+        for (const char *name : names)
+        {
+            if (override_mask_.overrides<NBBase>(this, override_names, OverrideMask::slot_of(override_names, name)))
+            {
+                return true;
+            }
+        }
+        return false;
     }
 
+    // The base looks up the Python class name, so this keeps NB_OVERRIDE
     std::string to_string() const override
     {
         NB_OVERRIDE_NAME("__repr__", to_string);
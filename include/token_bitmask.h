@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Packed set of allowed token ids, one bit per vocabulary entry stored in
+ * 32-bit words (bit i of word i / 32 is token i).
+ */
+class TokenBitmask
+{
+public:
+  explicit TokenBitmask(size_t size = 0, bool value = false);
+
+  size_t size() const { return size_; }
+
+  bool test(size_t id) const
+  {
+    return id < size_ && (words_[id >> 5] >> (id & 31)) & 1u;
+  }
+
+  void set(size_t id) { words_[id >> 5] |= 1u << (id & 31); }
+  void reset(size_t id) { words_[id >> 5] &= ~(1u << (id & 31)); }
+
+  // Set every bit
+  void set_all();
+
+  TokenBitmask &operator|=(const TokenBitmask &other);
+  TokenBitmask &operator&=(const TokenBitmask &other);
+  bool operator==(const TokenBitmask &other) const = default;
+
+  // Number of allowed tokens
+  size_t count() const;
+
+  bool any() const;
+  std::vector<uint32_t> allowed_ids() const;
+
+  const std::vector<uint32_t> &words() const { return words_; }
+  std::vector<uint32_t> &words() { return words_; }
+
+  size_t memory_usage() const { return sizeof(TokenBitmask) + words_.capacity() * sizeof(uint32_t); }
+
+private:
+  // Clear the padding bits past size_ in the last word
+  void trim();
+
+  size_t size_;
+  std::vector<uint32_t> words_;
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "state_machine.h"
+#include "token_bitmask.h"
+#include "walker.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace nb = nanobind;
+
+/**
+ * Vocabulary split for one leaf walker position.
+ *
+ * Accepted tokens are consumed completely by the leaf, so every walker whose
+ * innermost transition is at this position accepts them, unless a custom
+ * ancestor or completion check can veto; those are rechecked. Dependent tokens
+ * are either consumed partially or could follow the end of the leaf, so the
+ * enclosing machines decide. All other tokens are rejected.
+ */
+struct TokenClassification
+{
+  TokenBitmask accepted;
+  std::vector<uint32_t> dependent;
+
+  size_t memory_usage() const { return accepted.memory_usage() + dependent.capacity() * sizeof(uint32_t); }
+};
+
+/**
+ * Per-leaf-state classification of a vocabulary.
+ *
+ * Masks are assembled from the classification of each walker's innermost
+ * leaf, and only dependent tokens are walked through the full stack, so the
+ * cost of a mask scales with the dependent set instead of the vocabulary.
+ * Classifications are memoized by the leaf walker's signature().
+ *
+ * Tokens that are not valid UTF-8 on their own, such as byte-fallback tokens
+ * for part of a character, are always masked out without asking any walker:
+ * Python subclasses could not receive them as str. Constrained output can
+ * therefore only contain characters the vocabulary has whole tokens for.
+ */
+class TokenClassifier
+{
+public:
+  static constexpr size_t DEFAULT_MAX_STATES = 4096;
+
+  /**
+   * @param vocabulary The token strings, indexed by token id
+   * @param max_states Number of leaf positions to memoize; later ones are classified but not kept
+   */
+  explicit TokenClassifier(std::vector<std::string> vocabulary,
+                           size_t max_states = DEFAULT_MAX_STATES);
+
+  /**
+   * @brief Classify the start positions of every leaf machine reachable from root
+   * @param root The root state machine
+   * @return Number of leaf positions classified
+   */
+  size_t precompute(const nb::ref<StateMachine> &root);
+
+  /**
+   * @brief Classify the vocabulary for a leaf walker, memoizing the result
+   * @param leaf A walker of a leaf machine
+   * @return The accepted and dependent tokens at the leaf's position
+   */
+  std::shared_ptr<const TokenClassification> classify(nb::ref<Walker> leaf);
+
+  /**
+   * @brief Compute the tokens that at least one walker consumes completely
+   * @param walkers The current walkers
+   * @return The allowed-token mask
+   */
+  TokenBitmask compute_mask(std::vector<nb::ref<Walker>> &walkers);
+
+  const std::vector<std::string> &vocabulary() const { return vocabulary_; }
+
+  // Number of memoized leaf positions
+  size_t size() const;
+  size_t memory_usage() const;
+  void clear();
+
+private:
+  TokenClassification classify_uncached(nb::ref<Walker> leaf) const;
+
+  const std::vector<std::string> vocabulary_;
+  // Tokens walkers are asked about: non-empty and valid UTF-8
+  TokenBitmask candidates_;
+  const size_t max_states_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<uint64_t, std::shared_ptr<const TokenClassification>> states_;
+  size_t memory_usage_ = 0;
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "token_bitmask.h"
+#include "token_classifier.h"
+#include "walker.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace nb = nanobind;
+
+/**
+ * Cache of allowed-token masks keyed by the signature of a walker set.
+ *
+ * Generation keeps returning to the same grammar positions (inside a string
+ * value, after a comma in an object), and every walker set at such a
+ * position accepts the same tokens. The mask for a set is computed once over
+ * the whole vocabulary and reused until it is evicted, least-recently-used
+ * first, once the cached masks exceed the memory budget. Misses are computed
+ * through a TokenClassifier, so only context-dependent tokens are walked.
+ *
+ * Entries made by get_or_compute() keep the sorted walker signatures they
+ * were computed for, and a hit must match them exactly, so walker sets whose
+ * combined keys collide never share a mask. Each Walker::signature() is
+ * still a 64-bit hash, so two positions whose walker signatures collide
+ * would share one. get() and put() take the caller's key as given.
+ */
+class TokenMaskCache
+{
+public:
+  static constexpr size_t DEFAULT_CAPACITY_BYTES = 64 * 1024 * 1024;
+
+  /**
+   * @param vocabulary The token strings, indexed by token id
+   * @param capacity_bytes Memory budget for cached masks
+   */
+  explicit TokenMaskCache(std::vector<std::string> vocabulary,
+                          size_t capacity_bytes = DEFAULT_CAPACITY_BYTES);
+
+  /**
+   * @brief Canonical signature of a walker set
+   * @param walkers The walkers
+   * @return Order- and duplicate-insensitive combination of Walker::signature()
+   */
+  static uint64_t signature(const std::vector<nb::ref<Walker>> &walkers);
+
+  /**
+   * @brief Return the mask for the walkers, computing and caching it on a miss
+   * @param walkers The current walkers
+   * @return The tokens that at least one walker consumes completely
+   */
+  std::shared_ptr<const TokenBitmask> get_or_compute(std::vector<nb::ref<Walker>> &walkers);
+
+  /**
+   * @brief Compute the mask for the walkers without touching the cache
+   * @param walkers The current walkers
+   * @return The tokens that at least one walker consumes completely
+   */
+  TokenBitmask compute(std::vector<nb::ref<Walker>> &walkers);
+
+  // Cached mask for a key, or null if absent; not checked against any walkers
+  std::shared_ptr<const TokenBitmask> get(uint64_t key);
+  void put(uint64_t key, TokenBitmask mask);
+
+  bool contains(uint64_t key) const;
+  void clear();
+
+  const std::vector<std::string> &vocabulary() const { return classifier_.vocabulary(); }
+  TokenClassifier &classifier() { return classifier_; }
+
+  size_t size() const;
+  size_t memory_usage() const;
+  size_t capacity_bytes() const;
+  void set_capacity_bytes(size_t capacity_bytes);
+
+  size_t hits() const;
+  size_t misses() const;
+  size_t evictions() const;
+  double hit_rate() const;
+
+private:
+  struct Entry
+  {
+    uint64_t key;
+    std::shared_ptr<const TokenBitmask> mask;
+    // Sorted, distinct walker signatures the mask was computed for; empty for put()
+    std::vector<uint64_t> signatures;
+    size_t bytes;
+  };
+
+  // Sorted, distinct Walker::signature() values of a walker set
+  static std::vector<uint64_t> sorted_signatures(const std::vector<nb::ref<Walker>> &walkers);
+  static uint64_t combine_signatures(const std::vector<uint64_t> &signatures);
+
+  void insert_locked(uint64_t key, std::shared_ptr<const TokenBitmask> mask, std::vector<uint64_t> signatures = {});
+  void evict_locked();
+
+  TokenClassifier classifier_;
+
+  mutable std::mutex mutex_;
+  std::list<Entry> entries_;
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+  size_t capacity_bytes_;
+  size_t memory_usage_ = 0;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+  size_t evictions_ = 0;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <tsl/htrie_set.h>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Token strings of a tokenizer vocabulary, as the bytes they decode to.
+ *
+ * Tokenizers store some pieces in an encoded form: SentencePiece writes a
+ * leading space as U+2581 ("▁"), and byte-fallback tokens such as "<0x0A>"
+ * stand for a single raw byte, possibly half of a UTF-8 character. The
+ * vocabulary decodes every piece once when it is built, and keeps a trie of
+ * the decoded tokens for StateMachine::advance_all().
+ */
+class TokenVocabulary
+{
+public:
+  /**
+   * @param pieces The token strings, indexed by token id
+   * @param decode Whether to decode the pieces; false keeps them as they are
+   */
+  explicit TokenVocabulary(std::vector<std::string> pieces, bool decode = true);
+
+  /**
+   * @brief Bytes a single piece stands for
+   * @param piece A token string as stored by the tokenizer
+   * @return The byte for "<0xNN>", otherwise the piece with "▁" replaced by spaces
+   */
+  static std::string decode_token(std::string_view piece);
+
+  // Decoded tokens, indexed by token id
+  const std::vector<std::string> &tokens() const { return tokens_; }
+  const std::string &token(size_t id) const;
+
+  // Trie of the non-empty decoded tokens
+  const tsl::htrie_set<char> &trie() const { return trie_; }
+
+  bool contains(std::string_view token) const;
+  size_t size() const { return tokens_.size(); }
+
+private:
+  std::vector<std::string> tokens_;
+  tsl::htrie_set<char> trie_;
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+// Helpers for byte-level tokens, which may end in the middle of a UTF-8
+// character that the next token completes.
+
+/**
+ * @brief Length of the longest prefix that does not end inside a multi-byte character
+ * @param bytes The bytes to split
+ * @return bytes.size() unless the bytes end with an unfinished character
+ *
+ * Only the start of a well-formed character is held back; bytes that cannot
+ * become valid UTF-8 are left in place for the walkers to reject.
+ */
+inline size_t utf8_complete_length(std::string_view bytes)
+{
+  auto is_continuation = [&](size_t i)
+  { return (static_cast<unsigned char>(bytes[i]) & 0xC0) == 0x80; };
+
+  // A character is at most four bytes, so its lead byte is among the last four.
+  size_t lead = bytes.size();
+  while (lead > 0 && bytes.size() - lead < 3 && is_continuation(lead - 1))
+  {
+    --lead;
+  }
+  if (lead == 0)
+  {
+    return bytes.size();
+  }
+  --lead;
+
+  unsigned char byte = static_cast<unsigned char>(bytes[lead]);
+  size_t expected = 1;
+  if (byte >= 0xC2 && byte <= 0xDF)
+  {
+    expected = 2;
+  }
+  else if (byte >= 0xE0 && byte <= 0xEF)
+  {
+    expected = 3;
+  }
+  else if (byte >= 0xF0 && byte <= 0xF4)
+  {
+    expected = 4;
+  }
+  return bytes.size() - lead < expected ? lead : bytes.size();
+}
+
+/**
+ * @brief Whether bytes are well-formed UTF-8, i.e. decode to a Python str
+ * @param bytes The bytes to check
+ * @return False for truncated, overlong or surrogate sequences and stray continuation bytes
+ */
+inline bool utf8_is_valid(std::string_view bytes)
+{
+  size_t i = 0;
+  while (i < bytes.size())
+  {
+    unsigned char byte = static_cast<unsigned char>(bytes[i]);
+    size_t length = 1;
+    // Bounds of the second byte, which also rule out overlong forms and surrogates
+    unsigned char low = 0x80, high = 0xBF;
+    if (byte < 0x80)
+    {
+      ++i;
+      continue;
+    }
+    else if (byte >= 0xC2 && byte <= 0xDF)
+    {
+      length = 2;
+    }
+    else if (byte >= 0xE0 && byte <= 0xEF)
+    {
+      length = 3;
+      low = byte == 0xE0 ? 0xA0 : 0x80;
+      high = byte == 0xED ? 0x9F : 0xBF;
+    }
+    else if (byte >= 0xF0 && byte <= 0xF4)
+    {
+      length = 4;
+      low = byte == 0xF0 ? 0x90 : 0x80;
+      high = byte == 0xF4 ? 0x8F : 0xBF;
+    }
+    else
+    {
+      return false;
+    }
+    if (bytes.size() - i < length)
+    {
+      return false;
+    }
+    unsigned char second = static_cast<unsigned char>(bytes[i + 1]);
+    if (second < low || second > high)
+    {
+      return false;
+    }
+    for (size_t k = 2; k < length; ++k)
+    {
+      if ((static_cast<unsigned char>(bytes[i + k]) & 0xC0) != 0x80)
+      {
+        return false;
+      }
+    }
+    i += length;
+  }
+  return true;
+}
+
+/**
+ * @brief End of a chunk of at most max_bytes that starts at begin and ends on a character boundary
+ * @param text The text to split
+ * @param begin Start of the chunk
+ * @param max_bytes Upper bound on the chunk size; a longer single character is returned whole
+ * @return One past the last byte of the chunk
+ */
+inline size_t utf8_chunk_end(std::string_view text, size_t begin, size_t max_bytes)
+{
+  auto is_continuation = [&](size_t i)
+  { return (static_cast<unsigned char>(text[i]) & 0xC0) == 0x80; };
+
+  size_t end = begin + max_bytes < text.size() ? begin + max_bytes : text.size();
+  while (end < text.size() && end > begin && is_continuation(end))
+  {
+    --end;
+  }
+  if (end == begin && begin < text.size())
+  {
+    ++end;
+    while (end < text.size() && is_continuation(end))
+    {
+      ++end;
+    }
+  }
+  return end;
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "shared_set.h"
+#include "shared_string.h"
+#include "small_vector.h"
 #include "state_machine.h"
 #include <nanobind/nanobind.h>
 #include <nanobind/intrusive/counter.h>
@@ -11,27 +14,42 @@
 #include <tuple>
 #include <vector>
 #include <any>
+#include <cstdint>
 
 namespace nb = nanobind;
 
+// Built-in walker types, which hot loops call without virtual dispatch
+enum class WalkerKind : uint8_t
+{
+    Native,   // A plain Walker
+    Accepted, // An AcceptedState
+    Custom    // Any other C++ or Python subclass
+};
+
 class Walker : public nb::intrusive_base
 {
 public:
     using State = StateMachine::State;
     using VisitedEdge = std::tuple<State, std::optional<State>, std::optional<std::string>>;
-
-    nb::ref<StateMachine> state_machine_;
-    std::vector<nb::ref<Walker>> accepted_history_;
-    std::set<VisitedEdge> explored_edges_;
+    // Walkers rarely accept more than a few values per nesting level
+    using History = SmallVector<nb::ref<Walker>, 4>;
+
+    // Fields are ordered and typed to keep walkers small; see the sizeof check in walker.cpp.
+    // Explored edges and strings are shared between clones until one of them changes.
+    StateMachine::NativeRef state_machine_;
+    History accepted_history_;
+    SharedSet<VisitedEdge> explored_edges_;
     State current_state_;
     std::optional<State> target_state_;
     nb::ref<Walker> transition_walker_;
+    SharedString remaining_input_;
+    SharedString _raw_value_;
     size_t consumed_character_count_;
-    std::optional<std::string> remaining_input_;
-    std::optional<std::string> _raw_value_;
     bool _accepts_more_input_;
+    // Set by the code that creates built-in walkers; see walker_dispatch.h
+    WalkerKind kind_ = WalkerKind::Custom;
 
-    Walker(nb::ref<StateMachine> state_machine, std::optional<State> current_state = std::nullopt);
+    Walker(StateMachine::NativeRef state_machine, std::optional<State> current_state = std::nullopt);
     virtual ~Walker() = default;
 
     virtual std::vector<nb::ref<Walker>> consume_token(const std::string &token);
@@ -42,10 +60,29 @@ public:
     virtual bool should_complete_transition() const;
     virtual bool has_reached_accept_state() const;
 
+    /**
+     * @brief Whether should_complete_transition() may differ from the plain walker's
+     *
+     * Precomputed per-leaf results assume a leaf that consumed a token is
+     * never vetoed when its transition completes; this reports when they cannot.
+     */
+    virtual bool overrides_completion() const;
+
     virtual bool accepts_any_token() const;
     virtual std::vector<std::string> get_valid_continuations(int depth = 0) const;
     virtual std::set<std::string> find_valid_prefixes(const tsl::htrie_set<char> &trie);
 
+    /**
+     * @brief Hash of everything that decides which input this walker accepts next
+     * @return A 64-bit signature; walkers with equal signatures accept the same tokens
+     *
+     * Values accumulated by plain walkers are left out, so every walker at the
+     * same grammar position shares a signature. Subclasses are assumed to
+     * depend on their raw value and consumed character count unless they
+     * override this, e.g. a leaf that only needs its position in a fixed text.
+     */
+    virtual uint64_t signature() const;
+
     virtual nb::object parse_value(const std::optional<std::string> &value) const;
 
     virtual nb::ref<Walker> clone() const;
@@ -60,6 +97,35 @@ public:
 
     std::vector<nb::ref<Walker>> branch(const std::optional<std::string> &token = std::nullopt);
 
+    /**
+     * @brief Branch into out instead of a fresh vector
+     * @param token Optional token to branch on
+     * @param out Receives the branched walkers, appended in the same order as branch()
+     */
+    void branch_into(const std::optional<std::string> &token, std::vector<nb::ref<Walker>> &out);
+
+    /**
+     * @brief consume_token() appending into out
+     * @param token The token to consume
+     * @param out Receives the advanced walkers
+     *
+     * Plain walkers of plain machines go straight to StateMachine::advance_into();
+     * everything else goes through the virtual consume_token().
+     */
+    void consume_token_into(const std::string &token, std::vector<nb::ref<Walker>> &out);
+
+    /**
+     * @brief Whether consume_token() would leave some walker with no input left over
+     * @param token The token to test
+     *
+     * Plain walkers of plain machines stop at the first success and keep none
+     * of the walkers they create; others fall back to consume_token().
+     */
+    bool can_consume(const std::string &token);
+
+    // Whether the input so far is complete, i.e. the sequence may end here
+    bool can_end() const;
+
     VisitedEdge current_edge() const;
 
     virtual nb::object get_current_value() const;
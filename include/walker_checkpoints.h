@@ -0,0 +1,79 @@
+#pragma once
+
+#include "walker.h"
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace nb = nanobind;
+
+/**
+ * Ring of the walker sets a sequence passed through, for rolling it back.
+ *
+ * Every decoding step records the walkers it produced. advance() moves
+ * clones forward rather than the walkers it was given, and walker fields
+ * copy on write, so a checkpoint is one vector of references that shares its
+ * walkers with the sequence and with the neighbouring checkpoints.
+ * Restoring hands back the stored vector in O(1). Only the most recent
+ * `window` checkpoints are kept; older ones are released as new ones are
+ * pushed.
+ *
+ * Sharing assumes stored walkers are not modified in place. The engine only
+ * does so in should_start_transition(), which clears _accepts_more_input_
+ * on a walker it is rejecting as the start of a transition because that
+ * edge was already explored. Fields assigned from Python, on the other hand,
+ * change every checkpoint holding the walker, so clone it first.
+ *
+ * Meant to be owned by one sequence, so it is not synchronized.
+ */
+class WalkerCheckpoints
+{
+public:
+  using Snapshot = std::shared_ptr<const std::vector<nb::ref<Walker>>>;
+
+  /**
+   * @param window Number of checkpoints to keep, at least 1
+   */
+  explicit WalkerCheckpoints(size_t window);
+
+  /**
+   * @brief Record the walkers after a step
+   * @param walkers The walkers to keep
+   * @return The step number of the new checkpoint, counting from 0
+   */
+  size_t push(std::vector<nb::ref<Walker>> walkers);
+
+  /**
+   * @brief Checkpoint a number of steps before the latest one
+   * @param steps_back 0 for the latest checkpoint
+   * @return The recorded walkers
+   */
+  Snapshot peek(size_t steps_back = 0) const;
+
+  /**
+   * @brief Discard the latest checkpoints
+   * @param steps Number of checkpoints to discard; fewer than size()
+   * @return The walkers of the checkpoint that is now the latest
+   */
+  Snapshot rollback(size_t steps);
+
+  void clear();
+
+  // Step number of the latest checkpoint, or nullopt if none is held
+  std::optional<size_t> step() const
+  {
+    return size_ == 0 ? std::nullopt : std::optional<size_t>(next_step_ - 1);
+  }
+  size_t size() const { return size_; }
+  size_t window() const { return slots_.size(); }
+
+private:
+  // Slot of the checkpoint steps_back before the latest
+  size_t slot_of(size_t steps_back) const;
+
+  std::vector<Snapshot> slots_;
+  size_t latest_ = 0;
+  size_t size_ = 0;
+  size_t next_step_ = 0;
+};
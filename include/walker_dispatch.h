@@ -0,0 +1,75 @@
+#pragma once
+
+#include "accepted_state.h"
+#include "walker.h"
+#include <string>
+
+/**
+ * Calls into walkers that skip the vtable for built-in kinds.
+ *
+ * The transition loops call these predicates for every walker on every
+ * token. Plain walkers and accepted states are dispatched on kind_ with
+ * qualified calls the compiler can inline; custom subclasses, including
+ * every Python subclass, still go through the virtual methods and their
+ * trampolines.
+ */
+namespace walker_dispatch
+{
+    inline bool can_accept_more_input(const Walker &walker)
+    {
+        switch (walker.kind_)
+        {
+        case WalkerKind::Native:
+            return walker.Walker::can_accept_more_input();
+        case WalkerKind::Accepted:
+            return can_accept_more_input(*static_cast<const AcceptedState &>(walker).accepted_walker_);
+        default:
+            return walker.can_accept_more_input();
+        }
+    }
+
+    inline bool has_reached_accept_state(const Walker &walker)
+    {
+        switch (walker.kind_)
+        {
+        case WalkerKind::Native:
+            return walker.Walker::has_reached_accept_state();
+        case WalkerKind::Accepted:
+            return true;
+        default:
+            return walker.has_reached_accept_state();
+        }
+    }
+
+    inline bool should_start_transition(Walker &walker, const std::string &token)
+    {
+        switch (walker.kind_)
+        {
+        case WalkerKind::Native:
+            return walker.Walker::should_start_transition(token);
+        case WalkerKind::Accepted:
+            return static_cast<AcceptedState &>(walker).AcceptedState::should_start_transition(token);
+        default:
+            return walker.should_start_transition(token);
+        }
+    }
+
+    inline bool should_complete_transition(const Walker &walker)
+    {
+        return walker.kind_ == WalkerKind::Native ? walker.Walker::should_complete_transition()
+                                                  : walker.should_complete_transition();
+    }
+
+    inline nb::ref<Walker> clone(const Walker &walker)
+    {
+        switch (walker.kind_)
+        {
+        case WalkerKind::Native:
+            return walker.Walker::clone();
+        case WalkerKind::Accepted:
+            return clone(*static_cast<const AcceptedState &>(walker).accepted_walker_);
+        default:
+            return walker.clone();
+        }
+    }
+}
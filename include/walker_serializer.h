@@ -0,0 +1,53 @@
+#pragma once
+
+#include "state_machine.h"
+#include "walker.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nb = nanobind;
+
+/**
+ * Binary snapshot/restore of walker sets.
+ *
+ * Blobs must come from a trusted source: the Python state of walker
+ * subclasses is stored pickled, and restoring it runs pickle.loads, which
+ * can execute arbitrary code. Corrupt blobs are otherwise rejected with
+ * std::runtime_error.
+ */
+class WalkerSerializer
+{
+public:
+    static constexpr uint32_t MAGIC = 0x57455350; // "PSEW"
+    static constexpr uint32_t VERSION = 2;
+
+    /**
+     * @brief Snapshot a set of walkers into a compact binary blob
+     * @param root The root state machine the walkers were created from
+     * @param walkers The walkers to snapshot
+     * @return The serialized walker set
+     *
+     * State machines are referenced by their position in a deterministic
+     * traversal of the root's graph, so the blob can only be restored against
+     * a structurally identical root; the root's fingerprint() is stored to
+     * check this. Walkers shared between several parents
+     * (history entries, transition walkers, accepted states) are written once.
+     */
+    static std::string serialize(
+        const nb::ref<StateMachine> &root,
+        const std::vector<nb::ref<Walker>> &walkers);
+
+    /**
+     * @brief Restore a walker set previously produced by serialize()
+     * @param root The root state machine to restore the walkers against
+     * @param data The serialized walker set
+     * @return The restored walkers, in their original order
+     *
+     * Only restore blobs from a trusted source; see the class comment.
+     */
+    static std::vector<nb::ref<Walker>> deserialize(
+        const nb::ref<StateMachine> &root,
+        std::string_view data);
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "walker.h"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace nb = nanobind;
+
+/**
+ * Copy-on-write handle to the walker set of one sequence.
+ *
+ * Sampling n continuations of a prompt used to clone every walker n times.
+ * fork() instead returns n handles to the same set, and handles at the same
+ * position share one memo of advances: the first handle to consume a token
+ * computes the next set, and every other handle consuming that token from
+ * there picks up the result. Handles only stop sharing once their tokens
+ * differ, and a set is freed when the last handle moves past it.
+ *
+ * The shared walkers must be treated as read-only. Handles may be advanced
+ * from several threads; advances from the same position are serialized.
+ */
+class WalkerSet
+{
+public:
+  explicit WalkerSet(std::vector<nb::ref<Walker>> walkers = {});
+
+  /**
+   * @brief Handles that start out sharing this handle's walkers
+   * @param n Number of handles
+   */
+  std::vector<WalkerSet> fork(size_t n) const;
+
+  /**
+   * @brief Move this handle past a token
+   * @param token The token to consume, as bytes
+   * @return Whether any walker consumed it completely; if not, the set is now empty
+   *
+   * Walkers that leave part of the token unconsumed are dropped, as in
+   * MaskPipeline::submit(). A token that ends inside a UTF-8 character, as
+   * byte-fallback tokens do, leaves the walkers alone and keeps the
+   * unfinished character pending until later tokens complete it.
+   */
+  bool consume_token(const std::string &token);
+
+  // Start of a UTF-8 character still waiting for its remaining bytes
+  const std::string &pending_bytes() const { return node_->pending_bytes; }
+
+  const std::vector<nb::ref<Walker>> &walkers() const;
+  size_t size() const { return walkers().size(); }
+  bool empty() const { return walkers().empty(); }
+
+  // Whether both handles currently point at the same set
+  bool shares_with(const WalkerSet &other) const { return node_ == other.node_; }
+
+private:
+  struct Node
+  {
+    std::vector<nb::ref<Walker>> walkers;
+    std::string pending_bytes;
+    // Held while advancing, so that each token is advanced once
+    std::mutex mutex;
+    // Sets reached from this one, by token; entries expire with their last handle
+    std::unordered_map<std::string, std::weak_ptr<Node>> advances;
+  };
+
+  explicit WalkerSet(std::shared_ptr<Node> node) : node_(std::move(node)) {}
+
+  std::shared_ptr<Node> node_;
+};
@@ -1,4 +1,5 @@
 #pragma once
+#include "override_mask.h"
 #include "walker.h"
 #include <nanobind/trampoline.h>
 
@@ -6,59 +7,79 @@ class PyWalker : public Walker
 {
 public:
     // NB_TRAMPOLINE macro defines the interface
-    NB_TRAMPOLINE(Walker, 15);
+    NB_TRAMPOLINE(Walker, 16);
+
+    // Methods whose base runs without the GIL, by Python name; see OverrideMask
+    static constexpr const char *override_names[] = {
+        "clone", "consume_token", "can_accept_more_input", "is_within_value",
+        "should_start_transition", "should_complete_transition", "has_reached_accept_state",
+        "accepts_any_token", "get_valid_continuations", "find_valid_prefixes", "signature",
+        "get_raw_value"};
+    OverrideMask override_mask_;
 
     // Pure virtual methods
     nb::ref<Walker> clone() const override
     {
-        NB_OVERRIDE(clone);
+        PSE_OVERRIDE(clone);
     }
 
     std::vector<nb::ref<Walker>> consume_token(const std::string &token) override
     {
-        NB_OVERRIDE(consume_token, token);
+        PSE_OVERRIDE(consume_token, token);
     }
 
     bool can_accept_more_input() const override
     {
-        NB_OVERRIDE(can_accept_more_input);
+        PSE_OVERRIDE(can_accept_more_input);
     }
 
     bool is_within_value() const override
     {
-        NB_OVERRIDE(is_within_value);
+        PSE_OVERRIDE(is_within_value);
     }
 
     bool should_start_transition(const std::string &token) override
     {
-        NB_OVERRIDE(should_start_transition, token);
+        PSE_OVERRIDE(should_start_transition, token);
     }
 
     bool should_complete_transition() const override
     {
-        NB_OVERRIDE(should_complete_transition);
+        PSE_OVERRIDE(should_complete_transition);
     }
 
     bool has_reached_accept_state() const override
     {
-        NB_OVERRIDE(has_reached_accept_state);
+        PSE_OVERRIDE(has_reached_accept_state);
+    }
+
+    bool overrides_completion() const override
+    {
+        constexpr size_t slot = OverrideMask::slot_of(override_names, "should_complete_transition");
+        return override_mask_.overrides<NBBase>(this, override_names, slot);
     }
 
     bool accepts_any_token() const override
     {
-        NB_OVERRIDE(accepts_any_token);
+        PSE_OVERRIDE(accepts_any_token);
     }
 
     std::vector<std::string> get_valid_continuations(int depth = 0) const override
     {
-        NB_OVERRIDE(get_valid_continuations, depth);
+        PSE_OVERRIDE(get_valid_continuations, depth);
     }
 
     std::set<std::string> find_valid_prefixes(const tsl::htrie_set<char> &trie) override
     {
-        NB_OVERRIDE(find_valid_prefixes, trie);
+        PSE_OVERRIDE(find_valid_prefixes, trie);
+    }
+
+    uint64_t signature() const override
+    {
+        PSE_OVERRIDE(signature);
     }
 
+    // The base implementations below build Python objects, so they keep NB_OVERRIDE
     nb::object parse_value(const std::optional<std::string> &value) const override
     {
         NB_OVERRIDE(parse_value, value);
@@ -71,7 +92,7 @@ public:
 
     std::optional<std::string> get_raw_value() const override
     {
-        NB_OVERRIDE(get_raw_value);
+        PSE_OVERRIDE(get_raw_value);
     }
 
     std::string to_string() const override
@@ -7,7 +7,8 @@ constraints and transitions within the state machine.
 
 from __future__ import annotations
 
-from typing import Any, Self
+from collections.abc import Callable
+from typing import Any, Literal, Self, overload
 
 from pse_core import Edge, State, StateGraph, VisitedEdge
 
@@ -91,9 +92,210 @@ class StateMachine:
         """
         ...
 
+    max_walkers: int
+    """Upper bound on the walkers one `advance` keeps alive; 0 means unbounded.
+
+    When a breadth-first level of `advance` exceeds the cap, the walkers with
+    the lowest priority are dropped before they are expanded further.
+    """
+
+    walker_priority: Callable[[Walker], float] | None
+    """Ranks walkers when pruning, higher first; `default_walker_priority` if None."""
+
+    pruned_walkers: int
+    """Walkers dropped by this machine's `advance`; assign 0 to reset."""
+
+    def advance_pruned(
+        self,
+        walker: Walker,
+        token: str,
+        max_walkers: int,
+        priority: Callable[[Walker], float] | None = None,
+    ) -> list[Walker]:
+        """Advance with a walker cap that also applies to every nested machine.
+
+        Overrides `max_walkers` and, if given, `walker_priority` of every
+        machine advanced during this call.
+        """
+        ...
+
     @staticmethod
-    def advance_all(walkers: list[Walker], token: str, vocab: Any | None = None) -> list[tuple[str, Walker]]:
-        """Advance multiple walkers with a token, optionally using a vocabulary DAWG."""
+    def default_walker_priority(walker: Walker) -> float:
+        """Default pruning priority.
+
+        Accepted walkers rank first, then walkers with fewer nested
+        transitions, then walkers with less pending input.
+        """
+        ...
+
+    @staticmethod
+    def advance_all(walkers: list[Walker], token: str, vocab: TokenVocabulary | None = None) -> list[tuple[str, Walker]]:
+        """Advance multiple walkers with a token, optionally using a vocabulary trie.
+
+        With `vocab`, walkers that consume only part of the token are kept if
+        the consumed part is itself a token of the vocabulary.
+        """
+        ...
+
+    @staticmethod
+    def can_consume(walkers: list[Walker], token: str) -> bool:
+        """Whether any walker can consume `token` with no input left over.
+
+        Stops at the first walker that can, and keeps none of the walkers
+        created along the way; use it instead of `advance_all` when only the
+        answer matters, e.g. to build masks.
+        """
+        ...
+
+    @staticmethod
+    def can_end(walkers: list[Walker]) -> bool:
+        """Whether any walker has reached an accept state, so generation may stop here."""
+        ...
+
+    def freeze(self) -> None:
+        """Make this machine and every machine reachable from it immutable.
+
+        Afterwards assigning to any engine field or minimizing raises
+        RuntimeError, the fingerprint is memoized, and the grammar can be
+        advanced from many threads at once. Attributes that Python subclasses
+        define themselves are not guarded, so they must not change after
+        freezing either. Freezing cannot be undone; copies start out mutable.
+        Machines stored in a `MachineCache` are frozen automatically.
+        """
+        ...
+
+    @property
+    def frozen(self) -> bool:
+        """Whether this machine, or a machine that reaches it, has been frozen."""
+        ...
+
+    def fingerprint(self) -> int:
+        """Structural fingerprint of the graph reachable from this machine.
+
+        A stable 64-bit hash of states, edges, sub-machine fingerprints and
+        flags. Machines with equal fingerprints behave identically, so the
+        fingerprint can be used as a cache key. A machine anywhere in the graph
+        with a custom `walker_priority` only matches itself.
+        """
+        ...
+
+    def fingerprint_key(self) -> str:
+        """Identify configuration held outside the state graph.
+
+        By default a subclass is keyed by its class and its instance
+        attributes, provided they are all plain data: None, bools, numbers,
+        strings, bytes, and lists or tuples of those. Equal grammars built
+        twice then share a fingerprint. Subclasses that override
+        `get_walkers`, `get_edges`, `get_transitions`, `advance` or
+        `branch_walker`, use `__slots__`, or hold any other attribute fall
+        back to their instance identity and are never conflated; override
+        this to key them by their parameters instead.
+        """
+        ...
+
+    def first_bytes(self) -> str | None:
+        """Characters a token consumed by this machine can start with.
+
+        Plain machines derive them from their graph, as do subclasses with a
+        graph that keep the default `get_new_walker`, `get_walkers`,
+        `get_edges`, `get_transitions`, `advance` and `branch_walker`. Other
+        subclasses, including leaves, should
+        override this, returning None when any character may start a token;
+        frozen grammars then skip edges into the leaf whose first byte cannot
+        match without creating walkers for them. Every byte of the UTF-8
+        encoding counts, and returning extra characters is always safe.
+        """
+        ...
+
+    def may_start_with(self, byte: int) -> bool:
+        """Whether a token starting with `byte` can start a transition into this machine.
+
+        Only frozen machines keep the lookahead sets; mutable machines always
+        return True.
+        """
+        ...
+
+    @property
+    def nullable(self) -> bool:
+        """Whether this machine can be skipped or finish without consuming anything.
+
+        Conservatively True for machines that are not frozen.
+        """
+        ...
+
+    @staticmethod
+    def jump_forward(walkers: list[Walker], max_length: int = 256) -> tuple[str, list[Walker]]:
+        """Find the continuation forced by the grammar and advance through it.
+
+        The forced string is the longest common prefix of every walker's valid
+        continuations, repeated until the walkers diverge, one of them accepts
+        any token, or one of them could end here.
+
+        Args:
+            walkers: The current walkers.
+            max_length: Upper bound on the length of the forced string, in bytes.
+
+        Returns:
+            The forced string (possibly empty) and the walkers after consuming it.
+        """
+        ...
+
+    @overload
+    @staticmethod
+    def consume_tokens(walkers: list[Walker], tokens: list[str], keep_steps: Literal[False] = False) -> list[Walker]:
+        """Feed a sequence of tokens through the walkers in one native call.
+
+        Each step keeps the walkers that consume the whole token and collapses
+        walkers equal to an earlier one before the next token. Tokens that end
+        inside a UTF-8 character are joined with the tokens that complete it;
+        a sequence whose last token leaves a character unfinished is rejected
+        without calling any walker. Runs without the GIL except where Python
+        subclasses are called. Use
+        `TokenMaskCache.consume_tokens` to pass token ids, including
+        byte-fallback tokens.
+
+        Args:
+            walkers: The starting walkers.
+            tokens: The tokens, in order.
+            keep_steps: Return the walkers after every consumed token instead
+                of only the final ones.
+
+        Returns:
+            The final walkers, empty if some token was rejected; with
+            `keep_steps`, one walker list per consumed token, stopping at the
+            first rejected one.
+        """
+        ...
+
+    @overload
+    @staticmethod
+    def consume_tokens(walkers: list[Walker], tokens: list[str], keep_steps: Literal[True]) -> list[list[Walker]]:
+        """Feed a sequence of tokens through the walkers, returning the walkers after every token."""
+        ...
+
+    @staticmethod
+    def consume_text(walkers: list[Walker], text: str, chunk_bytes: int = 64) -> list[Walker]:
+        """Feed text through the walkers, e.g. to enforce a forced prefix.
+
+        The text is consumed like `consume_tokens` in chunks of at most
+        `chunk_bytes` bytes that never split a UTF-8 sequence.
+
+        Returns:
+            The final walkers, empty if the text was rejected.
+        """
+        ...
+
+    @staticmethod
+    def verify_draft(walkers: list[Walker], tokens: list[str]) -> tuple[int, list[list[Walker]]]:
+        """Check a batch of draft tokens against the walkers.
+
+        Args:
+            walkers: The current walkers.
+            tokens: The draft tokens, in order.
+
+        Returns:
+            The number of accepted tokens and the walkers after each accepted token.
+        """
         ...
 
     def __eq__(self, other: object) -> bool:
@@ -173,6 +375,18 @@ class Walker:
         """
         ...
 
+    def can_consume(self, token: str) -> bool:
+        """Whether `consume_token(token)` would return a walker with no input left over.
+
+        Plain walkers answer without keeping any advanced walker and stop at
+        the first success; subclasses fall back to `consume_token`.
+        """
+        ...
+
+    def can_end(self) -> bool:
+        """Whether the input so far is complete, i.e. the sequence may end here."""
+        ...
+
     def can_accept_more_input(self) -> bool:
         """Indicate whether the walker can accept more input for the current state.
 
@@ -235,6 +449,20 @@ class Walker:
         """
         ...
 
+    def signature(self) -> int:
+        """Hash of everything that decides which input this walker accepts next.
+
+        Walkers with equal signatures accept the same tokens. Values
+        accumulated by plain walkers are left out, so every walker at the same
+        grammar position shares a signature. Subclasses are assumed to depend
+        on their raw value and consumed character count; a subclass whose
+        acceptance only depends on its position can override this.
+
+        Returns:
+            A 64-bit signature.
+        """
+        ...
+
     def parse_value(self, value: str | None) -> Any:
         """Parse the accumulated value into an appropriate type.
 
@@ -414,8 +642,29 @@ class AcceptedState(Walker):
     This class wraps another walker (`accepted_walker`) that has successfully
     reached an accepted state in the state machine. It acts as a marker for
     accepted states and provides methods to retrieve values and advance the walker.
+
+    It is a view: `accepted_history`, `explored_edges` and the raw value are
+    read from the accepted walker rather than copied.
     """
 
+    @property
+    def accepted_history(self) -> list[Walker]:
+        """The history of the accepted walker."""
+        ...
+
+    @property
+    def explored_edges(self) -> set[VisitedEdge]:
+        """The explored edges of the accepted walker."""
+        ...
+
+    @property
+    def _raw_value(self) -> str | None:
+        """The assigned raw value, or else the accepted walker's."""
+        ...
+
+    @_raw_value.setter
+    def _raw_value(self, value: str | None) -> None: ...
+
     def __init__(self, walker: Walker) -> None:
         """Initialize the AcceptedState with the given walker.
 
@@ -496,3 +745,689 @@ class AcceptedState(Walker):
             A string representing the accepted state.
         """
         ...
+
+class WalkerSerializer:
+    """Binary snapshot/restore of walker sets.
+
+    Snapshots reference state machines by their position in the root's graph,
+    so a snapshot can only be restored against a structurally identical root;
+    the root's fingerprint is stored to check this. Walkers shared between
+    several parents are written once.
+
+    Snapshots must come from a trusted source. The Python state of walker
+    subclasses is pickled, and restoring it runs `pickle.loads`, which can
+    execute arbitrary code.
+    """
+
+    @staticmethod
+    def serialize(root: StateMachine, walkers: list[Walker]) -> bytes:
+        """Snapshot a set of walkers into a compact binary blob.
+
+        Python subclasses that implement `__setstate__` also have the result
+        of `__getstate__` pickled into the snapshot.
+
+        Args:
+            root: The root state machine the walkers were created from.
+            walkers: The walkers to snapshot.
+
+        Returns:
+            The serialized walker set.
+        """
+        ...
+
+    @staticmethod
+    def deserialize(root: StateMachine, data: bytes) -> list[Walker]:
+        """Restore a walker set previously produced by `serialize`.
+
+        Only restore snapshots from a trusted source, since any Python state
+        in them is unpickled.
+
+        Args:
+            root: The root state machine to restore the walkers against.
+            data: The serialized walker set.
+
+        Returns:
+            The restored walkers, in their original order.
+
+        Raises:
+            ValueError: If the snapshot was taken against a different root, or
+                holds Python state for a walker without `__setstate__`.
+            RuntimeError: If the snapshot is truncated or corrupt.
+        """
+        ...
+
+class WalkerCheckpoints:
+    """Ring of the walker sets a sequence passed through, for rolling it back.
+
+    Push the walkers after every step; a checkpoint shares its walkers with
+    the sequence and with neighbouring checkpoints instead of copying them.
+    Only the latest `window` checkpoints are kept, and older ones are released
+    as new ones arrive. Meant to be owned by a single sequence.
+
+    Because checkpoints share walkers, a walker must not be modified in place
+    after it was pushed: assigning fields such as `_raw_value` or
+    `consumed_character_count` changes every checkpoint holding it, so clone
+    it first. The engine's own advancing clones before it writes, except that
+    `should_start_transition` clears `_accepts_more_input` on a walker it
+    rejects because the edge was already explored.
+    """
+
+    def __init__(self, window: int) -> None:
+        """Keep up to `window` checkpoints; raises ValueError if it is 0."""
+        ...
+
+    def push(self, walkers: list[Walker]) -> int:
+        """Record the walkers after a step and return its step number, counting from 0."""
+        ...
+
+    def peek(self, steps_back: int = 0) -> list[Walker]:
+        """Walkers of the checkpoint `steps_back` steps before the latest.
+
+        Raises IndexError if that checkpoint is not held.
+        """
+        ...
+
+    def rollback(self, steps: int) -> list[Walker]:
+        """Discard the latest `steps` checkpoints and return the walkers of the new latest one.
+
+        Raises IndexError unless at least one checkpoint remains afterwards.
+        """
+        ...
+
+    def clear(self) -> None:
+        """Drop every checkpoint and restart the step count."""
+        ...
+
+    @property
+    def step(self) -> int | None:
+        """Step number of the latest checkpoint, or None if none is held."""
+        ...
+
+    @property
+    def window(self) -> int:
+        """Maximum number of checkpoints kept."""
+        ...
+
+    def __len__(self) -> int:
+        """Number of checkpoints held."""
+        ...
+
+class WalkerSet:
+    """Copy-on-write handle to the walker set of one sequence.
+
+    `fork(n)` returns n handles to the same walkers instead of n clones.
+    Handles at the same position share their advances: a token is consumed
+    once, and every other handle consuming it from there reuses the result.
+    Handles only stop sharing once their tokens differ. Treat the shared
+    walkers as read-only.
+    """
+
+    def __init__(self, walkers: list[Walker]) -> None: ...
+
+    def fork(self, n: int) -> list[WalkerSet]:
+        """Handles that start out sharing this handle's walkers."""
+        ...
+
+    def consume_token(self, token: str) -> bool:
+        """Move this handle past a token.
+
+        Walkers that leave part of the token unconsumed are dropped. Releases
+        the GIL, so handles can be advanced from several threads.
+
+        Returns:
+            Whether any walker consumed the token; if not, the set is now empty.
+        """
+        ...
+
+    def consume_bytes(self, data: bytes) -> bool:
+        """Move this handle past a token given as raw bytes.
+
+        A token that ends inside a UTF-8 character, such as a byte-fallback
+        token, leaves the walkers alone and keeps the unfinished character in
+        `pending_bytes` until later tokens complete it.
+
+        Returns:
+            Whether any walker consumed it completely; if not, the set is now empty.
+        """
+        ...
+
+    @property
+    def pending_bytes(self) -> bytes:
+        """Start of a UTF-8 character still waiting for its remaining bytes."""
+        ...
+
+    def shares_with(self, other: WalkerSet) -> bool:
+        """Whether both handles currently point at the same walkers."""
+        ...
+
+    @property
+    def walkers(self) -> list[Walker]:
+        """The current walkers."""
+        ...
+
+    def __len__(self) -> int: ...
+    def __bool__(self) -> bool: ...
+
+class GrammarImage:
+    """Versioned on-disk format for a frozen state machine graph.
+
+    The image stores every machine reachable from the root as flat records
+    (states, edges, end states, optional and case flags) plus a string table,
+    and is memory-mapped when loaded from a file. Images use the writing host's
+    byte order and are rejected on a host of the other order. Base `StateMachine` nodes are
+    rebuilt natively; nodes of other types are recreated through `resolve` and
+    then receive their graph, end states and flags from the image. `resolve`
+    must return a new, unfrozen machine for every record. Loaded graphs come
+    back frozen.
+    """
+
+    @staticmethod
+    def dumps(root: StateMachine, describe: Callable[[StateMachine], str] | None = None) -> bytes:
+        """Serialize the graph reachable from root into an image.
+
+        Args:
+            root: The root state machine.
+            describe: Returns a key stored alongside each non-native machine,
+                e.g. the parameters needed to recreate a leaf.
+
+        Returns:
+            The image bytes.
+        """
+        ...
+
+    @staticmethod
+    def loads(data: bytes, resolve: Callable[[str, str], StateMachine] | None = None) -> StateMachine:
+        """Rebuild a state machine graph from image bytes.
+
+        Args:
+            data: The image bytes.
+            resolve: Recreates a non-native machine from its type name and key.
+
+        Returns:
+            The root state machine, frozen.
+
+        Raises:
+            RuntimeError: If `resolve` returns a frozen machine.
+            ValueError: If `resolve` returns the same machine for two records.
+        """
+        ...
+
+    @staticmethod
+    def save(root: StateMachine, path: str, describe: Callable[[StateMachine], str] | None = None) -> None:
+        """Write the image for root to a file."""
+        ...
+
+    @staticmethod
+    def load(path: str, resolve: Callable[[str, str], StateMachine] | None = None) -> StateMachine:
+        """Memory-map an image file and rebuild its state machine graph."""
+        ...
+
+class MachineCache:
+    """Thread-safe LRU cache of compiled state machines.
+
+    Entries are keyed by a 64-bit key, by default the machine's structural
+    fingerprint, and evicted least-recently-used first once their estimated
+    memory exceeds `capacity_bytes`. Cached machines are shared between every
+    caller that requests the same key and must be treated as immutable.
+
+    Lookups match on the 64-bit key alone and never compare structure, so
+    grammars whose fingerprints collide would share an entry. This is very
+    unlikely, but callers that must never receive another grammar should use
+    `get`/`put` with a verified key of their own.
+    """
+
+    def __init__(self, capacity_bytes: int = 268435456) -> None: ...
+
+    @staticmethod
+    def instance() -> MachineCache:
+        """The process-wide machine cache."""
+        ...
+
+    def intern(self, machine: StateMachine) -> StateMachine:
+        """Return the cached machine structurally identical to machine, inserting it if absent.
+
+        On a hit the argument is left untouched; only an inserted machine is
+        frozen. Hits match on the fingerprint alone; see the class docstring.
+        """
+        ...
+
+    def get(self, key: int) -> StateMachine | None:
+        """Look up a machine by key, e.g. a fingerprint or a caller-side schema hash."""
+        ...
+
+    def put(self, key: int, machine: StateMachine) -> None:
+        """Insert or replace the machine stored under key."""
+        ...
+
+    def clear(self) -> None: ...
+    def __contains__(self, key: int) -> bool: ...
+    def __len__(self) -> int: ...
+
+    @property
+    def capacity_bytes(self) -> int:
+        """Memory budget in bytes."""
+        ...
+
+    @capacity_bytes.setter
+    def capacity_bytes(self, value: int) -> None: ...
+
+    @property
+    def memory_usage(self) -> int:
+        """Estimated memory of the cached machines in bytes."""
+        ...
+
+    @property
+    def hits(self) -> int: ...
+    @property
+    def misses(self) -> int: ...
+    @property
+    def evictions(self) -> int: ...
+
+class MinimizeStats:
+    """Machine and state counts before and after minimization."""
+
+    @property
+    def machines_before(self) -> int: ...
+    @property
+    def machines_after(self) -> int: ...
+    @property
+    def states_before(self) -> int: ...
+    @property
+    def states_after(self) -> int: ...
+
+class StateMachineMinimizer:
+    """Offline minimization of a state machine graph.
+
+    Structurally identical sub-machines are hash-consed so that every edge to
+    an equivalent machine points at one shared instance, and the states of
+    deterministic plain `StateMachine` graphs are merged with partition
+    refinement. Subclass graphs keep their states, and subclasses are only
+    shared when their type and `fingerprint_key()` agree, which by default
+    holds for instances of one class with equal plain-data attributes.
+    Machines on a reference cycle are never merged.
+    """
+
+    @staticmethod
+    def minimize(root: StateMachine) -> MinimizeStats:
+        """Minimize the graph reachable from root in place.
+
+        The graph must not be in use by walkers.
+
+        Args:
+            root: The root state machine.
+
+        Returns:
+            Machine and state counts before and after minimization.
+        """
+        ...
+
+    @staticmethod
+    def merge_equivalent_states(machine: StateMachine) -> bool:
+        """Merge equivalent states of a single deterministic machine.
+
+        Returns:
+            True if any states were merged.
+        """
+        ...
+
+class ValidationResult:
+    """Verdict on one document."""
+
+    @property
+    def accepted(self) -> bool: ...
+    @property
+    def error_offset(self) -> int:
+        """Byte offset of the first byte no walker could consume or that is not valid UTF-8.
+
+        Counted in bytes of the document's UTF-8 encoding, not in characters,
+        so it differs from a str index once the document contains non-ASCII
+        text; `len(document.encode()[:error_offset].decode())` converts it.
+        The document's size in bytes if it was accepted or ended before the
+        grammar allowed it to.
+        """
+        ...
+
+    def __bool__(self) -> bool: ...
+
+class DocumentValidator:
+    """Checks whole documents against a grammar without running a model.
+
+    Each document is fed through the walkers in chunks that end on UTF-8
+    character boundaries; when a chunk is rejected it is replayed one
+    character at a time to locate the error. Batches are split across native
+    worker threads that do not hold the GIL. Grammars built from Python
+    subclasses work too; each call into Python takes the GIL, so those parts
+    run one thread at a time. The root is frozen on construction, since
+    every worker walks it.
+    """
+
+    def __init__(
+        self,
+        root: StateMachine,
+        num_threads: int = 0,
+        chunk_bytes: int = 64,
+    ) -> None:
+        """Build a validator for documents matching root.
+
+        Args:
+            root: The grammar every document must match.
+            num_threads: Number of worker threads; 0 uses one per hardware thread.
+            chunk_bytes: Upper bound on the size of each chunk fed to the walkers.
+        """
+        ...
+
+    def validate(self, document: str) -> ValidationResult:
+        """Check one document against the grammar."""
+        ...
+
+    def validate_batch(self, documents: list[str]) -> list[ValidationResult]:
+        """Check documents in parallel on native threads.
+
+        Returns:
+            One result per document, in order.
+        """
+        ...
+
+    def validate_file(self, path: str) -> list[ValidationResult]:
+        """Check every line of a newline-delimited file, such as JSON Lines.
+
+        The file is memory-mapped rather than read. A trailing carriage return
+        is not part of its line, and a final newline does not start another
+        document.
+
+        Returns:
+            One result per line, in order; offsets are in bytes, relative to the line.
+        """
+        ...
+
+    @property
+    def root(self) -> StateMachine: ...
+    @property
+    def num_threads(self) -> int: ...
+    @property
+    def chunk_bytes(self) -> int: ...
+
+class TokenBitmask:
+    """Packed set of allowed token ids, one bit per vocabulary entry."""
+
+    def __init__(self, size: int, value: bool = False) -> None: ...
+    def __len__(self) -> int: ...
+    def __contains__(self, token_id: int) -> bool: ...
+    def __eq__(self, other: object) -> bool: ...
+    def count(self) -> int:
+        """Number of allowed tokens."""
+        ...
+
+    def any(self) -> bool: ...
+    def allowed_ids(self) -> list[int]:
+        """Allowed token ids in ascending order."""
+        ...
+
+    def to_bytes(self) -> bytes:
+        """The packed 32-bit words in native byte order; bit i of word i // 32 is token i."""
+        ...
+
+class TokenVocabulary:
+    """Token strings of a tokenizer vocabulary, as the bytes they decode to.
+
+    Every piece is decoded once when the vocabulary is built: byte-fallback
+    pieces such as "<0x0A>" become the single byte they stand for, and the
+    SentencePiece marker "\u2581" becomes a space. Pass the vocabulary to
+    `TokenMaskCache`, `TokenClassifier` or `MaskPipeline` instead of a list of
+    strings, and to `StateMachine.advance_all` as its trie.
+
+    Masks never allow a token that is not valid UTF-8 on its own, such as
+    the byte-fallback half of a character, and never pass one to a walker.
+    Such tokens are still consumed correctly by `consume_tokens` and
+    `WalkerSet.consume_bytes` when they arrive next to the bytes that
+    complete them.
+    """
+
+    def __init__(self, pieces: list[str], decode: bool = True) -> None:
+        """Build the vocabulary from the tokenizer's pieces, indexed by token id.
+
+        With `decode=False` the pieces are kept as they are.
+        """
+        ...
+
+    @staticmethod
+    def decode_token(piece: str) -> bytes:
+        """Bytes a single tokenizer piece stands for."""
+        ...
+
+    def token(self, id: int) -> bytes:
+        """Decoded bytes of a token id; raises IndexError outside the vocabulary."""
+        ...
+
+    def __contains__(self, token: bytes) -> bool: ...
+    def __len__(self) -> int: ...
+
+class TokenClassification:
+    """Vocabulary split for one leaf walker position.
+
+    Accepted tokens are consumed completely by the leaf, so every walker whose
+    innermost transition is at this position accepts them. Dependent tokens
+    are consumed partially or could follow the end of the leaf, so the
+    enclosing machines decide. All other tokens are rejected.
+    """
+
+    @property
+    def accepted(self) -> TokenBitmask: ...
+    @property
+    def dependent(self) -> list[int]: ...
+
+class TokenClassifier:
+    """Per-leaf-state classification of a vocabulary.
+
+    Masks are assembled from the classification of each walker's innermost
+    leaf, and only dependent tokens are walked through the full stack, so the
+    cost of a mask scales with the dependent set instead of the vocabulary.
+    Tokens the leaf consumes completely are also walked through the stack
+    when an enclosing walker is a custom class, its machine overrides
+    traversal, or the leaf overrides `should_complete_transition`, since any
+    of those may reject them. Classifications are memoized by the leaf
+    walker's `signature()`, up to `max_states` positions.
+    """
+
+    def __init__(self, vocabulary: list[str] | TokenVocabulary, max_states: int = 4096) -> None: ...
+    def precompute(self, root: StateMachine) -> int:
+        """Classify the start positions of every leaf machine reachable from root.
+
+        Returns:
+            The number of leaf positions classified.
+        """
+        ...
+
+    def classify(self, leaf: Walker) -> TokenClassification:
+        """Classify the vocabulary for a leaf walker into accepted and dependent tokens."""
+        ...
+
+    def compute_mask(self, walkers: list[Walker]) -> TokenBitmask:
+        """Compute the tokens that at least one walker consumes completely."""
+        ...
+
+    def clear(self) -> None: ...
+    def __len__(self) -> int: ...
+    @property
+    def vocabulary(self) -> list[str]: ...
+    @property
+    def memory_usage(self) -> int: ...
+
+class TokenMaskCache:
+    """Cache of allowed-token masks keyed by the signature of a walker set.
+
+    Generation keeps returning to the same grammar positions (inside a string
+    value, after a comma in an object), and every walker set at such a
+    position accepts the same tokens. The mask for a set is computed once over
+    the whole vocabulary and reused until it is evicted, least-recently-used
+    first, once the cached masks exceed `capacity_bytes`. Misses are computed
+    through a `TokenClassifier`, so only context-dependent tokens are walked.
+
+    Each entry keeps the sorted walker signatures it was computed for, and a
+    hit must match them exactly, so walker sets whose combined signatures
+    collide never share a mask. Individual walker signatures are still 64-bit
+    hashes, so a collision between two of those would share one.
+    """
+
+    def __init__(self, vocabulary: list[str] | TokenVocabulary, capacity_bytes: int = 67108864) -> None: ...
+    @staticmethod
+    def signature(walkers: list[Walker]) -> int:
+        """Canonical signature of a walker set, independent of order and duplicates."""
+        ...
+
+    def get_or_compute(self, walkers: list[Walker]) -> TokenBitmask:
+        """Return the allowed-token mask for the walkers, computing and caching it on a miss.
+
+        A token is allowed if at least one walker consumes it completely.
+        The returned mask is shared with the cache.
+        """
+        ...
+
+    def compute(self, walkers: list[Walker]) -> TokenBitmask:
+        """Compute the mask for the walkers without touching the cache."""
+        ...
+
+    def clear(self) -> None: ...
+    def __contains__(self, key: int) -> bool: ...
+    def __len__(self) -> int: ...
+    @overload
+    def consume_tokens(self, walkers: list[Walker], token_ids: list[int], keep_steps: Literal[False] = False) -> list[Walker]:
+        """Feed token ids through the walkers, like `StateMachine.consume_tokens`.
+
+        Raises IndexError if an id is outside the vocabulary.
+        """
+        ...
+
+    @overload
+    def consume_tokens(self, walkers: list[Walker], token_ids: list[int], keep_steps: Literal[True]) -> list[list[Walker]]:
+        """Feed token ids through the walkers, returning the walkers after every token."""
+        ...
+
+    def mask_logits(self, logits: Any, walkers: list[Walker]) -> None:
+        """Set the logits of tokens no walker accepts to -inf, in place.
+
+        Args:
+            logits: A writable CPU float32, float16 or bfloat16 array of shape
+                [vocab] or [batch, vocab]; every row gets the same mask.
+            walkers: The current walkers.
+        """
+        ...
+
+    def mask_logits_batch(self, logits: Any, walker_sets: list[list[Walker]]) -> None:
+        """Mask a [batch, vocab] logits buffer in place, one walker set per row."""
+        ...
+
+    @property
+    def vocabulary(self) -> list[str]: ...
+    @property
+    def classifier(self) -> TokenClassifier:
+        """The classifier used to compute masks on a miss; call `precompute` to warm it."""
+        ...
+
+    @property
+    def capacity_bytes(self) -> int:
+        """Memory budget in bytes."""
+        ...
+
+    @capacity_bytes.setter
+    def capacity_bytes(self, value: int) -> None: ...
+    @property
+    def memory_usage(self) -> int:
+        """Memory of the cached masks in bytes."""
+        ...
+
+    @property
+    def hits(self) -> int: ...
+    @property
+    def misses(self) -> int: ...
+    @property
+    def evictions(self) -> int: ...
+    @property
+    def hit_rate(self) -> float: ...
+
+class PendingMask:
+    """Handle to a step computed by a `MaskPipeline`."""
+
+    def done(self) -> bool:
+        """Whether the step has been computed."""
+        ...
+
+    def result(self) -> tuple[list[Walker], TokenBitmask]:
+        """Wait for the step, releasing the GIL while waiting.
+
+        Returns:
+            The walkers after the step and the allowed-token mask for the next one.
+
+        Raises:
+            Any exception raised while advancing the walkers or computing the mask.
+        """
+        ...
+
+class MaskPipeline:
+    """Computes token masks on background native threads.
+
+    After sampling, submit the token and keep the returned `PendingMask`; the
+    walkers are advanced and the next mask is computed while the next forward
+    pass runs. Workers do not hold the GIL; walkers implemented in Python take
+    it only for the duration of each call. Requests are started in submission
+    order.
+    """
+
+    def __init__(
+        self,
+        vocabulary: list[str] | TokenVocabulary,
+        num_threads: int = 1,
+        capacity_bytes: int = 67108864,
+    ) -> None: ...
+    def submit(self, walkers: list[Walker], token: str) -> PendingMask:
+        """Advance the walkers with a sampled token and compute the next mask in the background.
+
+        Only walkers that consume the whole token are kept.
+        """
+        ...
+
+    def submit_walkers(self, walkers: list[Walker]) -> PendingMask:
+        """Compute the mask for the walkers as they are, e.g. before the first token."""
+        ...
+
+    def close(self) -> None:
+        """Finish queued requests and stop the workers."""
+        ...
+
+    @property
+    def cache(self) -> TokenMaskCache:
+        """The mask cache shared by the workers."""
+        ...
+
+    @property
+    def pending(self) -> int:
+        """Number of requests waiting for a worker."""
+        ...
+
+class LogitMasker:
+    """In-place masking of logit buffers.
+
+    Disallowed tokens are overwritten with -inf straight from the packed
+    bitmask, using AVX-512, AVX2 or NEON when available and scalar code
+    otherwise. Buffers are writable CPU arrays (NumPy, PyTorch, ...) of
+    float32, float16 or bfloat16 with shape [vocab] or [batch, vocab],
+    contiguous along the vocabulary. Logits past the end of the mask are
+    disallowed, which covers output layers padded past the vocabulary.
+    """
+
+    @overload
+    @staticmethod
+    def apply(logits: Any, mask: TokenBitmask) -> None:
+        """Set disallowed logits to -inf in place, applying one mask to every row."""
+        ...
+
+    @overload
+    @staticmethod
+    def apply(logits: Any, masks: list[TokenBitmask]) -> None:
+        """Set disallowed logits to -inf in place, one mask per row."""
+        ...
+
+    @staticmethod
+    def backend() -> str:
+        """The kernel selected for this CPU: "avx512", "avx2", "neon" or "scalar"."""
+        ...
@@ -0,0 +1,3 @@
+from ._core import DocumentValidator, ValidationResult  # type: ignore[attr-defined]
+
+__all__ = ["DocumentValidator", "ValidationResult"]
@@ -0,0 +1,3 @@
+from ._core import GrammarImage  # type: ignore[attr-defined]
+
+__all__ = ["GrammarImage"]
@@ -0,0 +1,3 @@
+from ._core import LogitMasker  # type: ignore[attr-defined]
+
+__all__ = ["LogitMasker"]
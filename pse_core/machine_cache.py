@@ -0,0 +1,3 @@
+from ._core import MachineCache  # type: ignore[attr-defined]
+
+__all__ = ["MachineCache"]
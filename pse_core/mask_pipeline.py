@@ -0,0 +1,3 @@
+from ._core import MaskPipeline, PendingMask  # type: ignore[attr-defined]
+
+__all__ = ["MaskPipeline", "PendingMask"]
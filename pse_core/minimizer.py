@@ -0,0 +1,3 @@
+from ._core import MinimizeStats, StateMachineMinimizer  # type: ignore[attr-defined]
+
+__all__ = ["MinimizeStats", "StateMachineMinimizer"]
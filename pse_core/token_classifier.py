@@ -0,0 +1,3 @@
+from ._core import TokenClassification, TokenClassifier  # type: ignore[attr-defined]
+
+__all__ = ["TokenClassification", "TokenClassifier"]
@@ -0,0 +1,3 @@
+from ._core import TokenBitmask, TokenMaskCache  # type: ignore[attr-defined]
+
+__all__ = ["TokenBitmask", "TokenMaskCache"]
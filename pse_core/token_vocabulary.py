@@ -0,0 +1,3 @@
+from ._core import TokenVocabulary  # type: ignore[attr-defined]
+
+__all__ = ["TokenVocabulary"]
@@ -0,0 +1,3 @@
+from ._core import WalkerCheckpoints  # type: ignore[attr-defined]
+
+__all__ = ["WalkerCheckpoints"]
@@ -0,0 +1,3 @@
+from ._core import WalkerSerializer  # type: ignore[attr-defined]
+
+__all__ = ["WalkerSerializer"]
@@ -0,0 +1,3 @@
+from ._core import WalkerSet  # type: ignore[attr-defined]
+
+__all__ = ["WalkerSet"]
@@ -1,27 +1,26 @@
 #include "accepted_state.h"
+#include "hashing.h"
+#include "walker_dispatch.h"
 
 AcceptedState::AcceptedState(nb::ref<Walker> walker)
     : Walker(walker->state_machine_, walker->current_state_),
       accepted_walker_(walker)
 {
-    accepted_history_ = walker->accepted_history_;
-    explored_edges_ = walker->explored_edges_;
-    current_state_ = walker->current_state_;
+    kind_ = WalkerKind::Accepted;
     target_state_ = walker->target_state_;
     transition_walker_ = walker->transition_walker_;
     consumed_character_count_ = walker->consumed_character_count_;
     remaining_input_ = walker->remaining_input_;
-    _raw_value_ = walker->get_raw_value();
 }
 
 nb::ref<Walker> AcceptedState::clone() const
 {
-    return accepted_walker_->clone();
+    return walker_dispatch::clone(*accepted_walker_);
 }
 
 bool AcceptedState::can_accept_more_input() const
 {
-    return accepted_walker_->can_accept_more_input();
+    return walker_dispatch::can_accept_more_input(*accepted_walker_);
 }
 
 bool AcceptedState::has_reached_accept_state() const
@@ -36,11 +35,11 @@ bool AcceptedState::is_within_value() const
 
 bool AcceptedState::should_start_transition(const std::string &token)
 {
-    if (!can_accept_more_input())
+    if (!AcceptedState::can_accept_more_input())
     {
         return false;
     }
-    return accepted_walker_->should_start_transition(token);
+    return walker_dispatch::should_start_transition(*accepted_walker_, token);
 }
 
 std::vector<nb::ref<Walker>> AcceptedState::consume_token(const std::string &token)
@@ -57,6 +56,20 @@ nb::object AcceptedState::get_current_value() const
     return accepted_walker_->get_current_value();
 }
 
+std::optional<std::string> AcceptedState::get_raw_value() const
+{
+    if (_raw_value_)
+    {
+        return _raw_value_;
+    }
+    return accepted_walker_->get_raw_value();
+}
+
+uint64_t AcceptedState::signature() const
+{
+    return hash_combine(hash_bytes("AcceptedState"), accepted_walker_->signature());
+}
+
 bool AcceptedState::operator==(const Walker &other) const
 {
     return *accepted_walker_ == other;
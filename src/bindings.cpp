@@ -1,22 +1,68 @@
 #include "accepted_state.h"
+#include "document_validator.h"
+#include "grammar_image.h"
+#include "logit_masker.h"
+#include "machine_cache.h"
+#include "mask_pipeline.h"
+#include "minimizer.h"
+#include "small_vector.h"
 #include "state_machine.h"
 #include "state_machine_trampoline.h"
+#include "token_bitmask.h"
+#include "token_classifier.h"
+#include "token_mask_cache.h"
+#include "token_vocabulary.h"
 #include "walker.h"
+#include "walker_checkpoints.h"
+#include "walker_set.h"
 #include "walker_trampoline.h"
+#include "walker_serializer.h"
 
 #include <nanobind/nanobind.h>
+#include <nanobind/ndarray.h>
+#include <nanobind/stl/function.h>
 #include <nanobind/stl/optional.h>
 #include <nanobind/stl/pair.h>
+#include <nanobind/stl/set.h>
+#include <nanobind/stl/shared_ptr.h>
 #include <nanobind/stl/string.h>
 #include <nanobind/stl/tuple.h>
 #include <nanobind/stl/unordered_map.h>
 #include <nanobind/stl/variant.h>
 #include <nanobind/stl/vector.h>
+#include <nanobind/stl/detail/nb_list.h>
 #include <nanobind/intrusive/counter.inl>
 
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
 namespace nb = nanobind;
 using namespace nb::literals;
 
+// SmallVector converts to and from Python lists, like std::vector
+namespace nanobind::detail
+{
+    template <typename T, size_t N>
+    struct type_caster<SmallVector<T, N>> : list_caster<SmallVector<T, N>, T>
+    {
+    };
+}
+
+// Accessors for StateMachine fields exposed as properties; setters refuse frozen machines
+template <auto Member>
+auto get_field(const StateMachine &sm)
+{
+    return sm.*Member;
+}
+
+template <auto Member>
+void set_field(StateMachine &sm, std::remove_cvref_t<decltype(std::declval<StateMachine &>().*Member)> value)
+{
+    sm.check_mutable();
+    sm.*Member = std::move(value);
+}
+
 static int dummy_init(PyObject *self, PyObject *args, PyObject *kwds)
 {
     return PyBaseObject_Type.tp_init(self, args, kwds);
@@ -26,6 +72,80 @@ static PyType_Slot init_slots[] = {
     {Py_tp_init, (void *)dummy_init},
     {0, nullptr}};
 
+using Logits = nb::ndarray<nb::device::cpu>;
+
+// A [vocab] or [batch, vocab] logits buffer, contiguous along the vocabulary
+struct LogitsView
+{
+    void *data;
+    LogitType type;
+    size_t rows;
+    size_t size;
+    size_t row_stride;
+};
+
+static LogitsView logits_view(const Logits &logits)
+{
+    LogitsView view{logits.data(), LogitType::Float32, 1, 0, 0};
+    nb::dlpack::dtype dtype = logits.dtype();
+    if (dtype == nb::dtype<float>())
+    {
+        view.type = LogitType::Float32;
+    }
+    else if (dtype.code == static_cast<uint8_t>(nb::dlpack::dtype_code::Float) && dtype.bits == 16 && dtype.lanes == 1)
+    {
+        view.type = LogitType::Float16;
+    }
+    else if (dtype.code == static_cast<uint8_t>(nb::dlpack::dtype_code::Bfloat) && dtype.bits == 16 && dtype.lanes == 1)
+    {
+        view.type = LogitType::BFloat16;
+    }
+    else
+    {
+        throw std::invalid_argument("Logits must be float32, float16 or bfloat16");
+    }
+
+    if (logits.ndim() == 1 && logits.stride(0) == 1)
+    {
+        view.size = logits.shape(0);
+    }
+    else if (logits.ndim() == 2 && logits.stride(1) == 1 && logits.stride(0) >= 0)
+    {
+        view.rows = logits.shape(0);
+        view.size = logits.shape(1);
+        view.row_stride = static_cast<size_t>(logits.stride(0));
+    }
+    else
+    {
+        throw std::invalid_argument("Logits must have shape [vocab] or [batch, vocab] and be contiguous along the vocabulary");
+    }
+    return view;
+}
+
+static void mask_logits(const Logits &logits, const std::vector<const TokenBitmask *> &masks)
+{
+    if (std::find(masks.begin(), masks.end(), nullptr) != masks.end())
+    {
+        throw std::invalid_argument("Masks must not be None");
+    }
+    LogitsView view = logits_view(logits);
+    nb::gil_scoped_release release;
+    LogitMasker::apply_batch(view.data, view.type, view.rows, view.size, view.row_stride, masks);
+}
+
+// Runs a consume_tokens() overload without the GIL, returning the final walkers or every step.
+template <typename Consume>
+static nb::object consume_tokens_result(bool keep_steps, const Consume &consume)
+{
+    std::vector<std::vector<nb::ref<Walker>>> steps;
+    std::vector<nb::ref<Walker>> walkers;
+    {
+        nb::gil_scoped_release release;
+        walkers = consume(keep_steps ? &steps : nullptr);
+    }
+    return keep_steps ? nb::cast(steps) : nb::cast(walkers);
+}
+
 NB_MODULE(_core, m)
 {
     m.doc() = R"pbdoc(
@@ -39,6 +159,18 @@ NB_MODULE(_core, m)
 
            StateMachine
            Walker
+           GrammarImage
+           LogitMasker
+           MachineCache
+           MaskPipeline
+           StateMachineMinimizer
+           TokenBitmask
+           TokenClassifier
+           TokenMaskCache
+           TokenVocabulary
+           WalkerCheckpoints
+           WalkerSerializer
+           WalkerSet
     )pbdoc";
 
     nb::intrusive_init(
@@ -70,25 +202,98 @@ NB_MODULE(_core, m)
             nb::arg("end_states") = std::vector<StateMachine::State>{"$"},
             nb::arg("is_optional") = false,
             nb::arg("is_case_sensitive") = true)
-        .def_rw("state_graph", &StateMachine::state_graph_)
-        .def_rw("start_state", &StateMachine::start_state_)
-        .def_rw("end_states", &StateMachine::end_states_)
-        .def_rw("is_optional", &StateMachine::is_optional_)
-        .def_rw("is_case_sensitive", &StateMachine::is_case_sensitive_)
+        .def_prop_rw("state_graph", &get_field<&StateMachine::state_graph_>, &set_field<&StateMachine::state_graph_>)
+        .def_prop_rw("start_state", &get_field<&StateMachine::start_state_>, &set_field<&StateMachine::start_state_>)
+        .def_prop_rw("end_states", &get_field<&StateMachine::end_states_>, &set_field<&StateMachine::end_states_>)
+        .def_prop_rw("is_optional", &get_field<&StateMachine::is_optional_>, &set_field<&StateMachine::is_optional_>)
+        .def_prop_rw("is_case_sensitive", &get_field<&StateMachine::is_case_sensitive_>, &set_field<&StateMachine::is_case_sensitive_>)
+        .def_prop_rw("max_walkers", &get_field<&StateMachine::max_walkers_>, &set_field<&StateMachine::max_walkers_>)
+        .def_prop_rw("walker_priority", &get_field<&StateMachine::walker_priority_>, &set_field<&StateMachine::walker_priority_>,
+                     nb::arg("value").none())
+        .def("freeze", &StateMachine::freeze,
+             "Make this machine and every machine reachable from it immutable and safe to share between threads")
+        .def_prop_ro("frozen", &StateMachine::is_frozen)
+        .def_prop_rw(
+            "pruned_walkers",
+            [](const StateMachine &sm)
+            { return sm.pruned_walkers_.load(); },
+            [](StateMachine &sm, size_t value)
+            { sm.pruned_walkers_ = value; })
         .def("get_new_walker", &StateMachine::get_new_walker, nb::arg("state") = nb::none())
         .def("get_walkers", &StateMachine::get_walkers, nb::arg("state") = nb::none())
         .def("get_edges", &StateMachine::get_edges, nb::arg("state"))
         .def("get_transitions", &StateMachine::get_transitions, nb::arg("walker"), nb::arg("state") = nb::none())
         .def("advance", &StateMachine::advance, nb::arg("walker"), nb::arg("token"))
         .def("branch_walker", &StateMachine::branch_walker, nb::arg("walker"), nb::arg("token") = nb::none())
+        .def(
+            "advance_pruned",
+            [](const StateMachine &sm, nb::ref<Walker> walker, const std::string &token, size_t max_walkers, StateMachine::WalkerPriority priority)
+            {
+                StateMachine::PruneScope scope(max_walkers, std::move(priority));
+                return sm.advance(walker, token);
+            },
+            nb::arg("walker"), nb::arg("token"), nb::arg("max_walkers"), nb::arg("priority") = nb::none(),
+            "Advance with a walker cap that also applies to every nested machine")
+        .def_static("default_walker_priority", &StateMachine::default_walker_priority, nb::arg("walker"))
         .def_static(
             "advance_all",
             nb::overload_cast<std::vector<nb::ref<Walker>> &, const std::string &>(&StateMachine::advance_all),
             "Advance multiple walkers with a token")
         .def_static(
             "advance_all",
-            nb::overload_cast<std::vector<nb::ref<Walker>> &, const std::string &, const tsl::htrie_set<char> &>(&StateMachine::advance_all),
+            [](std::vector<nb::ref<Walker>> &walkers, const std::string &token, const TokenVocabulary &vocab)
+            { return StateMachine::advance_all(walkers, token, vocab.trie()); },
+            "walkers"_a,
+            "token"_a,
+            "vocab"_a,
             "Advance multiple walkers with a token, validating against vocabulary")
+        .def_static(
+            "consume_tokens",
+            [](const std::vector<nb::ref<Walker>> &walkers, const std::vector<std::string> &tokens, bool keep_steps)
+            {
+                return consume_tokens_result(keep_steps, [&](auto *steps)
+                                             { return StateMachine::consume_tokens(walkers, tokens, steps); });
+            },
+            "walkers"_a,
+            "tokens"_a,
+            "keep_steps"_a = false,
+            "Feed a sequence of tokens through the walkers, returning the final walkers or, with keep_steps, the walkers after each token")
+        .def_static(
+            "consume_text",
+            &StateMachine::consume_text,
+            "walkers"_a,
+            "text"_a,
+            "chunk_bytes"_a = 64,
+            nb::call_guard<nb::gil_scoped_release>(),
+            "Feed text through the walkers in chunks that never split a UTF-8 sequence")
+        .def_static(
+            "can_consume",
+            &StateMachine::can_consume,
+            "walkers"_a,
+            "token"_a,
+            "Whether any walker can consume the token in full, without keeping the advanced walkers")
+        .def_static(
+            "can_end",
+            &StateMachine::can_end,
+            "walkers"_a,
+            "Whether any walker has reached an accept state")
+        .def_static(
+            "jump_forward",
+            &StateMachine::jump_forward,
+            "walkers"_a,
+            "max_length"_a = 256,
+            "Find the continuation forced by the grammar and advance through it")
+        .def_static(
+            "verify_draft",
+            &StateMachine::verify_draft,
+            "walkers"_a,
+            "tokens"_a,
+            "Check a batch of draft tokens, returning the accepted count and the walkers after each")
+        .def("fingerprint", &StateMachine::fingerprint)
+        .def("fingerprint_key", &StateMachine::fingerprint_key)
+        .def("first_bytes", &StateMachine::first_bytes)
+        .def("may_start_with", &StateMachine::may_start_with, "byte"_a)
+        .def_prop_ro("nullable", &StateMachine::is_nullable)
         .def("__eq__", &StateMachine::operator==)
         .def("__repr__", &StateMachine::to_string);
 
@@ -104,13 +309,13 @@ NB_MODULE(_core, m)
         .def_prop_rw(
             "state_machine",
             [](Walker &w)
-            { return w.state_machine_; },
+            { return w.state_machine_.ref(); },
             [](Walker &w, StateMachine *sm)
             { w.state_machine_ = sm; })
         .def_prop_rw(
             "_raw_value",
             [](const Walker &w) -> std::optional<std::string>
-            { return w._raw_value_; },
+            { return w._raw_value_.to_optional(); },
             [](Walker &w, std::optional<std::string> v)
             { w._raw_value_ = v; },
             nb::arg().none())
@@ -124,17 +329,30 @@ NB_MODULE(_core, m)
             nb::arg().none())
 
         .def_rw("accepted_history", &Walker::accepted_history_)
-        .def_rw("explored_edges", &Walker::explored_edges_)
+        .def_prop_rw(
+            "explored_edges",
+            [](const Walker &w) -> std::set<Walker::VisitedEdge>
+            { return w.explored_edges_.get(); },
+            [](Walker &w, std::set<Walker::VisitedEdge> v)
+            { w.explored_edges_ = std::move(v); })
         .def_rw("current_state", &Walker::current_state_)
         .def_rw("target_state", &Walker::target_state_)
         .def_rw("consumed_character_count", &Walker::consumed_character_count_)
-        .def_rw("remaining_input", &Walker::remaining_input_, "remaining_input"_a = nb::none())
+        .def_prop_rw(
+            "remaining_input",
+            [](const Walker &w) -> std::optional<std::string>
+            { return w.remaining_input_.to_optional(); },
+            [](Walker &w, std::optional<std::string> v)
+            { w.remaining_input_ = v; },
+            nb::arg().none())
         .def_rw("_accepts_more_input", &Walker::_accepts_more_input_)
 
         .def("get_current_value", &Walker::get_current_value)
         .def("get_raw_value", &Walker::get_raw_value)
         .def("clone", &Walker::clone)
         .def("consume_token", &Walker::consume_token)
+        .def("can_consume", &Walker::can_consume, "token"_a)
+        .def("can_end", &Walker::can_end)
         .def("can_accept_more_input", &Walker::can_accept_more_input)
         .def("is_within_value", &Walker::is_within_value)
         .def("should_start_transition", &Walker::should_start_transition)
@@ -142,6 +360,7 @@ NB_MODULE(_core, m)
         .def("accepts_any_token", &Walker::accepts_any_token)
         .def("get_valid_continuations", &Walker::get_valid_continuations, "depth"_a = 0)
         .def("has_reached_accept_state", &Walker::has_reached_accept_state)
+        .def("signature", &Walker::signature)
         .def("start_transition", &Walker::start_transition, "transition_walker"_a, "token"_a = nb::none(), "start_state"_a = nb::none(), "target_state"_a = nb::none())
         .def("complete_transition", &Walker::complete_transition)
         .def("branch", &Walker::branch, "token"_a = nb::none())
@@ -157,6 +376,22 @@ NB_MODULE(_core, m)
             { return w.accepted_walker_; },
             [](AcceptedState &w, nb::ref<Walker> walker)
             { w.accepted_walker_ = walker; })
+        .def_prop_ro(
+            "accepted_history",
+            [](const AcceptedState &w)
+            { return w.accepted_walker_->accepted_history_; })
+        .def_prop_ro(
+            "explored_edges",
+            [](const AcceptedState &w) -> std::set<Walker::VisitedEdge>
+            { return w.accepted_walker_->explored_edges_.get(); })
+        .def_prop_rw(
+            "_raw_value",
+            [](const AcceptedState &w)
+            { return w.get_raw_value(); },
+            [](AcceptedState &w, std::optional<std::string> v)
+            { w._raw_value_ = v; },
+            nb::arg().none())
+        .def("get_raw_value", &AcceptedState::get_raw_value)
         .def("clone", &AcceptedState::clone)
         .def("can_accept_more_input", &AcceptedState::can_accept_more_input)
         .def("has_reached_accept_state", &AcceptedState::has_reached_accept_state)
@@ -165,4 +400,346 @@ NB_MODULE(_core, m)
         .def("consume_token", &AcceptedState::consume_token)
         .def("__eq__", &AcceptedState::operator==)
         .def("__repr__", &AcceptedState::to_string);
+
+    nb::class_<WalkerSerializer>(m, "WalkerSerializer")
+        .def_static(
+            "serialize",
+            [](nb::ref<StateMachine> root, const std::vector<nb::ref<Walker>> &walkers)
+            {
+                std::string data = WalkerSerializer::serialize(root, walkers);
+                return nb::bytes(data.data(), data.size());
+            },
+            "root"_a,
+            "walkers"_a,
+            "Snapshot a set of walkers into a compact binary blob")
+        .def_static(
+            "deserialize",
+            [](nb::ref<StateMachine> root, nb::bytes data)
+            {
+                return WalkerSerializer::deserialize(root, std::string_view(data.c_str(), data.size()));
+            },
+            "root"_a,
+            "data"_a,
+            "Restore a walker set previously produced by serialize");
+
+    nb::class_<WalkerCheckpoints>(m, "WalkerCheckpoints")
+        .def(nb::init<size_t>(), "window"_a)
+        .def("push", &WalkerCheckpoints::push, "walkers"_a,
+             "Record the walkers after a step and return its step number")
+        .def(
+            "peek",
+            [](const WalkerCheckpoints &checkpoints, size_t steps_back)
+            { return *checkpoints.peek(steps_back); },
+            "steps_back"_a = 0,
+            "Walkers of the checkpoint steps_back steps before the latest")
+        .def(
+            "rollback",
+            [](WalkerCheckpoints &checkpoints, size_t steps)
+            { return *checkpoints.rollback(steps); },
+            "steps"_a,
+            "Discard the latest checkpoints and return the walkers of the new latest one")
+        .def("clear", &WalkerCheckpoints::clear)
+        .def_prop_ro("step", &WalkerCheckpoints::step)
+        .def_prop_ro("window", &WalkerCheckpoints::window)
+        .def("__len__", &WalkerCheckpoints::size);
+
+    // Advancing is safe without the GIL: Python overrides, clones of Python
+    // walkers and their refcounts all take it themselves.
+    nb::class_<WalkerSet>(m, "WalkerSet")
+        .def(nb::init<std::vector<nb::ref<Walker>>>(), "walkers"_a)
+        .def("fork", &WalkerSet::fork, "n"_a,
+             "Handles that start out sharing this handle's walkers")
+        .def("consume_token", &WalkerSet::consume_token, "token"_a, nb::call_guard<nb::gil_scoped_release>(),
+             "Move this handle past a token, reusing the result if another handle already did")
+        .def(
+            "consume_bytes",
+            [](WalkerSet &set, nb::bytes data)
+            {
+                std::string token(data.c_str(), data.size());
+                nb::gil_scoped_release release;
+                return set.consume_token(token);
+            },
+            "data"_a,
+            "Move this handle past a token given as raw bytes, which may end inside a UTF-8 character")
+        .def_prop_ro(
+            "pending_bytes",
+            [](const WalkerSet &set)
+            { return nb::bytes(set.pending_bytes().data(), set.pending_bytes().size()); })
+        .def("shares_with", &WalkerSet::shares_with, "other"_a)
+        .def_prop_ro("walkers", &WalkerSet::walkers)
+        .def("__len__", &WalkerSet::size)
+        .def("__bool__", [](const WalkerSet &set)
+             { return !set.empty(); });
+
+    nb::class_<GrammarImage>(m, "GrammarImage")
+        .def_static(
+            "dumps",
+            [](nb::ref<StateMachine> root, GrammarImage::Describer describe)
+            {
+                std::string image = GrammarImage::dump(root, describe);
+                return nb::bytes(image.data(), image.size());
+            },
+            "root"_a,
+            "describe"_a = nb::none(),
+            "Serialize the graph reachable from root into an image")
+        .def_static(
+            "loads",
+            [](nb::bytes data, GrammarImage::Resolver resolve)
+            {
+                return GrammarImage::load_from(std::string_view(data.c_str(), data.size()), resolve);
+            },
+            "data"_a,
+            "resolve"_a = nb::none(),
+            "Rebuild a state machine graph from image bytes")
+        .def_static("save", &GrammarImage::save, "root"_a, "path"_a, "describe"_a = nb::none(),
+                    "Write the image for root to a file")
+        .def_static("load", &GrammarImage::load, "path"_a, "resolve"_a = nb::none(),
+                    "Memory-map an image file and rebuild its state machine graph");
+
+    nb::class_<MachineCache>(m, "MachineCache")
+        .def(nb::init<size_t>(), "capacity_bytes"_a = MachineCache::DEFAULT_CAPACITY_BYTES)
+        .def_static("instance", &MachineCache::instance, nb::rv_policy::reference,
+                    "The process-wide machine cache")
+        .def("intern", &MachineCache::intern, "machine"_a, nb::call_guard<nb::gil_scoped_release>(),
+             "Return the cached machine structurally identical to machine, inserting it if absent")
+        .def("get", &MachineCache::get, "key"_a, nb::call_guard<nb::gil_scoped_release>(),
+             "Look up a machine by key")
+        .def("put", &MachineCache::put, "key"_a, "machine"_a, nb::call_guard<nb::gil_scoped_release>(),
+             "Insert or replace the machine stored under key")
+        .def("clear", &MachineCache::clear, nb::call_guard<nb::gil_scoped_release>())
+        .def("__contains__", &MachineCache::contains, nb::call_guard<nb::gil_scoped_release>())
+        .def("__len__", &MachineCache::size, nb::call_guard<nb::gil_scoped_release>())
+        .def_prop_rw("capacity_bytes", &MachineCache::capacity_bytes, &MachineCache::set_capacity_bytes,
+                     nb::call_guard<nb::gil_scoped_release>())
+        .def_prop_ro("memory_usage", &MachineCache::memory_usage, nb::call_guard<nb::gil_scoped_release>())
+        .def_prop_ro("hits", &MachineCache::hits, nb::call_guard<nb::gil_scoped_release>())
+        .def_prop_ro("misses", &MachineCache::misses, nb::call_guard<nb::gil_scoped_release>())
+        .def_prop_ro("evictions", &MachineCache::evictions, nb::call_guard<nb::gil_scoped_release>());
+
+    nb::class_<MinimizeStats>(m, "MinimizeStats")
+        .def_ro("machines_before", &MinimizeStats::machines_before)
+        .def_ro("machines_after", &MinimizeStats::machines_after)
+        .def_ro("states_before", &MinimizeStats::states_before)
+        .def_ro("states_after", &MinimizeStats::states_after);
+
+    nb::class_<StateMachineMinimizer>(m, "StateMachineMinimizer")
+        .def_static("minimize", &StateMachineMinimizer::minimize, "root"_a,
+                    "Minimize the graph reachable from root in place")
+        .def_static("merge_equivalent_states", &StateMachineMinimizer::merge_equivalent_states, "machine"_a,
+                    "Merge equivalent states of a single deterministic machine");
+
+    nb::class_<ValidationResult>(m, "ValidationResult")
+        .def_ro("accepted", &ValidationResult::accepted)
+        .def_ro("error_offset", &ValidationResult::error_offset)
+        .def("__bool__", [](const ValidationResult &result)
+             { return result.accepted; })
+        .def("__repr__", [](const ValidationResult &result)
+             { return "ValidationResult(accepted=" + std::string(result.accepted ? "True" : "False") +
+                      ", error_offset=" + std::to_string(result.error_offset) + ")"; });
+
+    nb::class_<DocumentValidator>(m, "DocumentValidator")
+        .def(nb::init<nb::ref<StateMachine>, size_t, size_t>(),
+             "root"_a, "num_threads"_a = 0, "chunk_bytes"_a = DocumentValidator::DEFAULT_CHUNK_BYTES)
+        .def(
+            "validate",
+            [](const DocumentValidator &validator, const std::string &document)
+            { return validator.validate(document); },
+            "document"_a, nb::call_guard<nb::gil_scoped_release>(),
+            "Check one document against the grammar")
+        .def("validate_batch", &DocumentValidator::validate_batch, "documents"_a,
+             nb::call_guard<nb::gil_scoped_release>(),
+             "Check documents in parallel on native threads")
+        .def("validate_file", &DocumentValidator::validate_file, "path"_a,
+             nb::call_guard<nb::gil_scoped_release>(),
+             "Check every line of a memory-mapped newline-delimited file")
+        .def_prop_ro("root", &DocumentValidator::root)
+        .def_prop_ro("num_threads", &DocumentValidator::num_threads)
+        .def_prop_ro("chunk_bytes", &DocumentValidator::chunk_bytes);
+
+    nb::class_<TokenBitmask>(m, "TokenBitmask")
+        .def(nb::init<size_t, bool>(), "size"_a, "value"_a = false)
+        .def("__len__", &TokenBitmask::size)
+        .def("__contains__", &TokenBitmask::test, "token_id"_a)
+        .def("__eq__", &TokenBitmask::operator==)
+        .def("count", &TokenBitmask::count, "Number of allowed tokens")
+        .def("any", &TokenBitmask::any)
+        .def("allowed_ids", &TokenBitmask::allowed_ids, "Allowed token ids in ascending order")
+        .def(
+            "to_bytes",
+            [](const TokenBitmask &mask)
+            {
+                const auto &words = mask.words();
+                return nb::bytes(reinterpret_cast<const char *>(words.data()), words.size() * sizeof(uint32_t));
+            },
+            "The packed 32-bit words in native byte order");
+
+    nb::class_<TokenClassification>(m, "TokenClassification")
+        .def_ro("accepted", &TokenClassification::accepted)
+        .def_ro("dependent", &TokenClassification::dependent);
+
+    nb::class_<TokenVocabulary>(m, "TokenVocabulary")
+        .def(nb::init<std::vector<std::string>, bool>(), "pieces"_a, "decode"_a = true)
+        .def_static(
+            "decode_token",
+            [](const std::string &piece)
+            {
+                std::string token = TokenVocabulary::decode_token(piece);
+                return nb::bytes(token.data(), token.size());
+            },
+            "piece"_a,
+            "Bytes a single tokenizer piece stands for")
+        .def(
+            "token",
+            [](const TokenVocabulary &vocab, size_t id)
+            {
+                const std::string &token = vocab.token(id);
+                return nb::bytes(token.data(), token.size());
+            },
+            "id"_a,
+            "Decoded bytes of a token id")
+        .def(
+            "__contains__",
+            [](const TokenVocabulary &vocab, nb::bytes token)
+            { return vocab.contains(std::string_view(token.c_str(), token.size())); },
+            "token"_a)
+        .def("__len__", &TokenVocabulary::size);
+
+    nb::class_<TokenClassifier>(m, "TokenClassifier")
+        .def(nb::init<std::vector<std::string>, size_t>(),
+             "vocabulary"_a, "max_states"_a = TokenClassifier::DEFAULT_MAX_STATES)
+        .def(
+            "__init__",
+            [](TokenClassifier *classifier, const TokenVocabulary &vocabulary, size_t max_states)
+            { new (classifier) TokenClassifier(vocabulary.tokens(), max_states); },
+            "vocabulary"_a, "max_states"_a = TokenClassifier::DEFAULT_MAX_STATES)
+        .def("precompute", &TokenClassifier::precompute, "root"_a,
+             "Classify the start positions of every leaf machine reachable from root")
+        .def(
+            "classify",
+            [](TokenClassifier &classifier, nb::ref<Walker> leaf)
+            {
+                return std::const_pointer_cast<TokenClassification>(classifier.classify(leaf));
+            },
+            "leaf"_a,
+            "Classify the vocabulary for a leaf walker into accepted and dependent tokens")
+        .def("compute_mask", &TokenClassifier::compute_mask, "walkers"_a,
+             "Compute the tokens that at least one walker consumes completely")
+        .def("clear", &TokenClassifier::clear, nb::call_guard<nb::gil_scoped_release>())
+        .def("__len__", &TokenClassifier::size, nb::call_guard<nb::gil_scoped_release>())
+        .def_prop_ro("vocabulary", &TokenClassifier::vocabulary)
+        .def_prop_ro("memory_usage", &TokenClassifier::memory_usage, nb::call_guard<nb::gil_scoped_release>());
+
+    nb::class_<TokenMaskCache>(m, "TokenMaskCache")
+        .def(nb::init<std::vector<std::string>, size_t>(),
+             "vocabulary"_a, "capacity_bytes"_a = TokenMaskCache::DEFAULT_CAPACITY_BYTES)
+        .def(
+            "__init__",
+            [](TokenMaskCache *cache, const TokenVocabulary &vocabulary, size_t capacity_bytes)
+            { new (cache) TokenMaskCache(vocabulary.tokens(), capacity_bytes); },
+            "vocabulary"_a, "capacity_bytes"_a = TokenMaskCache::DEFAULT_CAPACITY_BYTES)
+        .def_static("signature", &TokenMaskCache::signature, "walkers"_a,
+                    "Canonical signature of a walker set")
+        .def(
+            "get_or_compute",
+            [](TokenMaskCache &cache, std::vector<nb::ref<Walker>> &walkers)
+            {
+                // Masks are never mutated from Python, so sharing the cached one is safe.
+                return std::const_pointer_cast<TokenBitmask>(cache.get_or_compute(walkers));
+            },
+            "walkers"_a,
+            "Return the allowed-token mask for the walkers, computing and caching it on a miss")
+        .def("compute", &TokenMaskCache::compute, "walkers"_a,
+             "Compute the mask for the walkers without touching the cache")
+        .def("clear", &TokenMaskCache::clear, nb::call_guard<nb::gil_scoped_release>())
+        .def("__contains__", &TokenMaskCache::contains, nb::call_guard<nb::gil_scoped_release>())
+        .def("__len__", &TokenMaskCache::size, nb::call_guard<nb::gil_scoped_release>())
+        .def(
+            "consume_tokens",
+            [](TokenMaskCache &cache, const std::vector<nb::ref<Walker>> &walkers, const std::vector<uint32_t> &token_ids, bool keep_steps)
+            {
+                return consume_tokens_result(keep_steps, [&](auto *steps)
+                                             { return StateMachine::consume_tokens(walkers, token_ids, cache.vocabulary(), steps); });
+            },
+            "walkers"_a, "token_ids"_a, "keep_steps"_a = false,
+            "Feed a sequence of token ids through the walkers, like StateMachine.consume_tokens")
+        .def(
+            "mask_logits",
+            [](TokenMaskCache &cache, Logits logits, std::vector<nb::ref<Walker>> &walkers)
+            {
+                auto mask = cache.get_or_compute(walkers);
+                mask_logits(logits, {mask.get()});
+            },
+            "logits"_a, "walkers"_a,
+            "Set the logits of tokens no walker accepts to -inf, in place, on every row")
+        .def(
+            "mask_logits_batch",
+            [](TokenMaskCache &cache, Logits logits, std::vector<std::vector<nb::ref<Walker>>> &walker_sets)
+            {
+                std::vector<std::shared_ptr<const TokenBitmask>> owned;
+                std::vector<const TokenBitmask *> masks;
+                for (auto &walkers : walker_sets)
+                {
+                    owned.push_back(cache.get_or_compute(walkers));
+                    masks.push_back(owned.back().get());
+                }
+                mask_logits(logits, masks);
+            },
+            "logits"_a, "walker_sets"_a,
+            "Mask a [batch, vocab] buffer in place, one walker set per row")
+        .def_prop_ro("vocabulary", &TokenMaskCache::vocabulary)
+        .def_prop_ro("classifier", &TokenMaskCache::classifier, nb::rv_policy::reference_internal)
+        .def_prop_rw("capacity_bytes", &TokenMaskCache::capacity_bytes, &TokenMaskCache::set_capacity_bytes,
+                     nb::call_guard<nb::gil_scoped_release>())
+        .def_prop_ro("memory_usage", &TokenMaskCache::memory_usage, nb::call_guard<nb::gil_scoped_release>())
+        .def_prop_ro("hits", &TokenMaskCache::hits, nb::call_guard<nb::gil_scoped_release>())
+        .def_prop_ro("misses", &TokenMaskCache::misses, nb::call_guard<nb::gil_scoped_release>())
+        .def_prop_ro("evictions", &TokenMaskCache::evictions, nb::call_guard<nb::gil_scoped_release>())
+        .def_prop_ro("hit_rate", &TokenMaskCache::hit_rate, nb::call_guard<nb::gil_scoped_release>());
+
+    nb::class_<PendingMask>(m, "PendingMask")
+        .def("done", &PendingMask::done, "Whether the step has been computed")
+        .def(
+            "result",
+            [](const PendingMask &pending)
+            {
+                const MaskStep *step;
+                {
+                    nb::gil_scoped_release release;
+                    step = &pending.wait();
+                }
+                return std::make_pair(step->walkers, std::const_pointer_cast<TokenBitmask>(step->mask));
+            },
+            "Wait for the step and return the advanced walkers and their mask");
+
+    nb::class_<MaskPipeline>(m, "MaskPipeline")
+        .def(nb::init<std::vector<std::string>, size_t, size_t>(),
+             "vocabulary"_a, "num_threads"_a = 1, "capacity_bytes"_a = TokenMaskCache::DEFAULT_CAPACITY_BYTES)
+        .def(
+            "__init__",
+            [](MaskPipeline *pipeline, const TokenVocabulary &vocabulary, size_t num_threads, size_t capacity_bytes)
+            { new (pipeline) MaskPipeline(vocabulary.tokens(), num_threads, capacity_bytes); },
+            "vocabulary"_a, "num_threads"_a = 1, "capacity_bytes"_a = TokenMaskCache::DEFAULT_CAPACITY_BYTES)
+        .def("submit", &MaskPipeline::submit, "walkers"_a, "token"_a,
+             "Advance the walkers with a sampled token and compute the next mask in the background")
+        .def("submit_walkers", &MaskPipeline::submit_walkers, "walkers"_a,
+             "Compute the mask for the walkers as they are in the background")
+        .def("close", &MaskPipeline::close, nb::call_guard<nb::gil_scoped_release>(),
+             "Finish queued requests and stop the workers")
+        .def_prop_ro("cache", &MaskPipeline::cache, nb::rv_policy::reference_internal)
+        .def_prop_ro("pending", &MaskPipeline::pending, nb::call_guard<nb::gil_scoped_release>());
+
+    nb::class_<LogitMasker>(m, "LogitMasker")
+        .def_static(
+            "apply",
+            [](Logits logits, const TokenBitmask &mask)
+            { mask_logits(logits, {&mask}); },
+            "logits"_a, "mask"_a,
+            "Set disallowed logits to -inf in place, applying one mask to every row")
+        .def_static(
+            "apply",
+            [](Logits logits, const std::vector<const TokenBitmask *> &masks)
+            { mask_logits(logits, masks); },
+            "logits"_a, "masks"_a,
+            "Set disallowed logits to -inf in place, one mask per row")
+        .def_static("backend", &LogitMasker::backend, "The kernel selected for this CPU");
 }
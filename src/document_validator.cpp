@@ -0,0 +1,158 @@
+#include "document_validator.h"
+#include "mapped_file.h"
+#include "utf8.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace nb = nanobind;
+
+namespace
+{
+  // Walkers after consuming text in full, with equal walkers collapsed
+  std::vector<nb::ref<Walker>> consume_fully(const std::vector<nb::ref<Walker>> &walkers, std::string_view text)
+  {
+    return StateMachine::consume_tokens(walkers, {std::string(text)});
+  }
+}
+
+DocumentValidator::DocumentValidator(nb::ref<StateMachine> root, size_t num_threads, size_t chunk_bytes)
+    : root_(std::move(root)), num_threads_(num_threads), chunk_bytes_(chunk_bytes)
+{
+  if (!root_)
+  {
+    throw std::invalid_argument("DocumentValidator needs a root state machine");
+  }
+  if (chunk_bytes_ == 0)
+  {
+    throw std::invalid_argument("chunk_bytes must be positive");
+  }
+  if (num_threads_ == 0)
+  {
+    num_threads_ = std::max(1u, std::thread::hardware_concurrency());
+  }
+  const_cast<StateMachine *>(root_.get())->freeze();
+}
+
+ValidationResult DocumentValidator::validate(std::string_view document) const
+{
+  std::vector<nb::ref<Walker>> walkers = const_cast<StateMachine *>(root_.get())->get_walkers();
+  for (size_t begin = 0, end; begin < document.size(); begin = end)
+  {
+    end = utf8_chunk_end(document, begin, chunk_bytes_);
+    std::string_view chunk = document.substr(begin, end - begin);
+    // Malformed bytes, e.g. from a file, could not be passed to Python subclasses as str.
+    std::vector<nb::ref<Walker>> advanced;
+    if (utf8_is_valid(chunk))
+    {
+      advanced = consume_fully(walkers, chunk);
+    }
+    if (!advanced.empty())
+    {
+      walkers = std::move(advanced);
+      continue;
+    }
+
+    // Replay the rejected chunk a character at a time to find the culprit.
+    for (size_t character = begin, next; character < end; character = next)
+    {
+      next = utf8_chunk_end(document, character, 1);
+      std::string_view bytes = document.substr(character, next - character);
+      if (!utf8_is_valid(bytes))
+      {
+        return {false, character};
+      }
+      advanced = consume_fully(walkers, bytes);
+      if (advanced.empty())
+      {
+        return {false, character};
+      }
+      walkers = std::move(advanced);
+    }
+  }
+  return {StateMachine::can_end(walkers), document.size()};
+}
+
+std::vector<ValidationResult> DocumentValidator::validate_batch(const std::vector<std::string> &documents) const
+{
+  return validate_all(std::vector<std::string_view>(documents.begin(), documents.end()));
+}
+
+std::vector<ValidationResult> DocumentValidator::validate_file(const std::string &path) const
+{
+  MappedFile file(path, "document file");
+  std::string_view data = file.data();
+
+  std::vector<std::string_view> lines;
+  for (size_t begin = 0; begin < data.size();)
+  {
+    size_t end = std::min(data.find('\n', begin), data.size());
+    std::string_view line = data.substr(begin, end - begin);
+    if (line.ends_with('\r'))
+    {
+      line.remove_suffix(1);
+    }
+    lines.push_back(line);
+    begin = end + 1;
+  }
+  return validate_all(lines);
+}
+
+std::vector<ValidationResult> DocumentValidator::validate_all(const std::vector<std::string_view> &documents) const
+{
+  std::vector<ValidationResult> results(documents.size());
+  std::atomic<size_t> next_document{0};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  // Workers claim documents one at a time, so a few long documents do not
+  // leave the other threads idle.
+  auto work = [&]
+  {
+    for (size_t i = next_document++; i < documents.size(); i = next_document++)
+    {
+      try
+      {
+        results[i] = validate(documents[i]);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error)
+        {
+          error = std::current_exception();
+        }
+        next_document = documents.size();
+      }
+    }
+  };
+
+  size_t num_threads = std::min(num_threads_, documents.size());
+  if (num_threads <= 1)
+  {
+    work();
+  }
+  else
+  {
+    std::vector<std::thread> workers;
+    workers.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+      workers.emplace_back(work);
+    }
+    for (auto &worker : workers)
+    {
+      worker.join();
+    }
+  }
+
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
+  return results;
+}
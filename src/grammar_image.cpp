@@ -0,0 +1,395 @@
+#include "grammar_image.h"
+#include "mapped_file.h"
+
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace nb = nanobind;
+
+using State = StateMachine::State;
+using StateGraph = StateMachine::StateGraph;
+
+namespace
+{
+  constexpr uint32_t IS_NATIVE = 1 << 0;
+  constexpr uint32_t IS_OPTIONAL = 1 << 1;
+  constexpr uint32_t IS_CASE_SENSITIVE = 1 << 2;
+
+  // Integer states are stored inline, string states as string table offsets.
+  struct StateRef
+  {
+    uint32_t is_string;
+    uint32_t value;
+  };
+
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t machine_count;
+    uint32_t state_count;
+    uint32_t edge_count;
+    uint32_t end_state_count;
+    uint32_t byte_order;
+    uint64_t machines_offset;
+    uint64_t states_offset;
+    uint64_t edges_offset;
+    uint64_t end_states_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+  };
+
+  struct MachineRecord
+  {
+    uint32_t flags;
+    StateRef start_state;
+    uint32_t first_state;
+    uint32_t state_count;
+    uint32_t first_end_state;
+    uint32_t end_state_count;
+    uint32_t type_name;
+    uint32_t key;
+  };
+
+  struct StateRecord
+  {
+    StateRef state;
+    uint32_t first_edge;
+    uint32_t edge_count;
+  };
+
+  struct EdgeRecord
+  {
+    uint32_t machine;
+    StateRef target_state;
+  };
+
+  class StringTable
+  {
+  public:
+    std::string data;
+
+    uint32_t intern(const std::string &value)
+    {
+      auto it = offsets_.find(value);
+      if (it != offsets_.end())
+      {
+        return it->second;
+      }
+      auto offset = static_cast<uint32_t>(data.size());
+      auto size = static_cast<uint32_t>(value.size());
+      data.append(reinterpret_cast<const char *>(&size), sizeof(size));
+      data.append(value);
+      offsets_.emplace(value, offset);
+      return offset;
+    }
+
+  private:
+    std::unordered_map<std::string, uint32_t> offsets_;
+  };
+
+  StateRef encode_state(const State &state, StringTable &strings)
+  {
+    if (std::holds_alternative<int>(state))
+    {
+      return {0, static_cast<uint32_t>(std::get<int>(state))};
+    }
+    return {1, strings.intern(std::get<std::string>(state))};
+  }
+
+  template <typename T>
+  void append_section(std::string &buffer, uint64_t &offset, const std::vector<T> &records)
+  {
+    buffer.resize((buffer.size() + 7) & ~size_t(7), '\0');
+    offset = buffer.size();
+    buffer.append(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(T));
+  }
+
+  // Read-only view over an image; records are used in place, never copied.
+  class ImageView
+  {
+  public:
+    explicit ImageView(std::string_view image) : image_(image)
+    {
+      if (image_.size() < sizeof(Header) ||
+          std::memcmp(image_.data(), GrammarImage::MAGIC, sizeof(GrammarImage::MAGIC)) != 0)
+      {
+        throw std::invalid_argument("Data is not a grammar image");
+      }
+      header_ = reinterpret_cast<const Header *>(image_.data());
+      // Records are read in place, so an image written on a host of the other
+      // byte order cannot be used; this field reads back swapped there.
+      if (header_->byte_order != GrammarImage::BYTE_ORDER_MARK)
+      {
+        throw std::invalid_argument("Grammar image was written with a different byte order");
+      }
+      if (header_->version != GrammarImage::VERSION)
+      {
+        throw std::invalid_argument("Unsupported grammar image version");
+      }
+      if (header_->machine_count == 0)
+      {
+        throw std::runtime_error("Corrupt grammar image");
+      }
+      machines = section<MachineRecord>(header_->machines_offset, header_->machine_count);
+      states = section<StateRecord>(header_->states_offset, header_->state_count);
+      edges = section<EdgeRecord>(header_->edges_offset, header_->edge_count);
+      end_states = section<StateRef>(header_->end_states_offset, header_->end_state_count);
+      if (header_->strings_offset > image_.size() ||
+          header_->strings_size > image_.size() - header_->strings_offset)
+      {
+        throw std::runtime_error("Corrupt grammar image");
+      }
+      strings_ = image_.substr(header_->strings_offset, header_->strings_size);
+    }
+
+    const Header &header() const { return *header_; }
+
+    std::string string_at(uint32_t offset) const
+    {
+      uint32_t size;
+      if (offset > strings_.size() || strings_.size() - offset < sizeof(size))
+      {
+        throw std::runtime_error("Corrupt grammar image");
+      }
+      std::memcpy(&size, strings_.data() + offset, sizeof(size));
+      if (strings_.size() - offset - sizeof(size) < size)
+      {
+        throw std::runtime_error("Corrupt grammar image");
+      }
+      return std::string(strings_.substr(offset + sizeof(size), size));
+    }
+
+    State decode_state(const StateRef &ref) const
+    {
+      if (ref.is_string)
+      {
+        return string_at(ref.value);
+      }
+      return static_cast<int>(ref.value);
+    }
+
+    void check_range(uint32_t first, uint32_t count, uint32_t total) const
+    {
+      if (first > total || count > total - first)
+      {
+        throw std::runtime_error("Corrupt grammar image");
+      }
+    }
+
+    const MachineRecord *machines = nullptr;
+    const StateRecord *states = nullptr;
+    const EdgeRecord *edges = nullptr;
+    const StateRef *end_states = nullptr;
+
+  private:
+    template <typename T>
+    const T *section(uint64_t offset, uint32_t count) const
+    {
+      if (offset % alignof(T) != 0 || offset > image_.size() ||
+          uint64_t(count) * sizeof(T) > image_.size() - offset)
+      {
+        throw std::runtime_error("Corrupt grammar image");
+      }
+      return reinterpret_cast<const T *>(image_.data() + offset);
+    }
+
+    std::string_view image_;
+    std::string_view strings_;
+    const Header *header_ = nullptr;
+  };
+}
+
+std::string GrammarImage::dump(const nb::ref<StateMachine> &root, const Describer &describe)
+{
+  auto machines = root->collect_state_machines();
+  std::unordered_map<const StateMachine *, uint32_t> machine_ids;
+  for (size_t i = 0; i < machines.size(); ++i)
+  {
+    machine_ids.emplace(machines[i], static_cast<uint32_t>(i));
+  }
+
+  StringTable strings;
+  std::vector<MachineRecord> machine_records;
+  std::vector<StateRecord> state_records;
+  std::vector<EdgeRecord> edge_records;
+  std::vector<StateRef> end_state_records;
+
+  for (StateMachine *machine : machines)
+  {
+    bool native = machine->is_native();
+
+    MachineRecord record{};
+    record.flags = (native ? IS_NATIVE : 0) |
+                   (machine->is_optional_ ? IS_OPTIONAL : 0) |
+                   (machine->is_case_sensitive_ ? IS_CASE_SENSITIVE : 0);
+    record.start_state = encode_state(machine->start_state_, strings);
+    record.type_name = strings.intern(native ? "StateMachine" : machine->get_name());
+    record.key = strings.intern(!native && describe ? describe(nb::ref<StateMachine>(machine)) : "");
+
+    // Sorted so that identical graphs always produce identical images.
+    std::map<State, const std::vector<StateMachine::Edge> *> sorted_graph;
+    for (const auto &[state, edges] : machine->state_graph_)
+    {
+      sorted_graph.emplace(state, &edges);
+    }
+
+    record.first_state = static_cast<uint32_t>(state_records.size());
+    record.state_count = static_cast<uint32_t>(sorted_graph.size());
+    for (const auto &[state, edges] : sorted_graph)
+    {
+      StateRecord state_record{};
+      state_record.state = encode_state(state, strings);
+      state_record.first_edge = static_cast<uint32_t>(edge_records.size());
+      state_record.edge_count = static_cast<uint32_t>(edges->size());
+      for (const auto &[edge, target_state] : *edges)
+      {
+        edge_records.push_back({machine_ids.at(edge.get()), encode_state(target_state, strings)});
+      }
+      state_records.push_back(state_record);
+    }
+
+    record.first_end_state = static_cast<uint32_t>(end_state_records.size());
+    record.end_state_count = static_cast<uint32_t>(machine->end_states_.size());
+    for (const auto &end_state : machine->end_states_)
+    {
+      end_state_records.push_back(encode_state(end_state, strings));
+    }
+
+    machine_records.push_back(record);
+  }
+
+  Header header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.byte_order = BYTE_ORDER_MARK;
+  header.machine_count = static_cast<uint32_t>(machine_records.size());
+  header.state_count = static_cast<uint32_t>(state_records.size());
+  header.edge_count = static_cast<uint32_t>(edge_records.size());
+  header.end_state_count = static_cast<uint32_t>(end_state_records.size());
+
+  std::string buffer(sizeof(Header), '\0');
+  append_section(buffer, header.machines_offset, machine_records);
+  append_section(buffer, header.states_offset, state_records);
+  append_section(buffer, header.edges_offset, edge_records);
+  append_section(buffer, header.end_states_offset, end_state_records);
+  buffer.resize((buffer.size() + 7) & ~size_t(7), '\0');
+  header.strings_offset = buffer.size();
+  header.strings_size = strings.data.size();
+  buffer.append(strings.data);
+
+  std::memcpy(buffer.data(), &header, sizeof(Header));
+  return buffer;
+}
+
+nb::ref<StateMachine> GrammarImage::load_from(std::string_view image, const Resolver &resolve)
+{
+  // Records are read in place, which needs them to be suitably aligned.
+  if (reinterpret_cast<uintptr_t>(image.data()) % alignof(Header) != 0)
+  {
+    std::string aligned(image);
+    return load_from(aligned, resolve);
+  }
+
+  ImageView view(image);
+  const Header &header = view.header();
+
+  std::vector<nb::ref<StateMachine>> machines;
+  machines.reserve(header.machine_count);
+  std::unordered_set<const StateMachine *> resolved;
+  for (uint32_t i = 0; i < header.machine_count; ++i)
+  {
+    const MachineRecord &record = view.machines[i];
+    if (record.flags & IS_NATIVE)
+    {
+      machines.push_back(nb::ref<StateMachine>(new StateMachine()));
+      continue;
+    }
+    std::string type_name = view.string_at(record.type_name);
+    if (!resolve)
+    {
+      throw std::invalid_argument(
+          "Grammar image contains a '" + type_name + "' machine but no resolver was given");
+    }
+    auto machine = resolve(type_name, view.string_at(record.key));
+    if (!machine)
+    {
+      throw std::invalid_argument("Resolver returned no state machine for '" + type_name + "'");
+    }
+    // Each record overwrites its machine's graph, so resolved machines must
+    // be fresh: neither shared through a cache nor reused for another record.
+    machine->check_mutable();
+    if (!resolved.insert(machine.get()).second)
+    {
+      throw std::invalid_argument("Resolver returned the same state machine for two '" + type_name + "' records");
+    }
+    machines.push_back(machine);
+  }
+
+  for (uint32_t i = 0; i < header.machine_count; ++i)
+  {
+    const MachineRecord &record = view.machines[i];
+    view.check_range(record.first_state, record.state_count, header.state_count);
+    view.check_range(record.first_end_state, record.end_state_count, header.end_state_count);
+
+    StateGraph state_graph;
+    state_graph.reserve(record.state_count);
+    for (uint32_t s = record.first_state; s < record.first_state + record.state_count; ++s)
+    {
+      const StateRecord &state_record = view.states[s];
+      view.check_range(state_record.first_edge, state_record.edge_count, header.edge_count);
+
+      std::vector<StateMachine::Edge> edges;
+      edges.reserve(state_record.edge_count);
+      for (uint32_t e = state_record.first_edge; e < state_record.first_edge + state_record.edge_count; ++e)
+      {
+        const EdgeRecord &edge_record = view.edges[e];
+        if (edge_record.machine >= header.machine_count)
+        {
+          throw std::runtime_error("Corrupt grammar image");
+        }
+        edges.emplace_back(machines[edge_record.machine], view.decode_state(edge_record.target_state));
+      }
+      state_graph.emplace(view.decode_state(state_record.state), std::move(edges));
+    }
+
+    std::vector<State> end_states;
+    end_states.reserve(record.end_state_count);
+    for (uint32_t s = record.first_end_state; s < record.first_end_state + record.end_state_count; ++s)
+    {
+      end_states.push_back(view.decode_state(view.end_states[s]));
+    }
+
+    StateMachine &machine = *machines[i];
+    machine.state_graph_ = std::move(state_graph);
+    machine.start_state_ = view.decode_state(record.start_state);
+    machine.end_states_ = std::move(end_states);
+    machine.is_optional_ = (record.flags & IS_OPTIONAL) != 0;
+    machine.is_case_sensitive_ = (record.flags & IS_CASE_SENSITIVE) != 0;
+  }
+
+  machines.front()->freeze();
+  return machines.front();
+}
+
+void GrammarImage::save(const nb::ref<StateMachine> &root, const std::string &path, const Describer &describe)
+{
+  std::string image = dump(root, describe);
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(image.data(), static_cast<std::streamsize>(image.size()));
+  if (!out)
+  {
+    throw std::runtime_error("Cannot write grammar image '" + path + "'");
+  }
+}
+
+nb::ref<StateMachine> GrammarImage::load(const std::string &path, const Resolver &resolve)
+{
+  MappedFile file(path, "grammar image");
+  return load_from(file.data(), resolve);
+}
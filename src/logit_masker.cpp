@@ -0,0 +1,260 @@
+#include "logit_masker.h"
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PSE_X86_KERNELS 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define PSE_NEON_KERNELS 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+  // -inf bit patterns; masking never needs to convert between float formats.
+  constexpr uint32_t FLOAT32_NEG_INF = 0xFF800000u;
+  constexpr uint16_t FLOAT16_NEG_INF = 0xFC00u;
+  constexpr uint16_t BFLOAT16_NEG_INF = 0xFF80u;
+
+  // Each kernel masks word_count full mask words, i.e. 32 * word_count logits.
+  using Kernel32 = void (*)(uint32_t *data, const uint32_t *words, size_t word_count, uint32_t fill);
+  using Kernel16 = void (*)(uint16_t *data, const uint32_t *words, size_t word_count, uint16_t fill);
+
+  template <typename T>
+  void mask_words_scalar(T *data, const uint32_t *words, size_t word_count, T fill)
+  {
+    for (size_t w = 0; w < word_count; ++w)
+    {
+      uint32_t rejected = ~words[w];
+      T *block = data + w * 32;
+      if (rejected == ~0u)
+      {
+        std::fill_n(block, 32, fill);
+        continue;
+      }
+      while (rejected)
+      {
+        block[std::countr_zero(rejected)] = fill;
+        rejected &= rejected - 1;
+      }
+    }
+  }
+
+#if PSE_X86_KERNELS
+  __attribute__((target("avx2"))) void mask_words32_avx2(uint32_t *data, const uint32_t *words, size_t word_count, uint32_t fill)
+  {
+    const __m256i fill_v = _mm256_set1_epi32(static_cast<int>(fill));
+    const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i zero = _mm256_setzero_si256();
+    for (size_t w = 0; w < word_count; ++w)
+    {
+      uint32_t word = words[w];
+      if (word == ~0u)
+      {
+        continue;
+      }
+      uint32_t *block = data + w * 32;
+      for (int k = 0; k < 4; ++k)
+      {
+        __m256i selected = _mm256_and_si256(_mm256_set1_epi32(static_cast<int>((word >> (8 * k)) & 0xFF)), bits);
+        __m256i rejected = _mm256_cmpeq_epi32(selected, zero);
+        _mm256_maskstore_epi32(reinterpret_cast<int *>(block + 8 * k), rejected, fill_v);
+      }
+    }
+  }
+
+  __attribute__((target("avx2"))) void mask_words16_avx2(uint16_t *data, const uint32_t *words, size_t word_count, uint16_t fill)
+  {
+    const __m256i fill_v = _mm256_set1_epi16(static_cast<short>(fill));
+    const __m256i bits = _mm256_setr_epi16(
+        0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+        0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, static_cast<short>(0x8000));
+    const __m256i zero = _mm256_setzero_si256();
+    for (size_t w = 0; w < word_count; ++w)
+    {
+      uint32_t word = words[w];
+      if (word == ~0u)
+      {
+        continue;
+      }
+      uint16_t *block = data + w * 32;
+      for (int k = 0; k < 2; ++k)
+      {
+        __m256i *lane = reinterpret_cast<__m256i *>(block + 16 * k);
+        __m256i selected = _mm256_and_si256(_mm256_set1_epi16(static_cast<short>((word >> (16 * k)) & 0xFFFF)), bits);
+        __m256i rejected = _mm256_cmpeq_epi16(selected, zero);
+        _mm256_storeu_si256(lane, _mm256_blendv_epi8(_mm256_loadu_si256(lane), fill_v, rejected));
+      }
+    }
+  }
+
+  __attribute__((target("avx512f"))) void mask_words32_avx512(uint32_t *data, const uint32_t *words, size_t word_count, uint32_t fill)
+  {
+    const __m512i fill_v = _mm512_set1_epi32(static_cast<int>(fill));
+    for (size_t w = 0; w < word_count; ++w)
+    {
+      uint32_t rejected = ~words[w];
+      if (rejected == 0)
+      {
+        continue;
+      }
+      uint32_t *block = data + w * 32;
+      _mm512_mask_storeu_epi32(block, static_cast<__mmask16>(rejected), fill_v);
+      _mm512_mask_storeu_epi32(block + 16, static_cast<__mmask16>(rejected >> 16), fill_v);
+    }
+  }
+
+  __attribute__((target("avx512f,avx512bw"))) void mask_words16_avx512(uint16_t *data, const uint32_t *words, size_t word_count, uint16_t fill)
+  {
+    const __m512i fill_v = _mm512_set1_epi16(static_cast<short>(fill));
+    for (size_t w = 0; w < word_count; ++w)
+    {
+      uint32_t rejected = ~words[w];
+      if (rejected == 0)
+      {
+        continue;
+      }
+      _mm512_mask_storeu_epi16(data + w * 32, static_cast<__mmask32>(rejected), fill_v);
+    }
+  }
+#endif
+
+#if PSE_NEON_KERNELS
+  void mask_words32_neon(uint32_t *data, const uint32_t *words, size_t word_count, uint32_t fill)
+  {
+    const uint32x4_t fill_v = vdupq_n_u32(fill);
+    const uint32_t bit_values[4] = {1, 2, 4, 8};
+    const uint32x4_t bits = vld1q_u32(bit_values);
+    const uint32x4_t zero = vdupq_n_u32(0);
+    for (size_t w = 0; w < word_count; ++w)
+    {
+      uint32_t word = words[w];
+      if (word == ~0u)
+      {
+        continue;
+      }
+      uint32_t *block = data + w * 32;
+      for (int k = 0; k < 8; ++k)
+      {
+        uint32x4_t rejected = vceqq_u32(vandq_u32(vdupq_n_u32((word >> (4 * k)) & 0xF), bits), zero);
+        vst1q_u32(block + 4 * k, vbslq_u32(rejected, fill_v, vld1q_u32(block + 4 * k)));
+      }
+    }
+  }
+
+  void mask_words16_neon(uint16_t *data, const uint32_t *words, size_t word_count, uint16_t fill)
+  {
+    const uint16x8_t fill_v = vdupq_n_u16(fill);
+    const uint16_t bit_values[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+    const uint16x8_t bits = vld1q_u16(bit_values);
+    const uint16x8_t zero = vdupq_n_u16(0);
+    for (size_t w = 0; w < word_count; ++w)
+    {
+      uint32_t word = words[w];
+      if (word == ~0u)
+      {
+        continue;
+      }
+      uint16_t *block = data + w * 32;
+      for (int k = 0; k < 4; ++k)
+      {
+        uint16x8_t selected = vandq_u16(vdupq_n_u16(static_cast<uint16_t>((word >> (8 * k)) & 0xFF)), bits);
+        uint16x8_t rejected = vceqq_u16(selected, zero);
+        vst1q_u16(block + 8 * k, vbslq_u16(rejected, fill_v, vld1q_u16(block + 8 * k)));
+      }
+    }
+  }
+#endif
+
+  struct Kernels
+  {
+    Kernel32 words32;
+    Kernel16 words16;
+    const char *name;
+  };
+
+  const Kernels &kernels()
+  {
+    static const Kernels selected = []() -> Kernels
+    {
+#if PSE_X86_KERNELS
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+      {
+        return {mask_words32_avx512, mask_words16_avx512, "avx512"};
+      }
+      if (__builtin_cpu_supports("avx2"))
+      {
+        return {mask_words32_avx2, mask_words16_avx2, "avx2"};
+      }
+#elif PSE_NEON_KERNELS
+      return {mask_words32_neon, mask_words16_neon, "neon"};
+#endif
+      return {mask_words_scalar<uint32_t>, mask_words_scalar<uint16_t>, "scalar"};
+    }();
+    return selected;
+  }
+
+  /**
+   * @brief Mask one row with the selected kernel, finishing the tail in scalar code
+   * @param data The row, reinterpreted as raw bit patterns
+   * @param size Number of logits in the row
+   * @param mask Allowed tokens
+   * @param fill The -inf bit pattern of the element type
+   * @param kernel The vectorized kernel for full mask words
+   */
+  template <typename T, typename Kernel>
+  void mask_row(T *data, size_t size, const TokenBitmask &mask, T fill, Kernel kernel)
+  {
+    size_t word_count = std::min(size, mask.size()) / 32;
+    kernel(data, mask.words().data(), word_count, fill);
+    for (size_t i = word_count * 32; i < size; ++i)
+    {
+      if (!mask.test(i))
+      {
+        data[i] = fill;
+      }
+    }
+  }
+}
+
+void LogitMasker::apply(void *logits, LogitType type, size_t size, const TokenBitmask &mask)
+{
+  const Kernels &selected = kernels();
+  switch (type)
+  {
+  case LogitType::Float32:
+    mask_row(static_cast<uint32_t *>(logits), size, mask, FLOAT32_NEG_INF, selected.words32);
+    break;
+  case LogitType::Float16:
+    mask_row(static_cast<uint16_t *>(logits), size, mask, FLOAT16_NEG_INF, selected.words16);
+    break;
+  case LogitType::BFloat16:
+    mask_row(static_cast<uint16_t *>(logits), size, mask, BFLOAT16_NEG_INF, selected.words16);
+    break;
+  }
+}
+
+void LogitMasker::apply_batch(void *logits, LogitType type, size_t rows, size_t size, size_t row_stride,
+                              const std::vector<const TokenBitmask *> &masks)
+{
+  if (masks.size() != rows && masks.size() != 1)
+  {
+    throw std::invalid_argument("Expected one mask per row or a single shared mask");
+  }
+  size_t element_size = type == LogitType::Float32 ? 4 : 2;
+  char *base = static_cast<char *>(logits);
+  for (size_t row = 0; row < rows; ++row)
+  {
+    const TokenBitmask *mask = masks.size() == 1 ? masks[0] : masks[row];
+    apply(base + row * row_stride * element_size, type, size, *mask);
+  }
+}
+
+const char *LogitMasker::backend()
+{
+  return kernels().name;
+}
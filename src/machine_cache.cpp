@@ -0,0 +1,183 @@
+#include "machine_cache.h"
+
+namespace nb = nanobind;
+
+MachineCache::MachineCache(size_t capacity_bytes)
+    : capacity_bytes_(capacity_bytes) {}
+
+MachineCache &MachineCache::instance()
+{
+  // Leaked on purpose: cached machines may own Python objects, which must not
+  // be released after the interpreter has shut down.
+  static MachineCache *cache = new MachineCache();
+  return *cache;
+}
+
+nb::ref<StateMachine> MachineCache::intern(const nb::ref<StateMachine> &machine)
+{
+  // Fingerprinting may call into Python, so do it before taking the lock.
+  uint64_t key = machine->fingerprint();
+
+  std::list<Entry> evicted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it != index_.end())
+    {
+      // The caller's machine is not stored, so it stays mutable.
+      ++hits_;
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return it->second->machine;
+    }
+
+    // Freezing and sizing only read the C++ graph, so they can run under the
+    // lock; doing them here keeps a machine that is not stored mutable.
+    const_cast<StateMachine *>(machine.get())->freeze();
+    size_t bytes = estimate_size(*machine);
+    ++misses_;
+    entries_.push_front({key, machine, bytes});
+    index_.emplace(key, entries_.begin());
+    memory_usage_ += bytes;
+    evict_locked(evicted);
+  }
+  return machine;
+}
+
+nb::ref<StateMachine> MachineCache::get(uint64_t key)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it == index_.end())
+  {
+    ++misses_;
+    return nb::ref<StateMachine>();
+  }
+  ++hits_;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->machine;
+}
+
+void MachineCache::put(uint64_t key, const nb::ref<StateMachine> &machine)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it != index_.end() && it->second->machine.get() == machine.get())
+    {
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return;
+    }
+  }
+
+  // The machine is about to be shared, so it is frozen first.
+  const_cast<StateMachine *>(machine.get())->freeze();
+  size_t bytes = estimate_size(*machine);
+
+  std::list<Entry> evicted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it != index_.end())
+    {
+      memory_usage_ -= it->second->bytes;
+      evicted.splice(evicted.end(), entries_, it->second);
+      index_.erase(it);
+    }
+    entries_.push_front({key, machine, bytes});
+    index_.emplace(key, entries_.begin());
+    memory_usage_ += bytes;
+    evict_locked(evicted);
+  }
+}
+
+bool MachineCache::contains(uint64_t key) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return index_.count(key) > 0;
+}
+
+void MachineCache::clear()
+{
+  std::list<Entry> evicted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    evicted.swap(entries_);
+    index_.clear();
+    memory_usage_ = 0;
+  }
+}
+
+size_t MachineCache::size() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+size_t MachineCache::memory_usage() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return memory_usage_;
+}
+
+size_t MachineCache::capacity_bytes() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return capacity_bytes_;
+}
+
+void MachineCache::set_capacity_bytes(size_t capacity_bytes)
+{
+  std::list<Entry> evicted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_bytes_ = capacity_bytes;
+    evict_locked(evicted);
+  }
+}
+
+size_t MachineCache::hits() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+size_t MachineCache::misses() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+size_t MachineCache::evictions() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return evictions_;
+}
+
+void MachineCache::evict_locked(std::list<Entry> &evicted)
+{
+  // The most recently inserted entry is kept even if it alone exceeds the budget.
+  while (memory_usage_ > capacity_bytes_ && entries_.size() > 1)
+  {
+    auto last = std::prev(entries_.end());
+    memory_usage_ -= last->bytes;
+    index_.erase(last->key);
+    evicted.splice(evicted.end(), entries_, last);
+    ++evictions_;
+  }
+}
+
+size_t MachineCache::estimate_size(const StateMachine &machine)
+{
+  size_t bytes = 0;
+  for (const StateMachine *node : machine.collect_state_machines())
+  {
+    bytes += sizeof(StateMachine);
+    for (const auto &[state, edges] : node->state_graph_)
+    {
+      bytes += sizeof(std::pair<const StateMachine::State, std::vector<StateMachine::Edge>>) + 2 * sizeof(void *);
+      bytes += edges.capacity() * sizeof(StateMachine::Edge);
+    }
+    bytes += node->end_states_.capacity() * sizeof(StateMachine::State);
+  }
+  return bytes;
+}
@@ -0,0 +1,54 @@
+#include "mapped_file.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string &path, const std::string &what)
+    : data_(MAP_FAILED)
+{
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    throw std::runtime_error("Cannot open " + what + " '" + path + "': " + std::strerror(errno));
+  }
+  struct stat info;
+  if (::fstat(fd, &info) != 0)
+  {
+    int error = errno;
+    ::close(fd);
+    throw std::runtime_error("Cannot stat " + what + " '" + path + "': " + std::strerror(error));
+  }
+  size_ = static_cast<size_t>(info.st_size);
+  int error = 0;
+  if (size_ > 0)
+  {
+    data_ = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    error = errno;
+  }
+  ::close(fd);
+  if (size_ > 0 && data_ == MAP_FAILED)
+  {
+    throw std::runtime_error("Cannot map " + what + " '" + path + "': " + std::strerror(error));
+  }
+}
+
+MappedFile::~MappedFile()
+{
+  if (data_ != MAP_FAILED)
+  {
+    ::munmap(data_, size_);
+  }
+}
+
+std::string_view MappedFile::data() const
+{
+  if (data_ == MAP_FAILED)
+  {
+    return {};
+  }
+  return std::string_view(static_cast<const char *>(data_), size_);
+}
@@ -0,0 +1,135 @@
+#include "mask_pipeline.h"
+
+#include <chrono>
+#include <stdexcept>
+
+namespace nb = nanobind;
+
+bool PendingMask::done() const
+{
+  return future_.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+const MaskStep &PendingMask::wait() const
+{
+  return future_.get();
+}
+
+MaskPipeline::MaskPipeline(std::vector<std::string> vocabulary, size_t num_threads, size_t capacity_bytes)
+    : cache_(std::move(vocabulary), capacity_bytes)
+{
+  if (num_threads == 0)
+  {
+    throw std::invalid_argument("MaskPipeline needs at least one thread");
+  }
+  workers_.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i)
+  {
+    workers_.emplace_back([this]
+                          { run(); });
+  }
+}
+
+MaskPipeline::~MaskPipeline()
+{
+  // Queued walkers may need the GIL to finish, so never wait while holding it.
+  if (PyGILState_Check())
+  {
+    nb::gil_scoped_release release;
+    close();
+  }
+  else
+  {
+    close();
+  }
+}
+
+PendingMask MaskPipeline::submit(std::vector<nb::ref<Walker>> walkers, std::string token)
+{
+  return enqueue([this, walkers = std::move(walkers), token = std::move(token)]() mutable
+                 {
+                   MaskStep step;
+                   for (auto &walker : walkers)
+                   {
+                     for (auto &advanced_walker : walker->consume_token(token))
+                     {
+                       if (!advanced_walker->remaining_input_)
+                       {
+                         step.walkers.push_back(std::move(advanced_walker));
+                       }
+                     }
+                   }
+                   walkers.clear();
+                   step.mask = cache_.get_or_compute(step.walkers);
+                   return step; });
+}
+
+PendingMask MaskPipeline::submit_walkers(std::vector<nb::ref<Walker>> walkers)
+{
+  return enqueue([this, walkers = std::move(walkers)]() mutable
+                 {
+                   MaskStep step;
+                   step.walkers = std::move(walkers);
+                   step.mask = cache_.get_or_compute(step.walkers);
+                   return step; });
+}
+
+PendingMask MaskPipeline::enqueue(std::function<MaskStep()> work)
+{
+  std::packaged_task<MaskStep()> task(std::move(work));
+  PendingMask pending(task.get_future().share());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_)
+    {
+      throw std::runtime_error("MaskPipeline is closed");
+    }
+    queue_.push_back(std::move(task));
+  }
+  ready_.notify_one();
+  return pending;
+}
+
+void MaskPipeline::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_)
+    {
+      return;
+    }
+    closed_ = true;
+  }
+  ready_.notify_all();
+  for (auto &worker : workers_)
+  {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+size_t MaskPipeline::pending() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queue_.size();
+}
+
+void MaskPipeline::run()
+{
+  while (true)
+  {
+    std::packaged_task<MaskStep()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ready_.wait(lock, [this]
+                  { return closed_ || !queue_.empty(); });
+      if (queue_.empty())
+      {
+        return;
+      }
+      task = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    task();
+  }
+}
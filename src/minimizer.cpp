@@ -0,0 +1,354 @@
+#include "minimizer.h"
+#include "hashing.h"
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace nb = nanobind;
+
+using Edge = StateMachine::Edge;
+using State = StateMachine::State;
+using StateGraph = StateMachine::StateGraph;
+
+namespace
+{
+  size_t count_states(const StateMachine &root)
+  {
+    size_t count = 0;
+    for (const StateMachine *machine : root.collect_state_machines())
+    {
+      count += machine->state_graph_.size();
+    }
+    return count;
+  }
+
+  std::vector<State> sorted_end_states(const StateMachine &machine)
+  {
+    std::vector<State> end_states = machine.end_states_;
+    std::sort(end_states.begin(), end_states.end());
+    end_states.erase(std::unique(end_states.begin(), end_states.end()), end_states.end());
+    return end_states;
+  }
+
+  // Hash of a machine's own structure, with sub-machines identified by
+  // address; only meaningful once sub-machines have been hash-consed.
+  uint64_t local_hash(const StateMachine &machine)
+  {
+    uint64_t hash = hash_bytes(machine.is_native() ? "StateMachine" : machine.get_name());
+    if (!machine.is_native())
+    {
+      hash = hash_combine(hash, hash_bytes(machine.fingerprint_key()));
+    }
+    hash = hash_combine(hash, (machine.is_optional_ ? 1 : 0) | (machine.is_case_sensitive_ ? 2 : 0));
+    hash = hash_combine(hash, hash_state(machine.start_state_));
+    for (const auto &end_state : sorted_end_states(machine))
+    {
+      hash = hash_combine(hash, hash_state(end_state));
+    }
+
+    std::vector<uint64_t> state_hashes;
+    for (const auto &[state, edges] : machine.state_graph_)
+    {
+      uint64_t state_hash = hash_state(state);
+      for (const auto &[edge, target_state] : edges)
+      {
+        state_hash = hash_combine(state_hash, reinterpret_cast<uintptr_t>(edge.get()));
+        state_hash = hash_combine(state_hash, hash_state(target_state));
+      }
+      state_hashes.push_back(state_hash);
+    }
+    std::sort(state_hashes.begin(), state_hashes.end());
+    for (uint64_t state_hash : state_hashes)
+    {
+      hash = hash_combine(hash, state_hash);
+    }
+    return hash;
+  }
+
+  bool same_structure(const StateMachine &a, const StateMachine &b)
+  {
+    if (a.is_native() != b.is_native())
+    {
+      return false;
+    }
+    if (!a.is_native() &&
+        (typeid(a) != typeid(b) ||
+         a.get_name() != b.get_name() ||
+         a.fingerprint_key() != b.fingerprint_key()))
+    {
+      return false;
+    }
+    // Custom priorities cannot be compared, so their machines are never shared.
+    if (a.walker_priority_ || b.walker_priority_)
+    {
+      return false;
+    }
+    return a.is_optional_ == b.is_optional_ &&
+           a.is_case_sensitive_ == b.is_case_sensitive_ &&
+           a.max_walkers_ == b.max_walkers_ &&
+           a.start_state_ == b.start_state_ &&
+           sorted_end_states(a) == sorted_end_states(b) &&
+           a.state_graph_ == b.state_graph_;
+  }
+
+  // Marks every machine that lies on a reference cycle and returns all
+  // reachable machines in post-order.
+  void find_cycles(
+      StateMachine *machine,
+      std::vector<StateMachine *> &stack,
+      std::unordered_map<StateMachine *, size_t> &on_stack,
+      std::unordered_set<StateMachine *> &done,
+      std::unordered_set<StateMachine *> &cyclic,
+      std::vector<StateMachine *> &post_order)
+  {
+    on_stack.emplace(machine, stack.size());
+    stack.push_back(machine);
+
+    std::map<State, const std::vector<Edge> *> sorted_graph;
+    for (const auto &[state, edges] : machine->state_graph_)
+    {
+      sorted_graph.emplace(state, &edges);
+    }
+    for (const auto &[state, edges] : sorted_graph)
+    {
+      for (const auto &[edge, target_state] : *edges)
+      {
+        StateMachine *child = const_cast<StateMachine *>(edge.get());
+        if (auto it = on_stack.find(child); it != on_stack.end())
+        {
+          cyclic.insert(stack.begin() + it->second, stack.end());
+        }
+        else if (done.count(child) == 0)
+        {
+          find_cycles(child, stack, on_stack, done, cyclic, post_order);
+        }
+      }
+    }
+
+    stack.pop_back();
+    on_stack.erase(machine);
+    done.insert(machine);
+    post_order.push_back(machine);
+  }
+}
+
+bool StateMachineMinimizer::merge_equivalent_states(StateMachine &machine)
+{
+  machine.check_mutable();
+  StateGraph &graph = machine.state_graph_;
+
+  // Partition refinement is only sound when each state has at most one edge
+  // per sub-machine.
+  for (const auto &[state, edges] : graph)
+  {
+    std::unordered_set<const StateMachine *> labels;
+    for (const auto &[edge, target_state] : edges)
+    {
+      if (!labels.insert(edge.get()).second)
+      {
+        return false;
+      }
+    }
+  }
+
+  std::map<State, size_t> index;
+  auto add_state = [&](const State &state)
+  { index.emplace(state, 0); };
+  add_state(machine.start_state_);
+  for (const auto &end_state : machine.end_states_)
+  {
+    add_state(end_state);
+  }
+  for (const auto &[state, edges] : graph)
+  {
+    add_state(state);
+    for (const auto &[edge, target_state] : edges)
+    {
+      add_state(target_state);
+    }
+  }
+
+  std::vector<State> states;
+  for (auto &[state, i] : index)
+  {
+    i = states.size();
+    states.push_back(state);
+  }
+
+  const size_t n = states.size();
+  std::vector<const std::vector<Edge> *> outgoing(n, nullptr);
+  std::vector<bool> is_end(n, false);
+  for (size_t i = 0; i < n; ++i)
+  {
+    auto it = graph.find(states[i]);
+    if (it != graph.end())
+    {
+      outgoing[i] = &it->second;
+    }
+    is_end[i] = std::find(machine.end_states_.begin(), machine.end_states_.end(), states[i]) !=
+                machine.end_states_.end();
+  }
+
+  // Initial partition: acceptance and whether the state has any edges, which
+  // is observable through can_accept_more_input().
+  std::vector<size_t> block(n);
+  for (size_t i = 0; i < n; ++i)
+  {
+    bool has_edges = outgoing[i] && !outgoing[i]->empty();
+    block[i] = (is_end[i] ? 2 : 0) | (has_edges ? 1 : 0);
+  }
+
+  size_t block_count = 0;
+  while (true)
+  {
+    using Signature = std::pair<size_t, std::vector<std::pair<uintptr_t, size_t>>>;
+    std::map<Signature, size_t> blocks;
+    std::vector<size_t> refined(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+      Signature signature{block[i], {}};
+      if (outgoing[i])
+      {
+        for (const auto &[edge, target_state] : *outgoing[i])
+        {
+          signature.second.emplace_back(reinterpret_cast<uintptr_t>(edge.get()), block[index.at(target_state)]);
+        }
+        std::sort(signature.second.begin(), signature.second.end());
+      }
+      refined[i] = blocks.emplace(std::move(signature), blocks.size()).first->second;
+    }
+    block.swap(refined);
+    if (blocks.size() == block_count)
+    {
+      break;
+    }
+    block_count = blocks.size();
+  }
+
+  if (block_count == n)
+  {
+    return false;
+  }
+
+  // The first state of each block in sorted order represents it, except that
+  // the start state always keeps its name.
+  std::vector<std::optional<size_t>> representative(block_count);
+  representative[block[index.at(machine.start_state_)]] = index.at(machine.start_state_);
+  for (size_t i = 0; i < n; ++i)
+  {
+    if (!representative[block[i]])
+    {
+      representative[block[i]] = i;
+    }
+  }
+  auto rep_of = [&](const State &state) -> const State &
+  { return states[*representative[block[index.at(state)]]]; };
+
+  StateGraph merged;
+  for (size_t i = 0; i < n; ++i)
+  {
+    if (*representative[block[i]] != i || !outgoing[i])
+    {
+      continue;
+    }
+    std::vector<Edge> edges;
+    edges.reserve(outgoing[i]->size());
+    for (const auto &[edge, target_state] : *outgoing[i])
+    {
+      edges.emplace_back(edge, rep_of(target_state));
+    }
+    merged.emplace(states[i], std::move(edges));
+  }
+
+  std::vector<State> end_states;
+  for (const auto &end_state : machine.end_states_)
+  {
+    const State &rep = rep_of(end_state);
+    if (std::find(end_states.begin(), end_states.end(), rep) == end_states.end())
+    {
+      end_states.push_back(rep);
+    }
+  }
+
+  machine.state_graph_ = std::move(merged);
+  machine.end_states_ = std::move(end_states);
+  return true;
+}
+
+MinimizeStats StateMachineMinimizer::minimize(const nb::ref<StateMachine> &root)
+{
+  MinimizeStats stats;
+  auto machines = root->collect_state_machines();
+  for (const StateMachine *machine : machines)
+  {
+    machine->check_mutable();
+  }
+  stats.machines_before = machines.size();
+  stats.states_before = count_states(*root);
+
+  std::vector<StateMachine *> stack;
+  std::unordered_map<StateMachine *, size_t> on_stack;
+  std::unordered_set<StateMachine *> done;
+  std::unordered_set<StateMachine *> cyclic;
+  std::vector<StateMachine *> post_order;
+  find_cycles(const_cast<StateMachine *>(root.get()), stack, on_stack, done, cyclic, post_order);
+
+  std::unordered_map<const StateMachine *, nb::ref<StateMachine>> canonical;
+  std::unordered_map<uint64_t, std::vector<StateMachine *>> buckets;
+
+  // Children come before their parents, so every edge can be redirected to
+  // its canonical machine before the parent itself is compared.
+  for (StateMachine *machine : post_order)
+  {
+    for (auto &[state, edges] : machine->state_graph_)
+    {
+      for (auto &edge : edges)
+      {
+        if (auto it = canonical.find(edge.first.get()); it != canonical.end())
+        {
+          edge.first = it->second;
+        }
+      }
+      // Redirected edges may now be exact duplicates of each other.
+      std::vector<Edge> unique_edges;
+      unique_edges.reserve(edges.size());
+      for (auto &edge : edges)
+      {
+        if (std::find(unique_edges.begin(), unique_edges.end(), edge) == unique_edges.end())
+        {
+          unique_edges.push_back(edge);
+        }
+      }
+      edges.swap(unique_edges);
+    }
+
+    if (machine->is_native())
+    {
+      merge_equivalent_states(*machine);
+    }
+
+    if (cyclic.count(machine) > 0 || machine == root.get())
+    {
+      continue;
+    }
+
+    auto &bucket = buckets[local_hash(*machine)];
+    auto match = std::find_if(bucket.begin(), bucket.end(), [&](StateMachine *candidate)
+                              { return same_structure(*machine, *candidate); });
+    if (match != bucket.end())
+    {
+      canonical.emplace(machine, nb::ref<StateMachine>(*match));
+    }
+    else
+    {
+      bucket.push_back(machine);
+    }
+  }
+
+  stats.machines_after = root->collect_state_machines().size();
+  stats.states_after = count_states(*root);
+  return stats;
+}
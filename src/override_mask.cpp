@@ -0,0 +1,51 @@
+#include "override_mask.h"
+
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace
+{
+  std::mutex type_masks_mutex;
+  // Keyed by type; each type is kept alive so its address is never reused.
+  std::unordered_map<PyTypeObject *, uint64_t> type_masks;
+}
+
+uint64_t OverrideMask::resolve(PyTypeObject *type, nb::handle (*base)(), std::span<const char *const> names)
+{
+  if (names.size() > MAX_METHODS)
+  {
+    throw std::invalid_argument("Too many overridable methods");
+  }
+  {
+    std::lock_guard<std::mutex> lock(type_masks_mutex);
+    auto it = type_masks.find(type);
+    if (it != type_masks.end())
+    {
+      return it->second;
+    }
+  }
+
+  // Take the GIL before the lock again, never while holding it.
+  nb::gil_scoped_acquire guard;
+  nb::handle type_handle(reinterpret_cast<PyObject *>(type));
+  nb::handle base_type = base();
+  uint64_t mask = 0;
+  for (size_t slot = 0; slot < names.size(); ++slot)
+  {
+    nb::object method = nb::getattr(type_handle, names[slot], nb::none());
+    nb::object base_method = nb::getattr(base_type, names[slot], nb::none());
+    if (!method.is(base_method))
+    {
+      mask |= uint64_t(1) << slot;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(type_masks_mutex);
+  auto [it, inserted] = type_masks.emplace(type, mask);
+  if (inserted)
+  {
+    Py_INCREF(type);
+  }
+  return it->second;
+}
@@ -1,8 +1,16 @@
 #include "state_machine.h"
 #include "walker.h"
 #include "accepted_state.h"
+#include "hashing.h"
+#include "utf8.h"
+#include "walker_dispatch.h"
 #include <algorithm>
-#include <deque>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_set>
 
 namespace nb = nanobind;
 
@@ -10,6 +18,130 @@ using Edge = StateMachine::Edge;
 using State = StateMachine::State;
 using StateGraph = StateMachine::StateGraph;
 
+namespace
+{
+    uint64_t next_instance_id()
+    {
+        static std::atomic<uint64_t> counter{0};
+        return ++counter;
+    }
+
+    thread_local const StateMachine::PruneScope *current_prune_scope = nullptr;
+
+    /**
+     * A walker waiting to consume a token.
+     *
+     * The token is borrowed, not copied. It points at the caller's token,
+     * which outlives the call, or at a walker's remaining input, whose
+     * buffer input keeps alive even if the walker's field is reassigned.
+     */
+    struct Pending
+    {
+        nb::ref<Walker> walker;
+        const std::string *token;
+        SharedString input;
+
+        Pending(nb::ref<Walker> walker, const std::string &token)
+            : walker(std::move(walker)), token(&token) {}
+        Pending(nb::ref<Walker> walker, SharedString input)
+            : walker(std::move(walker)), token(&*input), input(std::move(input)) {}
+        // Same token as source, for walkers branched from it
+        Pending(nb::ref<Walker> walker, const Pending &source)
+            : walker(std::move(walker)), token(source.token), input(source.input) {}
+    };
+
+    using PendingQueue = SmallVector<Pending, 8>;
+
+    /**
+     * @brief Keep the highest-priority walkers across the results and the next BFS level
+     * @param result Finished walkers
+     * @param frontier Walkers still to be advanced
+     * @param limit Number of walkers to keep
+     * @param priority Ranks the walkers, higher first; null for StateMachine::default_walker_priority
+     * @return Number of walkers dropped
+     *
+     * Ties keep the earlier walker, and survivors keep their relative order.
+     */
+    size_t prune_walkers(
+        std::vector<nb::ref<Walker>> &result,
+        PendingQueue &frontier,
+        size_t limit,
+        const StateMachine::WalkerPriority *priority)
+    {
+        size_t total = result.size() + frontier.size();
+        std::vector<std::pair<double, size_t>> ranked;
+        ranked.reserve(total);
+        for (size_t i = 0; i < total; ++i)
+        {
+            const nb::ref<Walker> &walker = i < result.size() ? result[i] : frontier[i - result.size()].walker;
+            ranked.emplace_back(priority ? (*priority)(walker) : StateMachine::default_walker_priority(walker), i);
+        }
+        std::stable_sort(ranked.begin(), ranked.end(), [](const auto &a, const auto &b)
+                         { return a.first > b.first; });
+
+        std::vector<bool> keep(total, false);
+        for (size_t i = 0; i < limit; ++i)
+        {
+            keep[ranked[i].second] = true;
+        }
+
+        std::vector<nb::ref<Walker>> kept_result;
+        PendingQueue kept_frontier;
+        for (size_t i = 0; i < total; ++i)
+        {
+            if (!keep[i])
+            {
+                continue;
+            }
+            if (i < result.size())
+            {
+                kept_result.push_back(std::move(result[i]));
+            }
+            else
+            {
+                kept_frontier.push_back(std::move(frontier[i - result.size()]));
+            }
+        }
+        result.swap(kept_result);
+        frontier = std::move(kept_frontier);
+        return total - limit;
+    }
+}
+
+StateMachine::PruneScope::PruneScope(size_t max_walkers, WalkerPriority priority)
+    : max_walkers(max_walkers),
+      priority(std::move(priority)),
+      previous_(current_prune_scope)
+{
+    current_prune_scope = this;
+}
+
+StateMachine::PruneScope::~PruneScope()
+{
+    current_prune_scope = previous_;
+}
+
+const StateMachine::PruneScope *StateMachine::PruneScope::current()
+{
+    return current_prune_scope;
+}
+
+struct StateMachine::Lookahead
+{
+    struct Entry
+    {
+        // Bytes a consumed token can start with
+        ByteSet first;
+        // Whether an end state is reachable without consuming anything
+        bool nullable = false;
+    };
+
+    // The machine as a whole, as seen from an edge into it
+    Entry machine;
+    // Every state of a plain machine's graph
+    std::unordered_map<State, Entry> states;
+};
+
 StateMachine::StateMachine(
     StateGraph &&state_graph,
     State start_state,
@@ -20,11 +152,29 @@ StateMachine::StateMachine(
       start_state_(std::move(start_state)),
       end_states_(std::move(end_states)),
       is_optional_(is_optional),
-      is_case_sensitive_(is_case_sensitive) {}
+      is_case_sensitive_(is_case_sensitive),
+      instance_id_(next_instance_id()) {}
+
+StateMachine::StateMachine(const StateMachine &other)
+    : nb::intrusive_base(),
+      state_graph_(other.state_graph_),
+      start_state_(other.start_state_),
+      end_states_(other.end_states_),
+      is_optional_(other.is_optional_),
+      is_case_sensitive_(other.is_case_sensitive_),
+      instance_id_(next_instance_id()),
+      max_walkers_(other.max_walkers_),
+      walker_priority_(other.walker_priority_) {}
+
+StateMachine::~StateMachine()
+{
+    delete lookahead_.load(std::memory_order_acquire);
+}
 
 nb::ref<Walker> StateMachine::get_new_walker(std::optional<State> state)
 {
-    auto w = new Walker(nb::ref<StateMachine>(this), state);
+    auto w = new Walker(NativeRef(this), state);
+    w->kind_ = WalkerKind::Native;
     return nb::ref<Walker>(w);
 }
 
@@ -39,6 +189,12 @@ std::vector<nb::ref<Walker>> StateMachine::get_walkers(std::optional<State> stat
 }
 
 std::vector<Edge> StateMachine::get_edges(State state) const
+{
+    auto edges = edges_of(state);
+    return {edges.begin(), edges.end()};
+}
+
+std::span<const Edge> StateMachine::edges_of(State state) const
 {
     auto it = state_graph_.find(state);
     if (it == state_graph_.end())
@@ -51,44 +207,101 @@ std::vector<Edge> StateMachine::get_edges(State state) const
 std::vector<std::tuple<nb::ref<Walker>, State, State>>
 StateMachine::get_transitions(nb::ref<Walker> walker, std::optional<State> state) const
 {
-    std::vector<std::tuple<nb::ref<Walker>, State, State>> result;
+    Transitions transitions;
+    transitions_into(walker, state.value_or(walker->current_state_), transitions);
+    return {transitions.begin(), transitions.end()};
+}
 
-    State current_state = state.value_or(walker->current_state_);
+void StateMachine::transitions_into(
+    const nb::ref<Walker> &walker,
+    const State &state,
+    Transitions &out,
+    std::optional<uint8_t> first_byte) const
+{
+    // Overridden get_edges() must still be honoured, at the cost of a copy.
+    bool default_traversal = !overrides_traversal();
+    std::vector<Edge> copied;
+    std::span<const Edge> edges;
+    if (default_traversal)
+    {
+        edges = edges_of(state);
+    }
+    else
+    {
+        copied = get_edges(state);
+        edges = copied;
+    }
 
-    for (auto &[edge, target_state] : get_edges(current_state))
+    for (const auto &[edge, target_state] : edges)
     {
-        auto transition_walkers = edge->get_walkers();
-        for (const auto &transition : transition_walkers)
+        bool target_is_end = std::find(end_states_.begin(), end_states_.end(), target_state) != end_states_.end();
+
+        // A nullable edge is kept even if it cannot start: an optional one into an
+        // end state turns the rejection into an accepted state, and any other may
+        // be passed through on the way to a state that can start with the byte.
+        bool skip = first_byte && !edge->may_start_with(*first_byte) && !edge->is_nullable();
+        if (!skip)
         {
-            result.emplace_back(transition, current_state, target_state);
+            // The span only makes the graph const; the edge machines themselves are shared and mutable.
+            for (const auto &transition : const_cast<StateMachine *>(edge.get())->get_walkers())
+            {
+                out.emplace_back(transition, state, target_state);
+            }
         }
 
-        if (edge->is_optional_ &&
-            std::find(end_states_.begin(), end_states_.end(), target_state) == end_states_.end() &&
-            walker->can_accept_more_input())
+        if (edge->is_optional_ && !target_is_end && walker->can_accept_more_input())
         {
-
-            auto next_transitions = get_transitions(walker, target_state);
-            result.insert(result.end(), next_transitions.begin(), next_transitions.end());
+            if (default_traversal)
+            {
+                transitions_into(walker, target_state, out, first_byte);
+            }
+            else
+            {
+                auto next_transitions = get_transitions(walker, target_state);
+                out.insert(out.end(), next_transitions.begin(), next_transitions.end());
+            }
         }
     }
-
-    return result;
 }
 
 std::vector<nb::ref<Walker>> StateMachine::branch_walker(nb::ref<Walker> walker, std::optional<std::string> token)
 {
     std::vector<nb::ref<Walker>> result;
-    std::optional<std::string> input_token = token.has_value() ? token : walker->remaining_input_;
+    branch_walker_into(walker, token, result);
+    return result;
+}
+
+void StateMachine::branch_walker_into(
+    nb::ref<Walker> walker,
+    const std::optional<std::string> &token,
+    std::vector<nb::ref<Walker>> &out)
+{
+    std::optional<std::string> input_token = token.has_value() ? token : walker->remaining_input_.to_optional();
+
+    // Edges that cannot start with the next byte are dropped before any walker is created
+    std::optional<uint8_t> first_byte;
+    if (input_token && !input_token->empty())
+    {
+        first_byte = static_cast<uint8_t>(input_token->front());
+    }
 
-    auto transitions = get_transitions(walker);
+    Transitions transitions;
+    if (!overrides_traversal())
+    {
+        transitions_into(walker, walker->current_state_, transitions, first_byte);
+    }
+    else
+    {
+        auto overridden = get_transitions(walker);
+        transitions.insert(transitions.end(), overridden.begin(), overridden.end());
+    }
     for (const auto &[transition, start_state, target_state] : transitions)
     {
         auto branched_walker = walker->start_transition(transition, input_token, start_state, target_state);
 
         if (branched_walker)
         {
-            result.push_back(*branched_walker);
+            out.push_back(*branched_walker);
             continue;
         }
 
@@ -103,85 +316,275 @@ std::vector<nb::ref<Walker>> StateMachine::branch_walker(nb::ref<Walker> walker,
             }
 
             auto accepted = new AcceptedState(walker);
-            result.push_back(accepted);
+            out.push_back(accepted);
         }
     }
-
-    return result;
 }
 
 std::vector<nb::ref<Walker>> StateMachine::advance(nb::ref<Walker> walker, const std::string &token) const
 {
     std::vector<nb::ref<Walker>> result;
-    std::deque<std::pair<nb::ref<Walker>, std::string>> queue;
-    queue.push_back({walker, token});
+    advance_into(walker, token, result);
+    return result;
+}
+
+namespace
+{
+    // Scratch buffers for one level of nested advance_into() calls.
+    struct AdvanceFrame
+    {
+        PendingQueue queue;
+        PendingQueue next;
+        std::vector<nb::ref<Walker>> branched;
+        std::vector<nb::ref<Walker>> consumed;
+        std::vector<nb::ref<Walker>> result;
+    };
+
+    /**
+     * Borrows the calling thread's frame for the current nesting depth.
+     *
+     * Nested machines advance re-entrantly through their transition walkers,
+     * so every depth owns its frame. Buffers are emptied on release, keeping
+     * their capacity but no walkers.
+     */
+    class FrameLease
+    {
+    public:
+        FrameLease()
+        {
+            if (depth_ == frames_.size())
+            {
+                frames_.push_back(std::make_unique<AdvanceFrame>());
+            }
+            frame_ = frames_[depth_++].get();
+        }
+
+        ~FrameLease()
+        {
+            frame_->queue.clear();
+            frame_->next.clear();
+            frame_->branched.clear();
+            frame_->consumed.clear();
+            frame_->result.clear();
+            --depth_;
+        }
+
+        FrameLease(const FrameLease &) = delete;
+        FrameLease &operator=(const FrameLease &) = delete;
+
+        AdvanceFrame &operator*() const { return *frame_; }
+
+    private:
+        static thread_local std::vector<std::unique_ptr<AdvanceFrame>> frames_;
+        static thread_local size_t depth_;
+        AdvanceFrame *frame_;
+    };
+
+    thread_local std::vector<std::unique_ptr<AdvanceFrame>> FrameLease::frames_;
+    thread_local size_t FrameLease::depth_ = 0;
+}
 
-    auto handle_blocked_transition = [&](nb::ref<Walker> blocked_walker, const std::string &current_token)
+void StateMachine::advance_into(nb::ref<Walker> walker, const std::string &token, std::vector<nb::ref<Walker>> &out) const
+{
+    size_t limit = max_walkers_;
+    const WalkerPriority *priority = walker_priority_ ? &walker_priority_ : nullptr;
+    if (const PruneScope *scope = PruneScope::current())
+    {
+        limit = scope->max_walkers;
+        if (scope->priority)
+        {
+            priority = &scope->priority;
+        }
+    }
+
+    FrameLease lease;
+    AdvanceFrame &frame = *lease;
+    std::vector<nb::ref<Walker>> &result = frame.result;
+    frame.queue.emplace_back(walker, token);
+
+    auto handle_blocked_transition = [&](Pending &blocked)
     {
-        std::vector<nb::ref<Walker>> branched_walkers;
+        nb::ref<Walker> &blocked_walker = blocked.walker;
+        const std::string &current_token = *blocked.token;
+        std::vector<nb::ref<Walker>> &branched_walkers = frame.branched;
+        branched_walkers.clear();
 
-        for (auto branched_walker : blocked_walker->branch(current_token))
+        blocked_walker->branch_into(current_token, branched_walkers);
+        size_t kept = 0;
+        for (auto &branched_walker : branched_walkers)
         {
-            if (branched_walker->should_start_transition(current_token))
+            if (walker_dispatch::should_start_transition(*branched_walker, current_token))
             {
-                branched_walkers.push_back(branched_walker);
+                branched_walkers[kept++] = std::move(branched_walker);
             }
-            else if (branched_walker->has_reached_accept_state())
+            else if (walker_dispatch::has_reached_accept_state(*branched_walker))
             {
-                result.push_back(branched_walker);
+                result.push_back(std::move(branched_walker));
+                branched_walkers.clear();
                 return;
             }
         }
+        branched_walkers.resize(kept);
 
-        for (const auto &new_walker : branched_walkers)
+        for (auto &new_walker : branched_walkers)
         {
-            queue.push_back({new_walker, current_token});
+            frame.next.emplace_back(std::move(new_walker), blocked);
         }
 
-        if (branched_walkers.empty() && blocked_walker->remaining_input_)
+        if (kept == 0 && blocked_walker->remaining_input_)
         {
             result.push_back(blocked_walker);
         }
+        branched_walkers.clear();
     };
 
-    while (!queue.empty())
+    // Breadth-first, one level at a time, so that pruning between levels
+    // keeps the discarded walkers from ever being expanded.
+    while (!frame.queue.empty())
     {
-        auto [current_walker, current_token] = queue.front();
-        queue.pop_front();
+        for (Pending &pending : frame.queue)
+        {
+            nb::ref<Walker> &current_walker = pending.walker;
+            const std::string &current_token = *pending.token;
+            if (!current_walker->transition_walker_ ||
+                !walker_dispatch::should_start_transition(*current_walker, current_token))
+            {
+                handle_blocked_transition(pending);
+                continue;
+            }
 
-        if (!current_walker->transition_walker_ ||
-            !current_walker->should_start_transition(current_token))
+            frame.consumed.clear();
+            current_walker->transition_walker_->consume_token_into(current_token, frame.consumed);
+            for (auto &transition : frame.consumed)
+            {
+                auto [new_walker, is_accepted] = current_walker->complete_transition(transition);
+
+                if (!new_walker)
+                {
+                    continue;
+                }
+
+                if (is_accepted)
+                {
+                    new_walker = new AcceptedState(*new_walker);
+                }
+
+                if ((*new_walker)->remaining_input_)
+                {
+                    frame.next.emplace_back(*new_walker, (*new_walker)->remaining_input_);
+                }
+                else
+                {
+                    result.push_back(std::move(*new_walker));
+                }
+            }
+            frame.consumed.clear();
+        }
+        frame.queue.clear();
+        std::swap(frame.queue, frame.next);
+
+        if (limit > 0 && result.size() + frame.queue.size() > limit)
         {
-            handle_blocked_transition(current_walker, current_token);
-            continue;
+            pruned_walkers_ += prune_walkers(result, frame.queue, limit, priority);
         }
+    }
+
+    out.insert(out.end(), std::make_move_iterator(result.begin()), std::make_move_iterator(result.end()));
+}
+
+bool StateMachine::can_advance(nb::ref<Walker> walker, const std::string &token) const
+{
+    const PruneScope *scope = PruneScope::current();
+    if ((scope ? scope->max_walkers : max_walkers_) > 0)
+    {
+        std::vector<nb::ref<Walker>> advanced;
+        advance_into(walker, token, advanced);
+        return std::any_of(advanced.begin(), advanced.end(), [](const nb::ref<Walker> &advanced_walker)
+                           { return !advanced_walker->remaining_input_; });
+    }
+
+    FrameLease lease;
+    AdvanceFrame &frame = *lease;
+    // Depth-first, so the first complete path ends the search.
+    PendingQueue &stack = frame.queue;
+    stack.emplace_back(std::move(walker), token);
+
+    while (!stack.empty())
+    {
+        Pending current = std::move(stack.back());
+        stack.pop_back();
+        nb::ref<Walker> &current_walker = current.walker;
+        const std::string &current_token = *current.token;
 
-        for (auto transition : current_walker->transition_walker_->consume_token(current_token))
+        if (!current_walker->transition_walker_ ||
+            !walker_dispatch::should_start_transition(*current_walker, current_token))
         {
-            auto [new_walker, is_accepted] = current_walker->complete_transition(transition);
+            // Mirrors handle_blocked_transition() in advance_into(), whose
+            // results all have input left over.
+            std::vector<nb::ref<Walker>> &branched_walkers = frame.branched;
+            branched_walkers.clear();
+            current_walker->branch_into(current_token, branched_walkers);
 
-            if (!new_walker)
+            size_t kept = 0;
+            bool accepted = false;
+            for (auto &branched_walker : branched_walkers)
             {
-                continue;
+                if (walker_dispatch::should_start_transition(*branched_walker, current_token))
+                {
+                    branched_walkers[kept++] = std::move(branched_walker);
+                }
+                else if (walker_dispatch::has_reached_accept_state(*branched_walker))
+                {
+                    accepted = true;
+                    break;
+                }
             }
-
-            if (is_accepted)
+            if (!accepted)
             {
-                new_walker = new AcceptedState(*new_walker);
+                for (size_t i = kept; i-- > 0;)
+                {
+                    stack.emplace_back(std::move(branched_walkers[i]), current);
+                }
             }
+            branched_walkers.clear();
+            continue;
+        }
 
-            if ((*new_walker)->remaining_input_)
+        std::vector<nb::ref<Walker>> &consumed = frame.consumed;
+        consumed.clear();
+        current_walker->transition_walker_->consume_token_into(current_token, consumed);
+        size_t pending = stack.size();
+        for (auto &transition : consumed)
+        {
+            auto [new_walker, is_accepted] = current_walker->complete_transition(transition);
+            if (!new_walker)
             {
-                queue.push_back({*new_walker, *(*new_walker)->remaining_input_});
+                continue;
             }
-            else
+            if (!(*new_walker)->remaining_input_)
             {
-                result.push_back(*new_walker);
+                return true;
             }
+            SharedString remaining_input = (*new_walker)->remaining_input_;
+            stack.emplace_back(std::move(*new_walker), std::move(remaining_input));
         }
+        // Visit this walker's successors in the order advance_into() would.
+        std::reverse(stack.begin() + pending, stack.end());
+        consumed.clear();
     }
+    return false;
+}
 
-    return result;
+double StateMachine::default_walker_priority(const nb::ref<Walker> &walker)
+{
+    size_t depth = 0;
+    for (const Walker *current = walker->transition_walker_.get(); current; current = current->transition_walker_.get())
+    {
+        ++depth;
+    }
+    size_t pending_input = walker->remaining_input_ ? walker->remaining_input_->size() : 0;
+    double priority = walker->has_reached_accept_state() ? 1e12 : 0.0;
+    return priority - static_cast<double>(depth) * 1e6 - static_cast<double>(pending_input);
 }
 
 std::vector<std::pair<std::string, nb::ref<Walker>>> StateMachine::advance_all(
@@ -255,8 +658,782 @@ std::vector<std::pair<std::string, nb::ref<Walker>>> StateMachine::advance_all(
     return results;
 }
 
+namespace
+{
+    // Appends every continuation the walker could take next; returns false if
+    // the walker's next input is not constrained to a known set of strings.
+    bool append_continuations(nb::ref<Walker> &walker, std::vector<std::string> &out)
+    {
+        if (walker->has_reached_accept_state() || walker->accepts_any_token())
+        {
+            return false;
+        }
+
+        auto continuations = walker->get_valid_continuations();
+        if (!continuations.empty())
+        {
+            out.insert(out.end(), continuations.begin(), continuations.end());
+            return true;
+        }
+
+        // Between two transitions: look at the edges it would take next.
+        if (walker->transition_walker_ && walker->transition_walker_->can_accept_more_input())
+        {
+            return false;
+        }
+        auto branches = walker->branch();
+        if (branches.empty())
+        {
+            return false;
+        }
+        for (const auto &branch : branches)
+        {
+            if (branch->accepts_any_token())
+            {
+                return false;
+            }
+            auto branch_continuations = branch->get_valid_continuations();
+            if (branch_continuations.empty())
+            {
+                return false;
+            }
+            out.insert(out.end(), branch_continuations.begin(), branch_continuations.end());
+        }
+        return true;
+    }
+
+    // Walkers that consume the whole token, i.e. the two-argument advance_all.
+    std::vector<nb::ref<Walker>> consume_fully(
+        std::vector<nb::ref<Walker>> &walkers,
+        const std::string &token)
+    {
+        std::vector<nb::ref<Walker>> result;
+        for (auto &walker : walkers)
+        {
+            for (auto &advanced_walker : walker->consume_token(token))
+            {
+                if (!advanced_walker->remaining_input_)
+                {
+                    result.push_back(std::move(advanced_walker));
+                }
+            }
+        }
+        return result;
+    }
+
+    /**
+     * @brief Drop walkers equal to an earlier one, keeping the first of each
+     * @param walkers The walkers, compacted in place
+     *
+     * Walkers are bucketed by signature() first, so operator== only runs
+     * between walkers at the same grammar position.
+     */
+    void collapse_equal_walkers(std::vector<nb::ref<Walker>> &walkers)
+    {
+        if (walkers.size() < 2)
+        {
+            return;
+        }
+        std::unordered_map<uint64_t, std::vector<size_t>> buckets;
+        size_t kept = 0;
+        for (size_t i = 0; i < walkers.size(); ++i)
+        {
+            const Walker &walker = *walkers[i];
+            auto &bucket = buckets[walker.signature()];
+            bool duplicate = std::any_of(bucket.begin(), bucket.end(), [&](size_t j)
+                                         {
+                                             const Walker &other = *walkers[j];
+                                             return typeid(other) == typeid(walker) && other == walker; });
+            if (duplicate)
+            {
+                continue;
+            }
+            bucket.push_back(kept);
+            if (kept != i)
+            {
+                walkers[kept] = std::move(walkers[i]);
+            }
+            ++kept;
+        }
+        walkers.resize(kept);
+    }
+
+    /**
+     * @brief Feed tokens through the walkers one after another
+     * @param walkers The starting walkers
+     * @param count Number of tokens
+     * @param token_at Returns the token at an index
+     * @param steps If set, receives the collapsed walkers after each consumed token
+     * @return The final walkers, empty if some token was rejected
+     *
+     * A token that ends inside a UTF-8 character, e.g. a byte-fallback token,
+     * is held back until the following tokens complete the character, so the
+     * walkers only ever see whole characters. The last token is consumed as is.
+     */
+    template <typename TokenAt>
+    std::vector<nb::ref<Walker>> consume_sequence(
+        const std::vector<nb::ref<Walker>> &walkers,
+        size_t count,
+        const TokenAt &token_at,
+        std::vector<std::vector<nb::ref<Walker>>> *steps)
+    {
+        std::vector<nb::ref<Walker>> current = walkers;
+        std::string pending;
+        for (size_t i = 0; i < count; ++i)
+        {
+            pending += token_at(i);
+            size_t complete = utf8_complete_length(pending);
+            if (i + 1 == count && complete < pending.size())
+            {
+                // No walker can consume half a character, and Python subclasses
+                // could not even receive it as a str, so reject it here.
+                return {};
+            }
+            if (complete > 0)
+            {
+                auto advanced = consume_fully(current, pending.substr(0, complete));
+                if (advanced.empty())
+                {
+                    return {};
+                }
+                collapse_equal_walkers(advanced);
+                current = std::move(advanced);
+                pending.erase(0, complete);
+            }
+            if (steps)
+            {
+                steps->push_back(current);
+            }
+        }
+        return current;
+    }
+}
+
+std::vector<nb::ref<Walker>> StateMachine::consume_tokens(
+    const std::vector<nb::ref<Walker>> &walkers,
+    const std::vector<std::string> &tokens,
+    std::vector<std::vector<nb::ref<Walker>>> *steps)
+{
+    return consume_sequence(walkers, tokens.size(), [&](size_t i) -> const std::string &
+                            { return tokens[i]; }, steps);
+}
+
+std::vector<nb::ref<Walker>> StateMachine::consume_tokens(
+    const std::vector<nb::ref<Walker>> &walkers,
+    const std::vector<uint32_t> &token_ids,
+    const std::vector<std::string> &vocabulary,
+    std::vector<std::vector<nb::ref<Walker>>> *steps)
+{
+    for (uint32_t id : token_ids)
+    {
+        if (id >= vocabulary.size())
+        {
+            throw std::out_of_range("Token id " + std::to_string(id) + " is outside the vocabulary");
+        }
+    }
+    return consume_sequence(walkers, token_ids.size(), [&](size_t i) -> const std::string &
+                            { return vocabulary[token_ids[i]]; }, steps);
+}
+
+std::vector<nb::ref<Walker>> StateMachine::consume_text(
+    const std::vector<nb::ref<Walker>> &walkers,
+    const std::string &text,
+    size_t chunk_bytes)
+{
+    if (chunk_bytes == 0)
+    {
+        throw std::invalid_argument("chunk_bytes must be positive");
+    }
+
+    // Chunks end on code point boundaries, so subclasses implemented in Python always see valid UTF-8.
+    std::vector<std::string> chunks;
+    for (size_t begin = 0, end; begin < text.size(); begin = end)
+    {
+        end = utf8_chunk_end(text, begin, chunk_bytes);
+        chunks.push_back(text.substr(begin, end - begin));
+    }
+    return consume_tokens(walkers, chunks);
+}
+
+bool StateMachine::can_consume(std::vector<nb::ref<Walker>> &walkers, const std::string &token)
+{
+    return std::any_of(walkers.begin(), walkers.end(), [&](nb::ref<Walker> &walker)
+                       { return walker->can_consume(token); });
+}
+
+bool StateMachine::can_end(const std::vector<nb::ref<Walker>> &walkers)
+{
+    return std::any_of(walkers.begin(), walkers.end(), [](const nb::ref<Walker> &walker)
+                       { return walker->can_end(); });
+}
+
+std::pair<std::string, std::vector<nb::ref<Walker>>> StateMachine::jump_forward(
+    std::vector<nb::ref<Walker>> &walkers,
+    size_t max_length)
+{
+    std::string forced;
+    std::vector<nb::ref<Walker>> current = walkers;
+    std::vector<std::string> continuations;
+
+    while (!current.empty() && forced.size() < max_length)
+    {
+        continuations.clear();
+        bool constrained = std::all_of(current.begin(), current.end(), [&](nb::ref<Walker> &walker)
+                                       { return append_continuations(walker, continuations); });
+        if (!constrained || continuations.empty())
+        {
+            break;
+        }
+
+        std::string prefix = continuations.front();
+        for (const auto &continuation : continuations)
+        {
+            auto mismatch = std::mismatch(prefix.begin(), prefix.end(), continuation.begin(), continuation.end());
+            prefix.erase(mismatch.first, prefix.end());
+        }
+
+        size_t length = std::min(prefix.size(), max_length - forced.size());
+        // Never split a UTF-8 code point.
+        while (length > 0 && length < prefix.size() &&
+               (static_cast<unsigned char>(prefix[length]) & 0xC0) == 0x80)
+        {
+            --length;
+        }
+        if (length == 0)
+        {
+            break;
+        }
+        prefix.resize(length);
+
+        auto advanced = consume_fully(current, prefix);
+        if (advanced.empty())
+        {
+            break;
+        }
+        forced += prefix;
+        current = std::move(advanced);
+    }
+
+    return {forced, current};
+}
+
+std::pair<size_t, std::vector<std::vector<nb::ref<Walker>>>> StateMachine::verify_draft(
+    std::vector<nb::ref<Walker>> &walkers,
+    const std::vector<std::string> &tokens)
+{
+    std::vector<std::vector<nb::ref<Walker>>> steps;
+    steps.reserve(tokens.size());
+
+    std::vector<nb::ref<Walker>> *current = &walkers;
+    for (const auto &token : tokens)
+    {
+        auto advanced = consume_fully(*current, token);
+        if (advanced.empty())
+        {
+            break;
+        }
+        steps.push_back(std::move(advanced));
+        current = &steps.back();
+    }
+
+    return {steps.size(), std::move(steps)};
+}
+
+std::vector<StateMachine *> StateMachine::collect_state_machines() const
+{
+    std::vector<StateMachine *> machines;
+    std::unordered_set<const StateMachine *> seen;
+
+    machines.push_back(const_cast<StateMachine *>(this));
+    seen.insert(this);
+
+    // The graph is stored in an unordered_map, so visit states in sorted order
+    // to get the same numbering in every process.
+    for (size_t i = 0; i < machines.size(); ++i)
+    {
+        const auto &state_graph = machines[i]->state_graph_;
+        std::vector<State> states;
+        states.reserve(state_graph.size());
+        for (const auto &[state, edges] : state_graph)
+        {
+            states.push_back(state);
+        }
+        std::sort(states.begin(), states.end());
+
+        for (const auto &state : states)
+        {
+            for (const auto &[edge, target_state] : state_graph.at(state))
+            {
+                if (seen.insert(edge.get()).second)
+                {
+                    machines.push_back(const_cast<StateMachine *>(edge.get()));
+                }
+            }
+        }
+    }
+
+    return machines;
+}
+
+namespace
+{
+    uint64_t fingerprint_of(
+        const StateMachine *machine,
+        std::unordered_map<const StateMachine *, uint64_t> &finished,
+        std::vector<const StateMachine *> &stack)
+    {
+        if (auto it = finished.find(machine); it != finished.end())
+        {
+            return it->second;
+        }
+        // Recursive grammars refer back to a machine that is still being
+        // hashed; encode the reference by its distance up the stack.
+        if (auto it = std::find(stack.begin(), stack.end(), machine); it != stack.end())
+        {
+            return hash_combine(0x5eed, static_cast<uint64_t>(stack.end() - it));
+        }
+        stack.push_back(machine);
+
+        uint64_t hash = 0;
+        if (machine->is_native())
+        {
+            hash = hash_combine(hash, hash_bytes("StateMachine"));
+        }
+        else
+        {
+            nb::gil_scoped_acquire guard;
+            hash = hash_combine(hash, hash_bytes(machine->get_name()));
+            hash = hash_combine(hash, hash_bytes(machine->fingerprint_key()));
+        }
+        hash = hash_combine(hash, (machine->is_optional_ ? 1 : 0) | (machine->is_case_sensitive_ ? 2 : 0));
+        if (machine->max_walkers_ > 0)
+        {
+            hash = hash_combine(hash, machine->max_walkers_);
+        }
+        // Custom priorities cannot be compared, so such machines only match themselves.
+        if (machine->walker_priority_)
+        {
+            hash = hash_combine(hash, machine->instance_id_);
+        }
+        hash = hash_combine(hash, hash_state(machine->start_state_));
+
+        std::vector<uint64_t> end_state_hashes;
+        for (const auto &end_state : machine->end_states_)
+        {
+            end_state_hashes.push_back(hash_state(end_state));
+        }
+        std::sort(end_state_hashes.begin(), end_state_hashes.end());
+        for (uint64_t end_state_hash : end_state_hashes)
+        {
+            hash = hash_combine(hash, end_state_hash);
+        }
+
+        std::vector<State> states;
+        states.reserve(machine->state_graph_.size());
+        for (const auto &[state, edges] : machine->state_graph_)
+        {
+            states.push_back(state);
+        }
+        std::sort(states.begin(), states.end());
+
+        for (const auto &state : states)
+        {
+            hash = hash_combine(hash, hash_state(state));
+            for (const auto &[edge, target_state] : machine->state_graph_.at(state))
+            {
+                hash = hash_combine(hash, fingerprint_of(edge.get(), finished, stack));
+                hash = hash_combine(hash, hash_state(target_state));
+            }
+        }
+
+        stack.pop_back();
+        finished.emplace(machine, hash);
+        return hash;
+    }
+}
+
+uint64_t StateMachine::fingerprint() const
+{
+    bool frozen = is_frozen();
+    if (frozen)
+    {
+        uint64_t cached = frozen_fingerprint_.load(std::memory_order_acquire);
+        if (cached != 0)
+        {
+            return cached;
+        }
+    }
+
+    std::unordered_map<const StateMachine *, uint64_t> finished;
+    std::vector<const StateMachine *> stack;
+    uint64_t hash = fingerprint_of(this, finished, stack);
+    if (frozen)
+    {
+        // Racing threads compute the same value, so the last store wins harmlessly.
+        frozen_fingerprint_.store(hash, std::memory_order_release);
+    }
+    return hash;
+}
+
+void StateMachine::retain_native()
+{
+    // Fast path: another owner already anchors the machine.
+    size_t count = native_refs_.load(std::memory_order_relaxed);
+    while (count != 0)
+    {
+        if (native_refs_.compare_exchange_weak(count, count + 1, std::memory_order_relaxed))
+        {
+            return;
+        }
+    }
+    // The first owner installs the anchor. Taking the reference may need the GIL,
+    // so it happens before the lock and is only handed over inside it.
+    nb::ref<StateMachine> anchor(this);
+    {
+        std::lock_guard<std::mutex> lock(native_mutex_);
+        if (native_refs_.fetch_add(1, std::memory_order_relaxed) == 0)
+        {
+            self_ref_ = std::move(anchor);
+        }
+    }
+}
+
+void StateMachine::release_native()
+{
+    size_t count = native_refs_.load(std::memory_order_relaxed);
+    while (count > 1)
+    {
+        if (native_refs_.compare_exchange_weak(count, count - 1, std::memory_order_release, std::memory_order_relaxed))
+        {
+            return;
+        }
+    }
+    // The last owner drops the anchor outside the lock, since that may delete this machine.
+    nb::ref<StateMachine> anchor;
+    {
+        std::lock_guard<std::mutex> lock(native_mutex_);
+        if (native_refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            anchor = std::move(self_ref_);
+        }
+    }
+}
+
+void StateMachine::freeze()
+{
+    for (StateMachine *machine : collect_state_machines())
+    {
+        machine->frozen_.store(true, std::memory_order_release);
+    }
+}
+
+void StateMachine::check_mutable() const
+{
+    if (is_frozen())
+    {
+        throw std::runtime_error("StateMachine is frozen");
+    }
+}
+
+void StateMachine::compute_lookahead(const StateMachine &root, std::unordered_map<const StateMachine *, Lookahead> &out)
+{
+    std::vector<StateMachine *> machines = root.collect_state_machines();
+    std::vector<StateMachine *> native;
+    for (StateMachine *machine : machines)
+    {
+        Lookahead &lookahead = out[machine];
+        const auto &end_states = machine->end_states_;
+        bool start_is_end = std::find(end_states.begin(), end_states.end(), machine->start_state_) != end_states.end();
+        if (machine->derives_lookahead())
+        {
+            native.push_back(machine);
+            lookahead.machine.nullable = machine->is_optional_ || start_is_end;
+            continue;
+        }
+
+        // Leaves and custom traversals consume input the graph does not show;
+        // trust their hint or assume anything.
+        std::optional<std::string> hint;
+        {
+            nb::gil_scoped_acquire guard;
+            hint = machine->first_bytes();
+        }
+        if (hint)
+        {
+            for (unsigned char byte : *hint)
+            {
+                lookahead.machine.first.set(byte);
+            }
+        }
+        else
+        {
+            lookahead.machine.first.set();
+        }
+        lookahead.machine.nullable = machine->is_optional_ || start_is_end;
+    }
+
+    // Recursive grammars refer to each other, so grow every set until nothing changes.
+    // Subclasses with the default traversal are walked by their graph like plain machines.
+    // Skipped edges are followed whenever the edge machine is nullable, which can only
+    // overestimate the bytes the engine would try.
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (StateMachine *machine : native)
+        {
+            Lookahead &lookahead = out[machine];
+            const auto &end_states = machine->end_states_;
+            auto entry_of = [&](const State &state)
+            {
+                Lookahead::Entry entry;
+                if (auto it = lookahead.states.find(state); it != lookahead.states.end())
+                {
+                    entry = it->second;
+                }
+                entry.nullable = entry.nullable || std::find(end_states.begin(), end_states.end(), state) != end_states.end();
+                return entry;
+            };
+
+            for (const auto &[state, edges] : machine->state_graph_)
+            {
+                Lookahead::Entry next = entry_of(state);
+                for (const auto &[edge, target_state] : edges)
+                {
+                    const Lookahead::Entry &sub = out[edge.get()].machine;
+                    next.first |= sub.first;
+                    if (sub.nullable)
+                    {
+                        Lookahead::Entry target = entry_of(target_state);
+                        next.first |= target.first;
+                        next.nullable = next.nullable || target.nullable;
+                    }
+                }
+
+                Lookahead::Entry &current = lookahead.states[state];
+                if (next.first != current.first || next.nullable != current.nullable)
+                {
+                    current = next;
+                    changed = true;
+                }
+            }
+
+            Lookahead::Entry start = entry_of(machine->start_state_);
+            start.nullable = start.nullable || machine->is_optional_;
+            if (start.first != lookahead.machine.first || start.nullable != lookahead.machine.nullable)
+            {
+                lookahead.machine = start;
+                changed = true;
+            }
+        }
+    }
+}
+
+const StateMachine::Lookahead *StateMachine::lookahead() const
+{
+    const Lookahead *published = lookahead_.load(std::memory_order_acquire);
+    if (published || !is_frozen())
+    {
+        return published;
+    }
+
+    std::unordered_map<const StateMachine *, Lookahead> computed;
+    compute_lookahead(*this, computed);
+
+    // Every machine reachable from a frozen one is frozen too, so publish them all.
+    // Racing threads compute the same sets; the first to publish wins.
+    for (auto &[machine, lookahead] : computed)
+    {
+        auto *candidate = new Lookahead(std::move(lookahead));
+        const Lookahead *expected = nullptr;
+        if (!machine->lookahead_.compare_exchange_strong(expected, candidate, std::memory_order_acq_rel))
+        {
+            delete candidate;
+        }
+    }
+    return lookahead_.load(std::memory_order_acquire);
+}
+
+bool StateMachine::derives_lookahead() const
+{
+    return is_native() || (!state_graph_.empty() && !overrides_traversal());
+}
+
+std::optional<std::string> StateMachine::first_bytes() const
+{
+    if (!derives_lookahead())
+    {
+        return std::nullopt;
+    }
+
+    ByteSet first;
+    if (const Lookahead *lookahead = this->lookahead())
+    {
+        first = lookahead->machine.first;
+    }
+    else
+    {
+        std::unordered_map<const StateMachine *, Lookahead> computed;
+        compute_lookahead(*this, computed);
+        first = computed[this].machine.first;
+    }
+
+    std::string bytes;
+    for (size_t byte = 0; byte < first.size(); ++byte)
+    {
+        if (first.test(byte))
+        {
+            bytes.push_back(static_cast<char>(byte));
+        }
+    }
+    return bytes;
+}
+
+bool StateMachine::may_start_with(uint8_t byte) const
+{
+    const Lookahead *lookahead = this->lookahead();
+    return !lookahead || lookahead->machine.first.test(byte);
+}
+
+bool StateMachine::is_nullable() const
+{
+    const Lookahead *lookahead = this->lookahead();
+    return !lookahead || lookahead->machine.nullable;
+}
+
+namespace
+{
+    // Appends an unambiguous encoding of a plain-data attribute value; false
+    // for anything else, whose equality the engine cannot judge.
+    bool encode_plain_value(nb::handle value, std::string &out)
+    {
+        auto append_sized = [&](char tag, std::string_view text)
+        {
+            out += tag;
+            out += std::to_string(text.size());
+            out += ':';
+            out.append(text);
+        };
+
+        if (value.is_none())
+        {
+            out += 'n';
+        }
+        else if (nb::isinstance<nb::bool_>(value))
+        {
+            out += nb::cast<bool>(value) ? "b1" : "b0";
+        }
+        else if (nb::isinstance<nb::int_>(value) || nb::isinstance<nb::float_>(value))
+        {
+            append_sized(nb::isinstance<nb::int_>(value) ? 'i' : 'f', nb::repr(value).c_str());
+        }
+        else if (nb::isinstance<nb::str>(value))
+        {
+            append_sized('s', nb::cast<std::string_view>(value));
+        }
+        else if (nb::isinstance<nb::bytes>(value))
+        {
+            nb::bytes bytes = nb::borrow<nb::bytes>(value);
+            append_sized('y', std::string_view(bytes.c_str(), bytes.size()));
+        }
+        else if (nb::isinstance<nb::list>(value) || nb::isinstance<nb::tuple>(value))
+        {
+            out += nb::isinstance<nb::list>(value) ? 'l' : 't';
+            out += std::to_string(nb::len(value));
+            out += ':';
+            for (nb::handle item : value)
+            {
+                if (!encode_plain_value(item, out))
+                {
+                    return false;
+                }
+            }
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    // Encodes the instance attributes of a Python subclass, or returns nullopt
+    // when some of its state cannot be compared by value.
+    std::optional<std::string> plain_attributes_key(nb::handle self)
+    {
+        // Slot attributes live outside __dict__ and would be missed.
+        nb::handle cls = self.type();
+        if (nb::hasattr(cls, "__slots__"))
+        {
+            return std::nullopt;
+        }
+
+        std::string key = nb::cast<std::string>(nb::getattr(cls, "__module__"));
+        key += '.';
+        key += nb::cast<std::string>(nb::getattr(cls, "__qualname__"));
+
+        nb::object attributes = nb::getattr(self, "__dict__", nb::none());
+        if (attributes.is_none())
+        {
+            return key;
+        }
+        std::vector<std::pair<std::string, nb::handle>> items;
+        for (auto [name, value] : nb::borrow<nb::dict>(attributes))
+        {
+            items.emplace_back(nb::cast<std::string>(name), value);
+        }
+        std::sort(items.begin(), items.end(), [](const auto &a, const auto &b)
+                  { return a.first < b.first; });
+        for (const auto &[name, value] : items)
+        {
+            key += '|';
+            key += name;
+            key += '=';
+            if (!encode_plain_value(value, key))
+            {
+                return std::nullopt;
+            }
+        }
+        return key;
+    }
+}
+
+bool StateMachine::overrides_traversal() const
+{
+    return !is_native();
+}
+
+bool StateMachine::overrides_graph() const
+{
+    return !is_native();
+}
+
+std::string StateMachine::fingerprint_key() const
+{
+    if (is_native())
+    {
+        return "";
+    }
+    if (!overrides_graph())
+    {
+        nb::gil_scoped_acquire guard;
+        nb::handle self = nb::find(this);
+        if (self.is_valid())
+        {
+            if (auto key = plain_attributes_key(self))
+            {
+                return *key;
+            }
+        }
+    }
+    return "#" + std::to_string(instance_id_);
+}
+
 bool StateMachine::operator==(const StateMachine &other) const
 {
+    if (this == &other)
+    {
+        return true;
+    }
     return state_graph_ == other.state_graph_;
 }
 
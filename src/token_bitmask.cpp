@@ -0,0 +1,84 @@
+#include "token_bitmask.h"
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+TokenBitmask::TokenBitmask(size_t size, bool value)
+    : size_(size),
+      words_((size + 31) / 32, value ? ~0u : 0u)
+{
+  trim();
+}
+
+void TokenBitmask::set_all()
+{
+  std::fill(words_.begin(), words_.end(), ~0u);
+  trim();
+}
+
+TokenBitmask &TokenBitmask::operator|=(const TokenBitmask &other)
+{
+  if (other.size_ != size_)
+  {
+    throw std::invalid_argument("Token bitmasks have different sizes");
+  }
+  for (size_t i = 0; i < words_.size(); ++i)
+  {
+    words_[i] |= other.words_[i];
+  }
+  return *this;
+}
+
+TokenBitmask &TokenBitmask::operator&=(const TokenBitmask &other)
+{
+  if (other.size_ != size_)
+  {
+    throw std::invalid_argument("Token bitmasks have different sizes");
+  }
+  for (size_t i = 0; i < words_.size(); ++i)
+  {
+    words_[i] &= other.words_[i];
+  }
+  return *this;
+}
+
+size_t TokenBitmask::count() const
+{
+  size_t total = 0;
+  for (uint32_t word : words_)
+  {
+    total += std::popcount(word);
+  }
+  return total;
+}
+
+bool TokenBitmask::any() const
+{
+  return std::any_of(words_.begin(), words_.end(), [](uint32_t word)
+                     { return word != 0; });
+}
+
+std::vector<uint32_t> TokenBitmask::allowed_ids() const
+{
+  std::vector<uint32_t> ids;
+  ids.reserve(count());
+  for (size_t i = 0; i < words_.size(); ++i)
+  {
+    uint32_t word = words_[i];
+    while (word)
+    {
+      ids.push_back(static_cast<uint32_t>(i * 32 + std::countr_zero(word)));
+      word &= word - 1;
+    }
+  }
+  return ids;
+}
+
+void TokenBitmask::trim()
+{
+  if (size_ % 32 != 0 && !words_.empty())
+  {
+    words_.back() &= (1u << (size_ % 32)) - 1;
+  }
+}
@@ -0,0 +1,206 @@
+#include "token_classifier.h"
+#include "utf8.h"
+
+#include <algorithm>
+#include <typeinfo>
+
+namespace nb = nanobind;
+
+namespace
+{
+  /**
+   * @brief Follow the chain of active transitions down to the innermost walker
+   * @param walker The outermost walker
+   * @return The innermost walker, or walker itself if it is between transitions
+   */
+  nb::ref<Walker> innermost(nb::ref<Walker> &walker)
+  {
+    nb::ref<Walker> current = walker;
+    while (current->transition_walker_)
+    {
+      current = current->transition_walker_;
+    }
+    return current;
+  }
+
+  /**
+   * @brief Whether a walker belongs to a leaf machine, i.e. consumes input itself
+   * @param walker The walker to check
+   * @return True for subclass walkers of machines without a state graph
+   */
+  bool is_leaf(const Walker &walker)
+  {
+    return typeid(walker) != typeid(Walker) && walker.state_machine_->state_graph_.empty();
+  }
+
+  /**
+   * @brief Whether every token the leaf consumes completely is accepted by walker
+   * @param walker The outermost walker
+   * @param leaf Its innermost walker
+   * @return True if nothing between them can veto the leaf's result
+   *
+   * Holds when every ancestor is a plain walker of a machine with the default
+   * traversal and the leaf keeps the default should_complete_transition().
+   */
+  bool trusts_leaf(const Walker &walker, const Walker &leaf)
+  {
+    for (const Walker *current = &walker; current != &leaf; current = current->transition_walker_.get())
+    {
+      if (current->kind_ != WalkerKind::Native || current->state_machine_->overrides_traversal())
+      {
+        return false;
+      }
+    }
+    return !leaf.overrides_completion();
+  }
+}
+
+TokenClassifier::TokenClassifier(std::vector<std::string> vocabulary, size_t max_states)
+    : vocabulary_(std::move(vocabulary)),
+      candidates_(vocabulary_.size()),
+      max_states_(max_states)
+{
+  for (size_t id = 0; id < vocabulary_.size(); ++id)
+  {
+    if (!vocabulary_[id].empty() && utf8_is_valid(vocabulary_[id]))
+    {
+      candidates_.set(id);
+    }
+  }
+}
+
+size_t TokenClassifier::precompute(const nb::ref<StateMachine> &root)
+{
+  size_t count = 0;
+  for (StateMachine *machine : root->collect_state_machines())
+  {
+    if (!machine->state_graph_.empty())
+    {
+      continue;
+    }
+    for (const auto &walker : machine->get_walkers())
+    {
+      if (is_leaf(*walker))
+      {
+        classify(walker);
+        ++count;
+      }
+    }
+  }
+  return count;
+}
+
+std::shared_ptr<const TokenClassification> TokenClassifier::classify(nb::ref<Walker> leaf)
+{
+  // Leaves may call into Python, so classification runs without the lock.
+  uint64_t key = leaf->signature();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (auto it = states_.find(key); it != states_.end())
+    {
+      return it->second;
+    }
+  }
+
+  auto classification = std::make_shared<const TokenClassification>(classify_uncached(leaf));
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (states_.size() < max_states_ && states_.emplace(key, classification).second)
+  {
+    memory_usage_ += classification->memory_usage();
+  }
+  return classification;
+}
+
+TokenClassification TokenClassifier::classify_uncached(nb::ref<Walker> leaf) const
+{
+  TokenClassification classification{TokenBitmask(vocabulary_.size()), {}};
+  // Once the leaf can end, any token may continue in the enclosing machine.
+  bool can_end = leaf->has_reached_accept_state();
+
+  for (size_t id = 0; id < vocabulary_.size(); ++id)
+  {
+    if (!candidates_.test(id))
+    {
+      continue;
+    }
+    const std::string &token = vocabulary_[id];
+    auto advanced_walkers = leaf->consume_token(token);
+    bool consumed = std::any_of(advanced_walkers.begin(), advanced_walkers.end(), [](const nb::ref<Walker> &advanced)
+                                { return !advanced->remaining_input_; });
+    if (consumed)
+    {
+      classification.accepted.set(id);
+    }
+    else if (can_end || !advanced_walkers.empty())
+    {
+      classification.dependent.push_back(static_cast<uint32_t>(id));
+    }
+  }
+  classification.dependent.shrink_to_fit();
+  return classification;
+}
+
+TokenBitmask TokenClassifier::compute_mask(std::vector<nb::ref<Walker>> &walkers)
+{
+  TokenBitmask mask(vocabulary_.size());
+  for (auto &walker : walkers)
+  {
+    nb::ref<Walker> leaf = innermost(walker);
+    if (!is_leaf(*leaf))
+    {
+      // Between transitions there is no leaf to classify against.
+      for (size_t id = 0; id < vocabulary_.size(); ++id)
+      {
+        if (candidates_.test(id) && !mask.test(id) && walker->can_consume(vocabulary_[id]))
+        {
+          mask.set(id);
+        }
+      }
+      continue;
+    }
+
+    auto classification = classify(leaf);
+    if (trusts_leaf(*walker, *leaf))
+    {
+      mask |= classification->accepted;
+    }
+    else
+    {
+      // An ancestor or the leaf itself may still reject what the leaf consumed.
+      for (uint32_t id : classification->accepted.allowed_ids())
+      {
+        if (!mask.test(id) && walker->can_consume(vocabulary_[id]))
+        {
+          mask.set(id);
+        }
+      }
+    }
+    for (uint32_t id : classification->dependent)
+    {
+      if (!mask.test(id) && walker->can_consume(vocabulary_[id]))
+      {
+        mask.set(id);
+      }
+    }
+  }
+  return mask;
+}
+
+size_t TokenClassifier::size() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return states_.size();
+}
+
+size_t TokenClassifier::memory_usage() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return memory_usage_;
+}
+
+void TokenClassifier::clear()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  states_.clear();
+  memory_usage_ = 0;
+}
@@ -0,0 +1,182 @@
+#include "token_mask_cache.h"
+#include "hashing.h"
+
+#include <algorithm>
+
+namespace nb = nanobind;
+
+TokenMaskCache::TokenMaskCache(std::vector<std::string> vocabulary, size_t capacity_bytes)
+    : classifier_(std::move(vocabulary)),
+      capacity_bytes_(capacity_bytes) {}
+
+std::vector<uint64_t> TokenMaskCache::sorted_signatures(const std::vector<nb::ref<Walker>> &walkers)
+{
+  std::vector<uint64_t> signatures;
+  signatures.reserve(walkers.size());
+  for (const auto &walker : walkers)
+  {
+    signatures.push_back(walker->signature());
+  }
+  std::sort(signatures.begin(), signatures.end());
+  signatures.erase(std::unique(signatures.begin(), signatures.end()), signatures.end());
+  return signatures;
+}
+
+uint64_t TokenMaskCache::combine_signatures(const std::vector<uint64_t> &signatures)
+{
+  uint64_t hash = hash_combine(hash_bytes("WalkerSet"), signatures.size());
+  for (uint64_t signature : signatures)
+  {
+    hash = hash_combine(hash, signature);
+  }
+  return hash;
+}
+
+uint64_t TokenMaskCache::signature(const std::vector<nb::ref<Walker>> &walkers)
+{
+  return combine_signatures(sorted_signatures(walkers));
+}
+
+TokenBitmask TokenMaskCache::compute(std::vector<nb::ref<Walker>> &walkers)
+{
+  return classifier_.compute_mask(walkers);
+}
+
+std::shared_ptr<const TokenBitmask> TokenMaskCache::get_or_compute(std::vector<nb::ref<Walker>> &walkers)
+{
+  // Walkers may call into Python, so signatures and masks are computed
+  // without holding the lock. Concurrent misses on one key compute twice.
+  std::vector<uint64_t> signatures = sorted_signatures(walkers);
+  uint64_t key = combine_signatures(signatures);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    // A colliding key with other walker signatures counts as a miss and is replaced.
+    if (it != index_.end() && (it->second->signatures.empty() || it->second->signatures == signatures))
+    {
+      ++hits_;
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return it->second->mask;
+    }
+    ++misses_;
+  }
+
+  auto mask = std::make_shared<const TokenBitmask>(compute(walkers));
+  std::lock_guard<std::mutex> lock(mutex_);
+  insert_locked(key, mask, std::move(signatures));
+  return mask;
+}
+
+std::shared_ptr<const TokenBitmask> TokenMaskCache::get(uint64_t key)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it == index_.end())
+  {
+    ++misses_;
+    return nullptr;
+  }
+  ++hits_;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->mask;
+}
+
+void TokenMaskCache::put(uint64_t key, TokenBitmask mask)
+{
+  auto shared = std::make_shared<const TokenBitmask>(std::move(mask));
+  std::lock_guard<std::mutex> lock(mutex_);
+  insert_locked(key, std::move(shared));
+}
+
+bool TokenMaskCache::contains(uint64_t key) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return index_.count(key) > 0;
+}
+
+void TokenMaskCache::clear()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  index_.clear();
+  memory_usage_ = 0;
+}
+
+size_t TokenMaskCache::size() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+size_t TokenMaskCache::memory_usage() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return memory_usage_;
+}
+
+size_t TokenMaskCache::capacity_bytes() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return capacity_bytes_;
+}
+
+void TokenMaskCache::set_capacity_bytes(size_t capacity_bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  capacity_bytes_ = capacity_bytes;
+  evict_locked();
+}
+
+size_t TokenMaskCache::hits() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+size_t TokenMaskCache::misses() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+size_t TokenMaskCache::evictions() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return evictions_;
+}
+
+double TokenMaskCache::hit_rate() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t lookups = hits_ + misses_;
+  return lookups == 0 ? 0.0 : static_cast<double>(hits_) / static_cast<double>(lookups);
+}
+
+void TokenMaskCache::insert_locked(uint64_t key, std::shared_ptr<const TokenBitmask> mask, std::vector<uint64_t> signatures)
+{
+  auto it = index_.find(key);
+  if (it != index_.end())
+  {
+    memory_usage_ -= it->second->bytes;
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+  size_t bytes = mask->memory_usage() + signatures.capacity() * sizeof(uint64_t) + sizeof(Entry) + 4 * sizeof(void *);
+  entries_.push_front({key, std::move(mask), std::move(signatures), bytes});
+  index_.emplace(key, entries_.begin());
+  memory_usage_ += bytes;
+  evict_locked();
+}
+
+void TokenMaskCache::evict_locked()
+{
+  // The most recently inserted entry is kept even if it alone exceeds the budget.
+  while (memory_usage_ > capacity_bytes_ && entries_.size() > 1)
+  {
+    auto last = std::prev(entries_.end());
+    memory_usage_ -= last->bytes;
+    index_.erase(last->key);
+    entries_.erase(last);
+    ++evictions_;
+  }
+}
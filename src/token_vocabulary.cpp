@@ -0,0 +1,82 @@
+#include "token_vocabulary.h"
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+  // U+2581 LOWER ONE EIGHTH BLOCK, SentencePiece's stand-in for a space
+  constexpr std::string_view SPACE_MARKER = "\xE2\x96\x81";
+
+  int hex_value(char c)
+  {
+    if (c >= '0' && c <= '9')
+    {
+      return c - '0';
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+      return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+      return c - 'a' + 10;
+    }
+    return -1;
+  }
+}
+
+TokenVocabulary::TokenVocabulary(std::vector<std::string> pieces, bool decode)
+    : tokens_(std::move(pieces))
+{
+  for (auto &token : tokens_)
+  {
+    if (decode)
+    {
+      token = decode_token(token);
+    }
+    if (!token.empty())
+    {
+      trie_.insert(token);
+    }
+  }
+}
+
+std::string TokenVocabulary::decode_token(std::string_view piece)
+{
+  // Byte-fallback pieces are exactly "<0xNN>".
+  if (piece.size() == 6 && piece.starts_with("<0x") && piece.back() == '>')
+  {
+    int high = hex_value(piece[3]);
+    int low = hex_value(piece[4]);
+    if (high >= 0 && low >= 0)
+    {
+      return std::string(1, static_cast<char>(high * 16 + low));
+    }
+  }
+
+  std::string decoded;
+  decoded.reserve(piece.size());
+  size_t begin = 0;
+  for (size_t marker = piece.find(SPACE_MARKER); marker != std::string_view::npos; marker = piece.find(SPACE_MARKER, begin))
+  {
+    decoded.append(piece.substr(begin, marker - begin));
+    decoded.push_back(' ');
+    begin = marker + SPACE_MARKER.size();
+  }
+  decoded.append(piece.substr(begin));
+  return decoded;
+}
+
+const std::string &TokenVocabulary::token(size_t id) const
+{
+  if (id >= tokens_.size())
+  {
+    throw std::out_of_range("Token id " + std::to_string(id) + " is outside the vocabulary");
+  }
+  return tokens_[id];
+}
+
+bool TokenVocabulary::contains(std::string_view token) const
+{
+  return trie_.find_ks(token.data(), token.size()) != trie_.end();
+}
@@ -1,8 +1,11 @@
 #include "walker.h"
 #include "state_machine.h"
+#include "hashing.h"
+#include "walker_dispatch.h"
 
 #include <algorithm>
 #include <cmath>
+#include <iterator>
 #include <numeric>
 #include <sstream>
 #include <typeinfo>
@@ -13,11 +16,15 @@
 
 namespace nb = nanobind;
 
+// Size budget for 64-bit targets. Thousands of walkers are live per sequence,
+// so growing past this should be a deliberate decision.
+static_assert(sizeof(void *) != 8 || sizeof(Walker) <= 232, "Walker grew past its size budget");
+
 // Constructor
-Walker::Walker(nb::ref<StateMachine> state_machine,
+Walker::Walker(StateMachine::NativeRef state_machine,
                std::optional<State> current_state)
-    : state_machine_(state_machine),
-      current_state_(current_state.value_or(state_machine->start_state_)),
+    : state_machine_(std::move(state_machine)),
+      current_state_(current_state.value_or(state_machine_->start_state_)),
       consumed_character_count_(0),
       _accepts_more_input_(false)
 {
@@ -29,14 +36,22 @@ Walker::Walker(nb::ref<StateMachine> state_machine,
 
 nb::ref<Walker> Walker::clone() const
 {
-  nb::object self_py = nb::find(this);
-  if (!self_py.is_valid())
+  // Walkers created by the engine never get a Python object, so this stays
+  // native: no instance lookup, no GIL, just an atomic refcount.
+  PyObject *self = self_py();
+  if (!self)
   {
-    // fallback behavior if no python identity
-    return nb::ref<Walker>(new Walker(*this));
+    auto copy = new Walker(*this);
+    copy->kind_ = WalkerKind::Native;
+    return nb::ref<Walker>(copy);
   }
-  nb::object cls = nb::getattr(self_py, "__class__");
-  nb::object python_walker = cls(state_machine_);
+
+  // Walkers with a Python object are recreated through their class. Engine
+  // threads such as MaskPipeline workers get here without the GIL.
+  nb::gil_scoped_acquire guard;
+  nb::object self_obj = nb::borrow(self);
+  nb::object cls = nb::getattr(self_obj, "__class__");
+  nb::object python_walker = cls(state_machine_.ref());
 
   // cast to pointer - not by value
   Walker *new_walker = nb::cast<Walker *>(python_walker);
@@ -117,7 +132,7 @@ std::vector<nb::ref<Walker>> Walker::consume_token(const std::string &token)
 
 bool Walker::can_accept_more_input() const
 {
-  if (transition_walker_ && transition_walker_->can_accept_more_input())
+  if (transition_walker_ && walker_dispatch::can_accept_more_input(*transition_walker_))
   {
     return true;
   }
@@ -144,7 +159,7 @@ bool Walker::should_start_transition(const std::string &token)
 {
   if (transition_walker_)
   {
-    return transition_walker_->should_start_transition(token);
+    return walker_dispatch::should_start_transition(*transition_walker_, token);
   }
 
   if (explored_edges_.count(current_edge()) > 0)
@@ -160,11 +175,16 @@ bool Walker::should_complete_transition() const
 {
   if (transition_walker_)
   {
-    return transition_walker_->should_complete_transition();
+    return walker_dispatch::should_complete_transition(*transition_walker_);
   }
   return true;
 }
 
+bool Walker::overrides_completion() const
+{
+  return kind_ != WalkerKind::Native;
+}
+
 bool Walker::accepts_any_token() const
 {
   if (transition_walker_)
@@ -191,23 +211,23 @@ Walker::start_transition(nb::ref<Walker> transition_walker,
                          std::optional<State> start_state,
                          std::optional<State> target_state)
 {
-  if (token && !transition_walker->should_start_transition(*token))
+  if (token && !walker_dispatch::should_start_transition(*transition_walker, *token))
   {
     return std::nullopt;
   }
 
   if (target_state_ == target_state && transition_walker_ &&
-      transition_walker_->can_accept_more_input())
+      walker_dispatch::can_accept_more_input(*transition_walker_))
   {
     return std::nullopt;
   }
 
-  auto clone = this->clone();
+  auto clone = walker_dispatch::clone(*this);
   clone->current_state_ = start_state.value_or(clone->current_state_);
   clone->target_state_ = target_state;
 
   if (clone->transition_walker_ &&
-      clone->transition_walker_->has_reached_accept_state())
+      walker_dispatch::has_reached_accept_state(*clone->transition_walker_))
   {
     clone->accepted_history_.push_back(clone->transition_walker_);
   }
@@ -220,7 +240,7 @@ Walker::start_transition(nb::ref<Walker> transition_walker,
 std::tuple<std::optional<nb::ref<Walker>>, bool>
 Walker::complete_transition(nb::ref<Walker> transition_walker)
 {
-  auto clone = this->clone();
+  auto clone = walker_dispatch::clone(*this);
   clone->transition_walker_ = transition_walker;
 
   clone->remaining_input_ = clone->transition_walker_->remaining_input_;
@@ -230,9 +250,9 @@ Walker::complete_transition(nb::ref<Walker> transition_walker)
       clone->transition_walker_->consumed_character_count_;
   clone->explored_edges_.insert(clone->current_edge());
 
-  if (!clone->should_complete_transition())
+  if (!walker_dispatch::should_complete_transition(*clone))
   {
-    if (clone->can_accept_more_input())
+    if (walker_dispatch::can_accept_more_input(*clone))
     {
       return std::make_tuple(clone, false);
     }
@@ -243,11 +263,11 @@ Walker::complete_transition(nb::ref<Walker> transition_walker)
   }
 
   if (clone->target_state_ &&
-      clone->transition_walker_->has_reached_accept_state())
+      walker_dispatch::has_reached_accept_state(*clone->transition_walker_))
   {
     clone->current_state_ = clone->target_state_.value();
 
-    if (!clone->transition_walker_->can_accept_more_input())
+    if (!walker_dispatch::can_accept_more_input(*clone->transition_walker_))
     {
       clone->accepted_history_.push_back(clone->transition_walker_);
       clone->transition_walker_ = nullptr;
@@ -270,32 +290,69 @@ std::vector<nb::ref<Walker>>
 Walker::branch(const std::optional<std::string> &token)
 {
   std::vector<nb::ref<Walker>> result;
+  branch_into(token, result);
+  return result;
+}
 
+void Walker::branch_into(const std::optional<std::string> &token, std::vector<nb::ref<Walker>> &out)
+{
   if (transition_walker_)
   {
-    std::vector<nb::ref<Walker>> transition_walkers;
-    if (transition_walker_->can_accept_more_input())
+    // Branch the transition in place, then wrap each branch in a clone.
+    size_t first = out.size();
+    if (walker_dispatch::can_accept_more_input(*transition_walker_))
     {
-      transition_walkers = transition_walker_->branch(token);
+      transition_walker_->branch_into(token, out);
     }
 
-    for (auto &new_transition_walker : transition_walkers)
+    for (size_t i = first; i < out.size(); ++i)
     {
-      auto clone = this->clone();
-      clone->transition_walker_ = new_transition_walker;
-      result.push_back(clone);
+      auto clone = walker_dispatch::clone(*this);
+      clone->transition_walker_ = std::move(out[i]);
+      out[i] = std::move(clone);
     }
 
-    if (transition_walkers.empty() &&
-        !transition_walker_->has_reached_accept_state())
+    if (out.size() == first &&
+        !walker_dispatch::has_reached_accept_state(*transition_walker_))
     {
-      return result;
+      return;
     }
   }
 
+  if (state_machine_->is_native())
+  {
+    state_machine_->branch_walker_into(nb::ref<Walker>(this), token, out);
+    return;
+  }
   auto branched_walkers = state_machine_->branch_walker(nb::ref<Walker>(this), token);
-  result.insert(result.end(), branched_walkers.begin(), branched_walkers.end());
-  return result;
+  out.insert(out.end(), branched_walkers.begin(), branched_walkers.end());
+}
+
+void Walker::consume_token_into(const std::string &token, std::vector<nb::ref<Walker>> &out)
+{
+  if (kind_ == WalkerKind::Native && state_machine_->is_native())
+  {
+    state_machine_->advance_into(nb::ref<Walker>(this), token, out);
+    return;
+  }
+  auto advanced_walkers = consume_token(token);
+  out.insert(out.end(), std::make_move_iterator(advanced_walkers.begin()), std::make_move_iterator(advanced_walkers.end()));
+}
+
+bool Walker::can_consume(const std::string &token)
+{
+  if (kind_ == WalkerKind::Native && state_machine_->is_native())
+  {
+    return state_machine_->can_advance(nb::ref<Walker>(this), token);
+  }
+  auto advanced_walkers = consume_token(token);
+  return std::any_of(advanced_walkers.begin(), advanced_walkers.end(), [](const nb::ref<Walker> &advanced)
+                     { return !advanced->remaining_input_; });
+}
+
+bool Walker::can_end() const
+{
+  return walker_dispatch::has_reached_accept_state(*this);
 }
 
 // Find valid prefixes
@@ -324,6 +381,34 @@ Walker::find_valid_prefixes(const tsl::htrie_set<char> &trie)
   return valid_prefixes;
 }
 
+uint64_t Walker::signature() const
+{
+  uint64_t hash = hash_combine(state_machine_->instance_id_, hash_state(current_state_));
+  hash = hash_combine(hash, target_state_ ? hash_state(*target_state_) : 0);
+  hash = hash_combine(hash, (_accepts_more_input_ ? 1 : 0) | (has_reached_accept_state() ? 2 : 0));
+  hash = hash_combine(hash, remaining_input_ ? hash_bytes(*remaining_input_) : 0);
+  hash = hash_combine(hash, transition_walker_ ? transition_walker_->signature() : 0);
+
+  auto raw_value = get_raw_value();
+  if (typeid(*this) != typeid(Walker))
+  {
+    hash = hash_combine(hash, consumed_character_count_);
+    hash = hash_combine(hash, raw_value ? hash_bytes(*raw_value) : 0);
+  }
+
+  // should_start_transition() only refuses edges explored with the current
+  // raw value, and raw values only grow, so older edges can be ignored.
+  for (const auto &[state, target_state, value] : explored_edges_)
+  {
+    if (value == raw_value)
+    {
+      hash = hash_combine(hash, hash_state(state));
+      hash = hash_combine(hash, target_state ? hash_state(*target_state) : 0);
+    }
+  }
+  return hash;
+}
+
 // Helper function to parse value
 nb::object Walker::parse_value(const std::optional<std::string> &value) const
 {
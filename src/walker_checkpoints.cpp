@@ -0,0 +1,68 @@
+#include "walker_checkpoints.h"
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+WalkerCheckpoints::WalkerCheckpoints(size_t window)
+{
+  if (window == 0)
+  {
+    throw std::invalid_argument("WalkerCheckpoints needs a window of at least one step");
+  }
+  slots_.resize(window);
+}
+
+size_t WalkerCheckpoints::push(std::vector<nb::ref<Walker>> walkers)
+{
+  latest_ = size_ == 0 ? 0 : (latest_ + 1) % slots_.size();
+  // Overwriting the oldest slot releases its walkers unless newer checkpoints share them.
+  slots_[latest_] = std::make_shared<const std::vector<nb::ref<Walker>>>(std::move(walkers));
+  if (size_ < slots_.size())
+  {
+    ++size_;
+  }
+  return next_step_++;
+}
+
+WalkerCheckpoints::Snapshot WalkerCheckpoints::peek(size_t steps_back) const
+{
+  if (steps_back >= size_)
+  {
+    throw std::out_of_range("No checkpoint " + std::to_string(steps_back) + " steps back; " +
+                            std::to_string(size_) + " are held");
+  }
+  return slots_[slot_of(steps_back)];
+}
+
+WalkerCheckpoints::Snapshot WalkerCheckpoints::rollback(size_t steps)
+{
+  if (steps >= size_)
+  {
+    throw std::out_of_range("Cannot roll back " + std::to_string(steps) + " steps; " +
+                            std::to_string(size_) + " checkpoints are held");
+  }
+  for (size_t i = 0; i < steps; ++i)
+  {
+    slots_[latest_].reset();
+    latest_ = slot_of(1);
+    --size_;
+  }
+  next_step_ -= steps;
+  return slots_[latest_];
+}
+
+void WalkerCheckpoints::clear()
+{
+  for (auto &slot : slots_)
+  {
+    slot.reset();
+  }
+  latest_ = 0;
+  size_ = 0;
+  next_step_ = 0;
+}
+
+size_t WalkerCheckpoints::slot_of(size_t steps_back) const
+{
+  return (latest_ + slots_.size() - steps_back % slots_.size()) % slots_.size();
+}
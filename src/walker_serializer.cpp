@@ -0,0 +1,421 @@
+#include "walker_serializer.h"
+#include "accepted_state.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace nb = nanobind;
+
+using State = StateMachine::State;
+
+namespace
+{
+  enum NodeFlags : uint8_t
+  {
+    IS_ACCEPTED_STATE = 1 << 0,
+    HAS_TARGET_STATE = 1 << 1,
+    HAS_REMAINING_INPUT = 1 << 2,
+    HAS_RAW_VALUE = 1 << 3,
+    ACCEPTS_MORE_INPUT = 1 << 4,
+    HAS_TRANSITION_WALKER = 1 << 5,
+    HAS_PYTHON_STATE = 1 << 6,
+  };
+
+  class Writer
+  {
+  public:
+    std::string buffer;
+
+    template <typename T>
+    void write(T value)
+    {
+      char bytes[sizeof(T)];
+      std::memcpy(bytes, &value, sizeof(T));
+      buffer.append(bytes, sizeof(T));
+    }
+
+    void write_string(std::string_view value)
+    {
+      write<uint32_t>(static_cast<uint32_t>(value.size()));
+      buffer.append(value.data(), value.size());
+    }
+
+    void write_state(const State &state)
+    {
+      if (std::holds_alternative<int>(state))
+      {
+        write<uint8_t>(0);
+        write<int64_t>(std::get<int>(state));
+      }
+      else
+      {
+        write<uint8_t>(1);
+        write_string(std::get<std::string>(state));
+      }
+    }
+
+    void write_optional_state(const std::optional<State> &state)
+    {
+      write<uint8_t>(state.has_value());
+      if (state)
+      {
+        write_state(*state);
+      }
+    }
+
+    void write_optional_string(const std::optional<std::string> &value)
+    {
+      write<uint8_t>(value.has_value());
+      if (value)
+      {
+        write_string(*value);
+      }
+    }
+  };
+
+  class Reader
+  {
+  public:
+    explicit Reader(std::string_view data) : data_(data), pos_(0) {}
+
+    template <typename T>
+    T read()
+    {
+      require(sizeof(T));
+      T value;
+      std::memcpy(&value, data_.data() + pos_, sizeof(T));
+      pos_ += sizeof(T);
+      return value;
+    }
+
+    std::string read_string()
+    {
+      auto size = read<uint32_t>();
+      require(size);
+      std::string value(data_.substr(pos_, size));
+      pos_ += size;
+      return value;
+    }
+
+    State read_state()
+    {
+      if (read<uint8_t>() == 0)
+      {
+        auto value = read<int64_t>();
+        if (value < std::numeric_limits<int>::min() || value > std::numeric_limits<int>::max())
+        {
+          throw std::runtime_error("Corrupt walker snapshot");
+        }
+        return static_cast<int>(value);
+      }
+      return read_string();
+    }
+
+    std::optional<State> read_optional_state()
+    {
+      if (!read<uint8_t>())
+      {
+        return std::nullopt;
+      }
+      return read_state();
+    }
+
+    std::optional<std::string> read_optional_string()
+    {
+      if (!read<uint8_t>())
+      {
+        return std::nullopt;
+      }
+      return read_string();
+    }
+
+    bool at_end() const { return pos_ == data_.size(); }
+    size_t remaining() const { return data_.size() - pos_; }
+
+  private:
+    void require(size_t size) const
+    {
+      if (data_.size() - pos_ < size)
+      {
+        throw std::runtime_error("Truncated walker snapshot");
+      }
+    }
+
+    std::string_view data_;
+    size_t pos_;
+  };
+
+  // Python subclasses keep their own attributes outside of the C++ walker;
+  // those that implement __setstate__ get them round-tripped through pickle.
+  nb::object python_state_of(const Walker *walker)
+  {
+    if (!walker->self_py())
+    {
+      return nb::object();
+    }
+    nb::object self_py = nb::find(walker);
+    if (!nb::hasattr(self_py, "__setstate__"))
+    {
+      return nb::object();
+    }
+    nb::object state = self_py.attr("__getstate__")();
+    return nb::module_::import_("pickle").attr("dumps")(state);
+  }
+}
+
+std::string WalkerSerializer::serialize(
+    const nb::ref<StateMachine> &root,
+    const std::vector<nb::ref<Walker>> &walkers)
+{
+  auto machines = root->collect_state_machines();
+  std::unordered_map<const StateMachine *, uint32_t> machine_ids;
+  for (size_t i = 0; i < machines.size(); ++i)
+  {
+    machine_ids.emplace(machines[i], static_cast<uint32_t>(i));
+  }
+
+  // Number every distinct walker in post-order so that references always
+  // point at nodes that have already been restored.
+  std::unordered_map<const Walker *, uint32_t> node_ids;
+  std::vector<const Walker *> nodes;
+
+  auto visit = [&](auto &&self, const Walker *walker) -> void
+  {
+    if (node_ids.count(walker) > 0)
+    {
+      return;
+    }
+    if (auto accepted = dynamic_cast<const AcceptedState *>(walker))
+    {
+      self(self, accepted->accepted_walker_.get());
+    }
+    if (walker->transition_walker_)
+    {
+      self(self, walker->transition_walker_.get());
+    }
+    for (const auto &history_walker : walker->accepted_history_)
+    {
+      self(self, history_walker.get());
+    }
+    node_ids.emplace(walker, static_cast<uint32_t>(nodes.size()));
+    nodes.push_back(walker);
+  };
+
+  for (const auto &walker : walkers)
+  {
+    visit(visit, walker.get());
+  }
+
+  Writer writer;
+  writer.write<uint32_t>(MAGIC);
+  writer.write<uint32_t>(VERSION);
+  writer.write<uint32_t>(static_cast<uint32_t>(machines.size()));
+  writer.write<uint64_t>(root->fingerprint());
+  writer.write<uint32_t>(static_cast<uint32_t>(nodes.size()));
+
+  for (const Walker *walker : nodes)
+  {
+    auto machine_it = machine_ids.find(walker->state_machine_.get());
+    if (machine_it == machine_ids.end())
+    {
+      throw std::invalid_argument(
+          "Walker references a state machine that is not reachable from the root");
+    }
+
+    auto accepted = dynamic_cast<const AcceptedState *>(walker);
+    nb::object python_state = python_state_of(walker);
+
+    uint8_t flags = 0;
+    flags |= accepted ? IS_ACCEPTED_STATE : 0;
+    flags |= walker->target_state_ ? HAS_TARGET_STATE : 0;
+    flags |= walker->remaining_input_ ? HAS_REMAINING_INPUT : 0;
+    flags |= walker->_raw_value_ ? HAS_RAW_VALUE : 0;
+    flags |= walker->_accepts_more_input_ ? ACCEPTS_MORE_INPUT : 0;
+    flags |= walker->transition_walker_ ? HAS_TRANSITION_WALKER : 0;
+    flags |= python_state.is_valid() ? HAS_PYTHON_STATE : 0;
+
+    writer.write<uint32_t>(machine_it->second);
+    writer.write<uint8_t>(flags);
+    if (accepted)
+    {
+      writer.write<uint32_t>(node_ids.at(accepted->accepted_walker_.get()));
+    }
+    writer.write_state(walker->current_state_);
+    if (walker->target_state_)
+    {
+      writer.write_state(*walker->target_state_);
+    }
+    writer.write<uint64_t>(walker->consumed_character_count_);
+    if (walker->remaining_input_)
+    {
+      writer.write_string(*walker->remaining_input_);
+    }
+    if (walker->_raw_value_)
+    {
+      writer.write_string(*walker->_raw_value_);
+    }
+    if (walker->transition_walker_)
+    {
+      writer.write<uint32_t>(node_ids.at(walker->transition_walker_.get()));
+    }
+
+    writer.write<uint32_t>(static_cast<uint32_t>(walker->accepted_history_.size()));
+    for (const auto &history_walker : walker->accepted_history_)
+    {
+      writer.write<uint32_t>(node_ids.at(history_walker.get()));
+    }
+
+    writer.write<uint32_t>(static_cast<uint32_t>(walker->explored_edges_.size()));
+    for (const auto &[start_state, target_state, value] : walker->explored_edges_)
+    {
+      writer.write_state(start_state);
+      writer.write_optional_state(target_state);
+      writer.write_optional_string(value);
+    }
+
+    if (python_state.is_valid())
+    {
+      nb::bytes pickled = nb::cast<nb::bytes>(python_state);
+      writer.write_string(std::string_view(pickled.c_str(), pickled.size()));
+    }
+  }
+
+  writer.write<uint32_t>(static_cast<uint32_t>(walkers.size()));
+  for (const auto &walker : walkers)
+  {
+    writer.write<uint32_t>(node_ids.at(walker.get()));
+  }
+
+  return std::move(writer.buffer);
+}
+
+std::vector<nb::ref<Walker>> WalkerSerializer::deserialize(
+    const nb::ref<StateMachine> &root,
+    std::string_view data)
+{
+  Reader reader(data);
+  if (reader.read<uint32_t>() != MAGIC)
+  {
+    throw std::invalid_argument("Data is not a walker snapshot");
+  }
+  if (reader.read<uint32_t>() != VERSION)
+  {
+    throw std::invalid_argument("Unsupported walker snapshot version");
+  }
+
+  auto machines = root->collect_state_machines();
+  auto machine_count = reader.read<uint32_t>();
+  if (machine_count != machines.size() || reader.read<uint64_t>() != root->fingerprint())
+  {
+    throw std::invalid_argument("Walker snapshot was taken against a different state machine");
+  }
+
+  auto node_ref = [](const std::vector<nb::ref<Walker>> &nodes, uint32_t id) -> nb::ref<Walker>
+  {
+    if (id >= nodes.size())
+    {
+      throw std::runtime_error("Corrupt walker snapshot");
+    }
+    return nodes[id];
+  };
+
+  auto node_count = reader.read<uint32_t>();
+  std::vector<nb::ref<Walker>> nodes;
+  // Every node takes at least one byte, which bounds the count a corrupt header can claim.
+  nodes.reserve(std::min<size_t>(node_count, reader.remaining()));
+
+  for (uint32_t i = 0; i < node_count; ++i)
+  {
+    auto machine_id = reader.read<uint32_t>();
+    if (machine_id >= machines.size())
+    {
+      throw std::runtime_error("Corrupt walker snapshot");
+    }
+    auto flags = reader.read<uint8_t>();
+
+    nb::ref<Walker> accepted_walker;
+    if (flags & IS_ACCEPTED_STATE)
+    {
+      accepted_walker = node_ref(nodes, reader.read<uint32_t>());
+    }
+    State current_state = reader.read_state();
+
+    nb::ref<Walker> walker = accepted_walker
+                                 ? nb::ref<Walker>(new AcceptedState(accepted_walker))
+                                 : machines[machine_id]->get_new_walker(current_state);
+
+    walker->current_state_ = std::move(current_state);
+    walker->target_state_ = std::nullopt;
+    if (flags & HAS_TARGET_STATE)
+    {
+      walker->target_state_ = reader.read_state();
+    }
+    walker->consumed_character_count_ = static_cast<size_t>(reader.read<uint64_t>());
+    walker->remaining_input_ = std::nullopt;
+    if (flags & HAS_REMAINING_INPUT)
+    {
+      walker->remaining_input_ = reader.read_string();
+    }
+    walker->_raw_value_ = std::nullopt;
+    if (flags & HAS_RAW_VALUE)
+    {
+      walker->_raw_value_ = reader.read_string();
+    }
+    walker->_accepts_more_input_ = (flags & ACCEPTS_MORE_INPUT) != 0;
+    walker->transition_walker_ = nullptr;
+    if (flags & HAS_TRANSITION_WALKER)
+    {
+      walker->transition_walker_ = node_ref(nodes, reader.read<uint32_t>());
+    }
+
+    walker->accepted_history_.clear();
+    auto history_size = reader.read<uint32_t>();
+    for (uint32_t j = 0; j < history_size; ++j)
+    {
+      walker->accepted_history_.push_back(node_ref(nodes, reader.read<uint32_t>()));
+    }
+
+    walker->explored_edges_.clear();
+    auto edge_count = reader.read<uint32_t>();
+    for (uint32_t j = 0; j < edge_count; ++j)
+    {
+      State start_state = reader.read_state();
+      std::optional<State> target_state = reader.read_optional_state();
+      std::optional<std::string> value = reader.read_optional_string();
+      walker->explored_edges_.emplace(std::move(start_state), std::move(target_state), std::move(value));
+    }
+
+    if (flags & HAS_PYTHON_STATE)
+    {
+      std::string pickled = reader.read_string();
+      nb::object state = nb::module_::import_("pickle").attr("loads")(
+          nb::bytes(pickled.data(), pickled.size()));
+      nb::object self_py = nb::find(walker.get());
+      if (!self_py.is_valid() || !nb::hasattr(self_py, "__setstate__"))
+      {
+        throw std::invalid_argument(
+            "Walker snapshot holds Python state for a walker that cannot restore it");
+      }
+      self_py.attr("__setstate__")(state);
+    }
+
+    nodes.push_back(std::move(walker));
+  }
+
+  auto walker_count = reader.read<uint32_t>();
+  std::vector<nb::ref<Walker>> walkers;
+  walkers.reserve(std::min<size_t>(walker_count, reader.remaining() / sizeof(uint32_t)));
+  for (uint32_t i = 0; i < walker_count; ++i)
+  {
+    walkers.push_back(node_ref(nodes, reader.read<uint32_t>()));
+  }
+
+  if (!reader.at_end())
+  {
+    throw std::runtime_error("Corrupt walker snapshot");
+  }
+  return walkers;
+}
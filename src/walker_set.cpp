@@ -0,0 +1,61 @@
+#include "walker_set.h"
+#include "utf8.h"
+#include <utility>
+
+WalkerSet::WalkerSet(std::vector<nb::ref<Walker>> walkers)
+    : node_(std::make_shared<Node>())
+{
+  node_->walkers = std::move(walkers);
+}
+
+std::vector<WalkerSet> WalkerSet::fork(size_t n) const
+{
+  return std::vector<WalkerSet>(n, *this);
+}
+
+bool WalkerSet::consume_token(const std::string &token)
+{
+  std::shared_ptr<Node> next;
+  {
+    std::lock_guard<std::mutex> lock(node_->mutex);
+    auto &memo = node_->advances[token];
+    next = memo.lock();
+    if (!next)
+    {
+      next = std::make_shared<Node>();
+      std::string input = node_->pending_bytes + token;
+      size_t complete = utf8_complete_length(input);
+      next->pending_bytes = input.substr(complete);
+      if (complete == 0)
+      {
+        next->walkers = node_->walkers;
+      }
+      else
+      {
+        input.resize(complete);
+        for (auto &walker : node_->walkers)
+        {
+          for (auto &advanced_walker : walker->consume_token(input))
+          {
+            if (!advanced_walker->remaining_input_)
+            {
+              next->walkers.push_back(std::move(advanced_walker));
+            }
+          }
+        }
+      }
+      memo = next;
+
+      // Forget the tokens no handle followed any further.
+      std::erase_if(node_->advances, [](const auto &entry)
+                    { return entry.second.expired(); });
+    }
+  }
+  node_ = std::move(next);
+  return !node_->walkers.empty();
+}
+
+const std::vector<nb::ref<Walker>> &WalkerSet::walkers() const
+{
+  return node_->walkers;
+}
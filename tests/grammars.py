@@ -0,0 +1,149 @@
+"""Grammars built from Python subclasses, the way schema grammars are."""
+
+from __future__ import annotations
+
+from pse_core import State
+from pse_core.state_machine import StateMachine
+from pse_core.walker import Walker
+
+
+class TextMachine(StateMachine):
+    """Leaf that matches a fixed string."""
+
+    def __init__(self, text: str, is_optional: bool = False) -> None:
+        super().__init__(is_optional=is_optional)
+        self.text = text
+
+    def get_new_walker(self, state: State | None = None) -> Walker:
+        return TextWalker(self, state)
+
+    def first_bytes(self) -> str | None:
+        return self.text[:1] or None
+
+
+class TextWalker(Walker):
+    """Walks a TextMachine; the position is the consumed character count."""
+
+    def __init__(self, state_machine: TextMachine, current_state: State | None = None) -> None:
+        super().__init__(state_machine, current_state)
+
+    @property
+    def remaining_text(self) -> str:
+        return self.state_machine.text[self.consumed_character_count :]
+
+    def can_accept_more_input(self) -> bool:
+        return bool(self.remaining_text)
+
+    def should_start_transition(self, token: str) -> bool:
+        remaining = self.remaining_text
+        return bool(remaining) and (remaining.startswith(token) or token.startswith(remaining))
+
+    def consume_token(self, token: str) -> list[Walker]:
+        remaining = self.remaining_text
+        length = len(remaining) if token.startswith(remaining) else len(token)
+        if not remaining or not remaining.startswith(token[:length]):
+            return []
+        walker = self.clone()
+        walker.consumed_character_count += length
+        walker._raw_value = self.state_machine.text[: walker.consumed_character_count]
+        walker.remaining_input = token[length:] or None
+        walker._accepts_more_input = walker.can_accept_more_input()
+        return [walker]
+
+    def has_reached_accept_state(self) -> bool:
+        return not self.remaining_text
+
+    def get_valid_continuations(self, depth: int = 0) -> list[str]:
+        return [self.remaining_text] if self.remaining_text else []
+
+
+class SequenceMachine(StateMachine):
+    """Matches its parts one after another."""
+
+    def __init__(self, parts: list[StateMachine], is_optional: bool = False) -> None:
+        graph = {index: [(part, index + 1)] for index, part in enumerate(parts)}
+        super().__init__(graph, 0, [len(parts)], is_optional=is_optional)
+
+
+class ChoiceMachine(StateMachine):
+    """Matches any one of its options."""
+
+    def __init__(self, options: list[StateMachine], is_optional: bool = False) -> None:
+        super().__init__({0: [(option, "$") for option in options]}, 0, ["$"], is_optional=is_optional)
+
+
+DIGITS = "0123456789"
+
+
+class DigitsMachine(StateMachine):
+    """Reads any run of digits through its own walker; the graph only shows a "0"."""
+
+    def __init__(self) -> None:
+        super().__init__({0: [(TextMachine("0"), 1)]}, 0, [1])
+
+    def get_new_walker(self, state: State | None = None) -> Walker:
+        return DigitsWalker(self, state)
+
+
+class DigitsWalker(Walker):
+    """Consumes leading digits itself instead of walking the machine's graph."""
+
+    def __init__(self, state_machine: DigitsMachine, current_state: State | None = None) -> None:
+        super().__init__(state_machine, current_state)
+
+    def can_accept_more_input(self) -> bool:
+        return True
+
+    def should_start_transition(self, token: str) -> bool:
+        return bool(token) and token[0] in DIGITS
+
+    def consume_token(self, token: str) -> list[Walker]:
+        digits = len(token) - len(token.lstrip(DIGITS))
+        if not digits:
+            return []
+        walker = self.clone()
+        walker.consumed_character_count += digits
+        walker._raw_value = (self._raw_value or "") + token[:digits]
+        walker.remaining_input = token[digits:] or None
+        walker._accepts_more_input = True
+        return [walker]
+
+    def has_reached_accept_state(self) -> bool:
+        return self.consumed_character_count > 0
+
+
+def boolean_object() -> StateMachine:
+    """Objects like {"a":true}, with a true, false or null value."""
+    return SequenceMachine(
+        [
+            TextMachine("{"),
+            TextMachine('"a"'),
+            TextMachine(":"),
+            ChoiceMachine([TextMachine("true"), TextMachine("false"), TextMachine("null")]),
+            TextMachine("}"),
+        ]
+    )
+
+
+def native_boolean_object() -> StateMachine:
+    """boolean_object() built from plain StateMachine nodes around the same leaves."""
+    choice = StateMachine({0: [(TextMachine(value), "$") for value in ["true", "false", "null"]]}, 0, ["$"])
+    parts = [TextMachine("{"), TextMachine('"a"'), TextMachine(":"), choice, TextMachine("}")]
+    return StateMachine({index: [(part, index + 1)] for index, part in enumerate(parts)}, 0, [len(parts)])
+
+
+def digit_list() -> StateMachine:
+    """Lists like [42], with a single run of digits read by DigitsWalker."""
+    return SequenceMachine([TextMachine("["), DigitsMachine(), TextMachine("]")])
+
+
+def advance(walkers: list[Walker], tokens: list[str]) -> list[Walker]:
+    """Walkers that consumed every token in full."""
+    for token in tokens:
+        walkers = [walker for _, walker in StateMachine.advance_all(walkers, token)]
+    return walkers
+
+
+def accepts(root: StateMachine, text: str) -> bool:
+    """Whether the whole text is a complete match of root."""
+    return StateMachine.can_end(advance(root.get_walkers(), [text]))
@@ -0,0 +1,27 @@
+from grammars import advance, boolean_object
+
+from pse_core.accepted_state import AcceptedState
+
+
+def accepted_walkers() -> list[AcceptedState]:
+    walkers = advance(boolean_object().get_walkers(), ['{"a":true}'])
+    accepted = [walker for walker in walkers if isinstance(walker, AcceptedState)]
+    assert accepted
+    return accepted
+
+
+def test_raw_value_reads_through_to_the_accepted_walker():
+    for walker in accepted_walkers():
+        assert walker._raw_value == '{"a":true}'
+        assert walker._raw_value == walker.get_raw_value()
+        assert walker._raw_value == walker.accepted_walker.get_raw_value()
+
+
+def test_assigned_raw_value_takes_precedence():
+    walker = accepted_walkers()[0]
+    walker._raw_value = "override"
+    assert walker._raw_value == "override"
+    assert walker.get_raw_value() == "override"
+
+    walker._raw_value = None
+    assert walker._raw_value == '{"a":true}'
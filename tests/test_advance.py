@@ -0,0 +1,101 @@
+from concurrent.futures import ThreadPoolExecutor
+
+from grammars import ChoiceMachine, SequenceMachine, TextMachine, advance, boolean_object
+
+from pse_core.state_machine import StateMachine
+from pse_core.walker import Walker
+
+
+def two_ways() -> StateMachine:
+    """One "abc" token splits as a|bc or ab|c, so leftover input is requeued on two branches."""
+    return SequenceMachine(
+        [
+            ChoiceMachine([TextMachine("a"), TextMachine("ab")]),
+            ChoiceMachine([TextMachine("bc"), TextMachine("c")]),
+            TextMachine("!", is_optional=True),
+        ]
+    )
+
+
+def paths(walkers: list[Walker]) -> list[tuple[str, ...]]:
+    result = []
+    for walker in walkers:
+        walker = getattr(walker, "accepted_walker", walker)
+        values = [accepted.get_raw_value() for accepted in walker.accepted_history]
+        if walker.transition_walker is not None:
+            values.append(walker.transition_walker.get_raw_value())
+        result.append(tuple(value for value in values if value))
+    return sorted(result)
+
+
+def test_leftover_input_continues_on_every_branch():
+    walkers = advance(two_ways().get_walkers(), ["abc"])
+    assert StateMachine.can_end(walkers)
+    assert all(walker.get_raw_value() == "abc" for walker in walkers)
+    assert not any(walker.remaining_input for walker in walkers)
+    assert ("a", "bc") in paths(walkers)
+    assert ("ab", "c") in paths(walkers)
+
+    assert StateMachine.can_end(advance(walkers, ["!"]))
+    assert not advance(walkers, ["c"])
+
+
+def test_partial_tokens_keep_both_choices_open():
+    walkers = advance(two_ways().get_walkers(), ["ab"])
+    assert walkers
+    assert not StateMachine.can_end(walkers)
+    assert StateMachine.can_end(advance(walkers, ["c"]))
+    assert StateMachine.can_end(advance(walkers, ["bc"]))
+    assert not StateMachine.can_end(advance(walkers, ["b"]))
+
+
+class InnerCheckMachine(StateMachine):
+    """Leaf whose walker runs a whole advance of another grammar while being advanced."""
+
+    def __init__(self, inner: StateMachine) -> None:
+        super().__init__()
+        self.inner = inner
+
+    def get_new_walker(self, state=None) -> Walker:
+        return InnerCheckWalker(self, state)
+
+
+class InnerCheckWalker(Walker):
+    def can_accept_more_input(self) -> bool:
+        return self.consumed_character_count == 0
+
+    def should_start_transition(self, token: str) -> bool:
+        return self.consumed_character_count == 0
+
+    def consume_token(self, token: str) -> list[Walker]:
+        inner = advance(self.state_machine.inner.get_walkers(), [token])
+        if not StateMachine.can_end(inner):
+            return []
+        walker = self.clone()
+        walker.consumed_character_count += len(token)
+        walker._raw_value = token
+        return [walker]
+
+    def has_reached_accept_state(self) -> bool:
+        return self.consumed_character_count > 0
+
+
+def test_nested_advance_does_not_disturb_the_outer_one():
+    root = SequenceMachine([TextMachine("<"), InnerCheckMachine(boolean_object()), TextMachine(">")])
+    start = root.get_walkers()
+    walkers = advance(start, ["<"])
+    assert StateMachine.can_end(advance(walkers, ['{"a":null}', ">"]))
+    assert not advance(walkers, ['{"a":nul}'])
+
+
+def test_threads_advance_the_same_grammar():
+    root = two_ways()
+    inputs = [["abc"], ["a", "bc"], ["ab", "c", "!"], ["abc!"], ["ac"], ["abcc"]] * 8
+    expected = [StateMachine.can_end(advance(root.get_walkers(), tokens)) for tokens in inputs]
+    assert expected[:6] == [True, True, True, True, True, False]
+
+    def run(tokens):
+        return StateMachine.can_end(advance(root.get_walkers(), tokens))
+
+    with ThreadPoolExecutor(max_workers=4) as pool:
+        assert list(pool.map(run, inputs)) == expected
@@ -0,0 +1,47 @@
+import pytest
+from grammars import TextMachine, advance
+
+from pse_core.state_machine import StateMachine
+
+
+def ambiguous() -> StateMachine:
+    """Plain machines around text leaves; after "xa" three walkers are alive."""
+    return StateMachine(
+        {
+            0: [(TextMachine("x"), 1)],
+            1: [(TextMachine("ab"), 2), (TextMachine("abc"), 2), (TextMachine("a"), 3)],
+            3: [(TextMachine("bcd"), 2)],
+        },
+        0,
+        [2],
+    )
+
+
+VOCABULARY = ["x", "xa", "xab", "xabc", "xabcd", "xabcde", "a", "ab", "abc", "b", "bc", "bcd", "c", "cd", "d", "y"]
+POSITIONS = [[], ["x"], ["xa"], ["xab"], ["xa", "bc"], ["xabcd"]]
+
+
+def consumes_fully(walker, token: str) -> bool:
+    return any(not advanced.remaining_input for advanced in walker.consume_token(token))
+
+
+@pytest.mark.parametrize("max_walkers", [0, 1, 2])
+@pytest.mark.parametrize("tokens", POSITIONS)
+def test_can_consume_agrees_with_consume_token(max_walkers, tokens):
+    root = ambiguous()
+    root.max_walkers = max_walkers
+    walkers = advance(root.get_walkers(), tokens)
+    for token in VOCABULARY:
+        for walker in walkers:
+            assert walker.can_consume(token) == consumes_fully(walker, token), (tokens, token)
+        expected = any(consumes_fully(walker, token) for walker in walkers)
+        assert StateMachine.can_consume(walkers, token) == expected, (tokens, token)
+
+
+def test_can_consume_keeps_no_walkers():
+    root = ambiguous()
+    walkers = root.get_walkers()
+    assert StateMachine.can_consume(walkers, "xabc")
+    assert not StateMachine.can_consume(walkers, "xabce")
+    assert [walker.current_state for walker in walkers] == [walker.current_state for walker in root.get_walkers()]
+    assert all(walker.consumed_character_count == 0 for walker in walkers)
@@ -0,0 +1,44 @@
+from concurrent.futures import ThreadPoolExecutor
+
+from grammars import TextMachine, advance, boolean_object
+
+from pse_core.state_machine import StateMachine
+from pse_core.token_mask_cache import TokenMaskCache
+from pse_core.token_vocabulary import TokenVocabulary
+
+# "é" is C3 A9 in UTF-8
+PIECES = ["<0xC3>", "<0xA9>", "t", "é"]
+
+
+def test_byte_fallback_tokens_are_joined_for_python_leaves():
+    root = TextMachine("été")
+    cache = TokenMaskCache(TokenVocabulary(PIECES))
+
+    walkers = cache.consume_tokens(root.get_walkers(), [0, 1, 2, 3])
+    assert StateMachine.can_end(walkers)
+
+    steps = cache.consume_tokens(root.get_walkers(), [0, 1, 2], keep_steps=True)
+    assert len(steps) == 3
+    assert len(steps[0]) == len(root.get_walkers())
+
+
+def test_trailing_partial_character_is_rejected_natively():
+    root = TextMachine("été")
+    cache = TokenMaskCache(TokenVocabulary(PIECES))
+
+    assert cache.consume_tokens(root.get_walkers(), [3, 2, 0]) == []
+    steps = cache.consume_tokens(root.get_walkers(), [3, 2, 0], keep_steps=True)
+    assert len(steps) == 2
+    assert steps[-1]
+
+
+def test_consume_text_from_threads():
+    root = boolean_object()
+    texts = ['{"a":true}', '{"a":false}', '{"a":null}', '{"a":nul}'] * 4
+
+    def run(text):
+        return StateMachine.can_end(StateMachine.consume_text(root.get_walkers(), text, chunk_bytes=3))
+
+    with ThreadPoolExecutor(max_workers=4) as pool:
+        results = list(pool.map(run, texts))
+    assert results == [StateMachine.can_end(advance(root.get_walkers(), [text])) for text in texts]
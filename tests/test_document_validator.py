@@ -0,0 +1,31 @@
+from grammars import SequenceMachine, TextMachine, accepts, boolean_object
+
+from pse_core.document_validator import DocumentValidator
+
+DOCUMENTS = ['{"a":true}', '{"a":false}', '{"a":nul}', '{"a":', '{"b":true}', "", '{"a":null}x']
+
+
+def test_batch_on_python_grammar_matches_single_threaded_walk():
+    root = boolean_object()
+    validator = DocumentValidator(boolean_object(), num_threads=4, chunk_bytes=3)
+
+    results = validator.validate_batch(DOCUMENTS * 8)
+    assert [bool(result) for result in results] == [accepts(root, document) for document in DOCUMENTS * 8]
+    assert [result.error_offset for result in results[: len(DOCUMENTS)]] == [10, 11, 8, 5, 2, 0, 10]
+
+
+def test_offsets_count_bytes_not_characters():
+    validator = DocumentValidator(SequenceMachine([TextMachine("été"), TextMachine("!")]))
+
+    result = validator.validate("été?")
+    assert not result
+    assert result.error_offset == len("été".encode()) == 5
+
+
+def test_file_with_malformed_bytes(tmp_path):
+    path = tmp_path / "documents.jsonl"
+    path.write_bytes(b'{"a":true}\n{"a":\xff}\n{"a":null}\n')
+    validator = DocumentValidator(boolean_object(), num_threads=2)
+
+    results = validator.validate_file(str(path))
+    assert [(bool(result), result.error_offset) for result in results] == [(True, 10), (False, 5), (True, 10)]
@@ -0,0 +1,64 @@
+import pytest
+from grammars import ChoiceMachine, SequenceMachine, TextMachine, accepts, boolean_object
+
+from pse_core.grammar_image import GrammarImage
+
+BYTE_ORDER_OFFSET = 28
+
+
+def describe(machine):
+    return getattr(machine, "text", "")
+
+
+def resolve(type_name, key):
+    if type_name == "TextMachine":
+        return TextMachine(key)
+    if type_name == "SequenceMachine":
+        return SequenceMachine([])
+    return ChoiceMachine([])
+
+
+def test_round_trip_python_grammar():
+    image = GrammarImage.dumps(boolean_object(), describe)
+    root = GrammarImage.loads(image, resolve)
+
+    assert accepts(root, '{"a":null}')
+    assert not accepts(root, '{"a":nul}')
+    assert GrammarImage.dumps(root, describe) == image
+
+
+def test_rejects_image_of_the_other_byte_order():
+    image = bytearray(GrammarImage.dumps(boolean_object(), describe))
+    marker = image[BYTE_ORDER_OFFSET : BYTE_ORDER_OFFSET + 4]
+    image[BYTE_ORDER_OFFSET : BYTE_ORDER_OFFSET + 4] = marker[::-1]
+
+    with pytest.raises(ValueError, match="byte order"):
+        GrammarImage.loads(bytes(image), resolve)
+
+
+def test_loaded_grammar_is_frozen():
+    root = GrammarImage.loads(GrammarImage.dumps(boolean_object(), describe), resolve)
+    assert root.frozen
+    assert all(machine.frozen for _, edges in root.state_graph.items() for machine, _ in edges)
+
+
+def test_rejects_a_frozen_machine_from_the_resolver():
+    shared = TextMachine("{")
+    shared.freeze()
+
+    def resolve_shared(type_name, key):
+        return shared if type_name == "TextMachine" else resolve(type_name, key)
+
+    with pytest.raises(RuntimeError, match="frozen"):
+        GrammarImage.loads(GrammarImage.dumps(boolean_object(), describe), resolve_shared)
+    assert shared.text == "{"
+
+
+def test_rejects_the_same_machine_for_two_records():
+    reused = TextMachine("")
+
+    def resolve_reused(type_name, key):
+        return reused if type_name == "TextMachine" else resolve(type_name, key)
+
+    with pytest.raises(ValueError, match="same state machine"):
+        GrammarImage.loads(GrammarImage.dumps(boolean_object(), describe), resolve_reused)
@@ -0,0 +1,53 @@
+from grammars import advance, boolean_object
+
+from pse_core.state_machine import StateMachine
+
+
+def test_jump_forward_stops_where_the_values_diverge():
+    start = boolean_object().get_walkers()
+    forced, walkers = StateMachine.jump_forward(start)
+
+    assert forced == '{"a":'
+    assert len(walkers) == len(advance(start, [forced]))
+    for value in ["true}", "false}", "null}"]:
+        assert StateMachine.can_end(advance(walkers, [value]))
+
+    # At the choice itself nothing is forced.
+    assert StateMachine.jump_forward(walkers)[0] == ""
+
+
+def test_jump_forward_completes_a_chosen_value():
+    start = boolean_object().get_walkers()
+    forced, walkers = StateMachine.jump_forward(advance(start, ['{"a":f']))
+
+    assert forced == "alse}"
+    assert StateMachine.can_end(walkers)
+
+
+def test_jump_forward_respects_max_length():
+    forced, walkers = StateMachine.jump_forward(boolean_object().get_walkers(), max_length=2)
+
+    assert '{"a":'.startswith(forced)
+    assert 0 < len(forced) <= 2
+    assert walkers
+
+
+def test_verify_draft_stops_at_the_first_rejected_token():
+    start = boolean_object().get_walkers()
+    draft = ["{", '"a"', ":", "tr", "x", "ue}"]
+    accepted, steps = StateMachine.verify_draft(start, draft)
+
+    assert accepted == 4
+    assert len(steps) == accepted
+    for count, walkers in enumerate(steps, start=1):
+        assert len(walkers) == len(advance(start, draft[:count]))
+    assert StateMachine.can_end(advance(steps[-1], ["ue}"]))
+
+
+def test_verify_draft_accepts_a_valid_draft():
+    start = boolean_object().get_walkers()
+    accepted, steps = StateMachine.verify_draft(start, ['{"a":', "null", "}"])
+
+    assert accepted == 3
+    assert StateMachine.can_end(steps[-1])
+    assert StateMachine.verify_draft(start, ["x", "{"]) == (0, [])
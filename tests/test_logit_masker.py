@@ -0,0 +1,107 @@
+import pytest
+from grammars import advance, boolean_object
+
+from pse_core.logit_masker import LogitMasker
+from pse_core.token_mask_cache import TokenBitmask, TokenMaskCache
+
+np = pytest.importorskip("numpy")
+
+VOCABULARY_SIZE = 100
+
+# At the start, words 0 and 2 are mixed and word 1 allows nothing. After
+# '{"a":' only the values in word 1 are allowed. The last four ids, which no
+# full mask word covers, are finished by the scalar tail.
+ALLOWED_POSITIONS = [0, 1, 5, 9, 12, 17, 30, 31, 64, 66, 70, 75, 80, 85, 90, 94, 95, 96, 97, 98, 99]
+# The grammar first allows every prefix of a complete object
+OBJECTS = ['{"a":true}', '{"a":false}', '{"a":null}']
+ALLOWED_PIECES = list(dict.fromkeys(text[:end] for text in OBJECTS for end in range(1, len(text) + 1)))
+VALUE_PIECES = {33: "t", 40: "true", 47: "fal", 63: "null}"}
+
+
+def vocabulary() -> list[str]:
+    pieces = [f"x{i}" for i in range(VOCABULARY_SIZE)]
+    for position, piece in zip(ALLOWED_POSITIONS, ALLOWED_PIECES, strict=True):
+        pieces[position] = piece
+    for position, piece in VALUE_PIECES.items():
+        pieces[position] = piece
+    return pieces
+
+
+def grammar_masks() -> tuple[TokenBitmask, TokenBitmask]:
+    cache = TokenMaskCache(vocabulary())
+    start = boolean_object().get_walkers()
+    at_start = cache.compute(start)
+    at_value = cache.compute(advance(start, ['{"a":']))
+    assert at_start.allowed_ids() == ALLOWED_POSITIONS
+    assert at_value.allowed_ids() == list(VALUE_PIECES)
+    return at_start, at_value
+
+
+def expected(logits, mask: TokenBitmask):
+    result = logits.copy()
+    for token_id in range(result.shape[-1]):
+        if token_id >= len(mask) or token_id not in mask:
+            result[..., token_id] = -np.inf
+    return result
+
+
+@pytest.mark.parametrize("dtype", ["float32", "float16"])
+@pytest.mark.parametrize("width", [64, VOCABULARY_SIZE, 128])
+def test_one_row_matches_the_mask(dtype, width):
+    for mask in grammar_masks():
+        logits = np.arange(1, width + 1, dtype=dtype)
+        reference = expected(logits, mask)
+        LogitMasker.apply(logits, mask)
+        assert np.array_equal(logits, reference)
+
+
+@pytest.mark.parametrize("dtype", ["float32", "float16"])
+def test_words_that_allow_everything_or_nothing(dtype):
+    everything = np.arange(1, VOCABULARY_SIZE + 1, dtype=dtype)
+    LogitMasker.apply(everything, TokenBitmask(VOCABULARY_SIZE, True))
+    assert np.array_equal(everything, np.arange(1, VOCABULARY_SIZE + 1, dtype=dtype))
+
+    nothing = np.arange(1, VOCABULARY_SIZE + 1, dtype=dtype)
+    LogitMasker.apply(nothing, TokenBitmask(VOCABULARY_SIZE, False))
+    assert np.all(np.isneginf(nothing))
+
+
+@pytest.mark.parametrize("dtype", ["float32", "float16"])
+def test_batch_rows_use_their_own_mask(dtype):
+    at_start, at_value = grammar_masks()
+    padded = np.tile(np.arange(1, 129, dtype=dtype), (3, 1))
+    logits = padded[:, :VOCABULARY_SIZE]
+    reference = np.stack(
+        [expected(logits[0], at_start), expected(logits[1], at_value), expected(logits[2], at_start)]
+    )
+
+    LogitMasker.apply(logits, [at_start, at_value, at_start])
+    assert np.array_equal(logits, reference)
+    assert np.array_equal(padded[:, VOCABULARY_SIZE:], np.tile(np.arange(101, 129, dtype=dtype), (3, 1)))
+
+    shared = np.tile(np.arange(1, VOCABULARY_SIZE + 1, dtype=dtype), (2, 1))
+    LogitMasker.apply(shared, at_value)
+    assert np.array_equal(shared, np.stack([expected(shared[0], at_value)] * 2))
+
+
+def test_bfloat16_matches_the_mask():
+    torch = pytest.importorskip("torch")
+    for mask in grammar_masks():
+        logits = torch.arange(1, 129, dtype=torch.float32).to(torch.bfloat16)
+        reference = torch.from_numpy(expected(logits.float().numpy(), mask)).to(torch.bfloat16)
+        LogitMasker.apply(logits, mask)
+        assert torch.equal(logits, reference)
+
+
+def test_rejects_unsupported_buffers():
+    mask = TokenBitmask(VOCABULARY_SIZE, True)
+    with pytest.raises(ValueError):
+        LogitMasker.apply(np.zeros(VOCABULARY_SIZE, dtype="float64"), mask)
+    with pytest.raises(ValueError):
+        LogitMasker.apply(np.zeros((VOCABULARY_SIZE, 2), dtype="float32")[:, 0], mask)
+    with pytest.raises(ValueError):
+        LogitMasker.apply(np.zeros((2, VOCABULARY_SIZE), dtype="float32"), [mask, mask, mask])
+
+
+def test_backend_names_a_known_kernel():
+    assert LogitMasker.backend() in {"avx512", "avx2", "neon", "scalar"}
@@ -0,0 +1,57 @@
+import pytest
+from grammars import SequenceMachine, TextMachine, accepts, advance, boolean_object, digit_list
+
+from pse_core.state_machine import StateMachine
+
+INPUTS = ['{"a":true}', '{"a":nul', '{"a"x', "y", "xy", "xxy", "z"]
+
+
+def nullable_prefix() -> StateMachine:
+    """A sub-machine that is not optional but whose start state is an end state."""
+    inner = StateMachine({0: [(TextMachine("x"), 0)]}, 0, [0])
+    return SequenceMachine([inner, TextMachine("y")])
+
+
+def outcome(root: StateMachine, text: str) -> tuple[int, bool]:
+    walkers = advance(root.get_walkers(), [text])
+    return len(walkers), StateMachine.can_end(walkers)
+
+
+@pytest.mark.parametrize("build", [boolean_object, nullable_prefix])
+def test_frozen_grammar_accepts_the_same_input(build):
+    mutable, frozen = build(), build()
+    frozen.freeze()
+    for text in INPUTS:
+        assert outcome(frozen, text) == outcome(mutable, text), text
+
+
+def test_python_graph_derives_its_first_bytes():
+    root = boolean_object()
+    assert root.first_bytes() == "{"
+
+    root.freeze()
+    assert root.may_start_with(ord("{"))
+    assert not root.may_start_with(ord("x"))
+    assert not root.nullable
+
+
+def test_nullable_edges_are_kept():
+    root = nullable_prefix()
+    root.freeze()
+    inner = root.get_edges(0)[0][0]
+    assert inner.nullable
+    assert not inner.may_start_with(ord("y"))
+    assert outcome(root, "y") == outcome(nullable_prefix(), "y")
+
+
+def test_graph_machines_with_custom_walkers_accept_any_first_byte():
+    root = digit_list()
+    root.freeze()
+    digits = root.get_edges(1)[0][0]
+    assert digits.first_bytes() is None
+    assert digits.may_start_with(ord("7"))
+
+    for text in ["[0]", "[7]", "[42]", "[x]", "[4x"]:
+        assert outcome(root, text) == outcome(digit_list(), text), text
+    assert accepts(root, "[42]")
+    assert not accepts(root, "[x]")
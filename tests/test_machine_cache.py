@@ -0,0 +1,87 @@
+from concurrent.futures import ThreadPoolExecutor
+
+from grammars import TextMachine, boolean_object
+
+from pse_core.machine_cache import MachineCache
+
+
+class EdgeOverridingMachine(TextMachine):
+    def get_edges(self, state):
+        return super().get_edges(state)
+
+
+class CallbackMachine(TextMachine):
+    def __init__(self, text, callback):
+        super().__init__(text)
+        self.callback = callback
+
+
+def test_equal_python_grammars_hit_the_cache():
+    cache = MachineCache()
+    first = cache.intern(boolean_object())
+    second = cache.intern(boolean_object())
+
+    assert second is first
+    assert cache.hits == 1
+    assert cache.misses == 1
+    assert len(cache) == 1
+
+
+def test_leaf_attributes_are_part_of_the_key():
+    assert TextMachine("a").fingerprint() == TextMachine("a").fingerprint()
+    assert TextMachine("a").fingerprint() != TextMachine("b").fingerprint()
+    assert TextMachine("a").fingerprint() != TextMachine("a", is_optional=True).fingerprint()
+
+
+def test_opaque_subclasses_keep_instance_identity():
+    assert EdgeOverridingMachine("a").fingerprint() != EdgeOverridingMachine("a").fingerprint()
+    assert CallbackMachine("a", print).fingerprint() != CallbackMachine("a", print).fingerprint()
+
+    cache = MachineCache()
+    cache.intern(EdgeOverridingMachine("a"))
+    cache.intern(EdgeOverridingMachine("a"))
+    assert cache.hits == 0
+    assert len(cache) == 2
+
+
+def test_custom_priorities_are_never_shared():
+    def build():
+        root = boolean_object()
+        root.max_walkers = 2
+        root.walker_priority = lambda walker: 0.0
+        return root
+
+    first, second = build(), build()
+    assert first.fingerprint() != second.fingerprint()
+
+    cache = MachineCache()
+    cache.intern(first)
+    assert cache.intern(second) is second
+    assert cache.hits == 0
+
+
+def test_a_hit_leaves_the_argument_mutable():
+    cache = MachineCache()
+    stored = cache.intern(boolean_object())
+    duplicate = boolean_object()
+
+    assert cache.intern(duplicate) is stored
+    assert stored.frozen
+    assert not duplicate.frozen
+    duplicate.is_optional = True
+
+
+def test_concurrent_interns_freeze_only_the_stored_machine():
+    cache = MachineCache()
+    machines = [boolean_object() for _ in range(32)]
+    for machine in machines:
+        machine.fingerprint()
+
+    with ThreadPoolExecutor(max_workers=8) as pool:
+        results = list(pool.map(cache.intern, machines))
+
+    stored = results[0]
+    assert all(result is stored for result in results)
+    assert len(cache) == 1
+    for machine in machines:
+        assert machine.frozen == (machine is stored)
@@ -0,0 +1,55 @@
+import gc
+import weakref
+from concurrent.futures import ThreadPoolExecutor
+
+from grammars import SequenceMachine, TextMachine, advance, boolean_object
+
+from pse_core.state_machine import StateMachine
+
+
+def test_walkers_outlive_the_python_handle_of_their_grammar():
+    root = boolean_object()
+    walkers = advance(root.get_walkers(), ['{"a":'])
+    del root
+    gc.collect()
+
+    assert StateMachine.can_end(advance(walkers, ["false}"]))
+    assert type(walkers[0].state_machine).__name__ == "SequenceMachine"
+
+
+def test_python_attributes_survive_on_engine_created_walkers():
+    leaf = TextMachine("abc")
+    walkers = advance(SequenceMachine([leaf]).get_walkers(), ["a"])
+    del leaf
+    gc.collect()
+
+    transition = walkers[0].transition_walker
+    assert transition.state_machine.text == "abc"
+    assert transition.remaining_text == "bc"
+    assert StateMachine.can_end(advance(walkers, ["bc"]))
+
+
+def test_threads_clone_walkers_of_a_dropped_grammar():
+    walkers = boolean_object().get_walkers()
+    gc.collect()
+
+    def run(value):
+        return StateMachine.can_end(advance([walker.clone() for walker in walkers], ['{"a":', value, "}"]))
+
+    with ThreadPoolExecutor(max_workers=4) as pool:
+        assert list(pool.map(run, ["true", "false", "null", "nul"] * 8)) == [True, True, True, False] * 8
+
+
+def test_grammar_is_released_with_its_last_walker():
+    root = boolean_object()
+    released = weakref.ref(root)
+    walkers = advance(root.get_walkers(), ['{"a":tr'])
+    del root
+    gc.collect()
+    assert released() is not None
+
+    walkers = advance(walkers, ["ue}"])
+    assert StateMachine.can_end(walkers)
+    del walkers
+    gc.collect()
+    assert released() is None
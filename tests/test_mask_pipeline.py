@@ -0,0 +1,39 @@
+from grammars import advance, boolean_object
+
+from pse_core.mask_pipeline import MaskPipeline
+from pse_core.token_mask_cache import TokenMaskCache
+
+VOCABULARY = ["{", '"a"', ":", "true", "false", "null", "}", "tr", "ue}", "x", '{"a":']
+
+
+def test_workers_advance_python_walkers():
+    root = boolean_object()
+    start = root.get_walkers()
+    pipeline = MaskPipeline(VOCABULARY, num_threads=4)
+    try:
+        pending = [pipeline.submit(start, token) for token in ["{", '{"a":', "x"] * 8]
+        results = [p.result() for p in pending]
+    finally:
+        pipeline.close()
+
+    expected = TokenMaskCache(VOCABULARY)
+    for (walkers, mask), token in zip(results, ["{", '{"a":', "x"] * 8, strict=True):
+        assert len(walkers) == len(advance(start, [token]))
+        assert mask == expected.compute(walkers)
+
+    _, mask = results[0]
+    assert mask.allowed_ids() == [VOCABULARY.index('"a"')]
+    assert results[2][0] == []
+
+
+def test_submit_walkers_matches_synchronous_mask():
+    root = boolean_object()
+    walkers = advance(root.get_walkers(), ['{"a":'])
+    pipeline = MaskPipeline(VOCABULARY, num_threads=2)
+    try:
+        _, mask = pipeline.submit_walkers(walkers).result()
+    finally:
+        pipeline.close()
+
+    allowed = {VOCABULARY[token_id] for token_id in mask.allowed_ids()}
+    assert allowed == {"true", "false", "null", "tr"}
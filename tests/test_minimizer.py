@@ -0,0 +1,22 @@
+from grammars import SequenceMachine, TextMachine, accepts
+
+from pse_core.minimizer import StateMachineMinimizer
+
+
+def test_equal_python_leaves_are_shared():
+    root = SequenceMachine([TextMachine("x"), TextMachine("y"), TextMachine("x")])
+    stats = StateMachineMinimizer.minimize(root)
+
+    assert stats.machines_before == 4
+    assert stats.machines_after == 3
+    first, third = root.get_edges(0)[0][0], root.get_edges(2)[0][0]
+    assert first is third
+    assert accepts(root, "xyx")
+    assert not accepts(root, "xyy")
+
+
+def test_leaves_with_different_attributes_stay_apart():
+    root = SequenceMachine([TextMachine("x"), TextMachine("x", is_optional=True), TextMachine("z")])
+    stats = StateMachineMinimizer.minimize(root)
+
+    assert stats.machines_after == stats.machines_before
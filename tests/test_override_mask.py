@@ -0,0 +1,60 @@
+from grammars import SequenceMachine, TextMachine, accepts
+
+from pse_core.walker import Walker
+
+
+def grammar_with(walker_type: type[Walker]) -> SequenceMachine:
+    """"a" then "b", walked by walker_type at the top level."""
+
+    class Machine(SequenceMachine):
+        def get_new_walker(self, state=None):
+            return walker_type(self, state)
+
+    return Machine([TextMachine("a"), TextMachine("b")])
+
+
+def test_single_override_dispatches_to_python():
+    calls = []
+
+    class RecordingWalker(Walker):
+        def should_start_transition(self, token):
+            calls.append(token)
+            return super().should_start_transition(token)
+
+    assert accepts(grammar_with(RecordingWalker), "ab")
+    assert calls
+
+    class RejectingWalker(Walker):
+        def should_start_transition(self, token):
+            return False
+
+    assert not accepts(grammar_with(RejectingWalker), "ab")
+
+
+def test_sibling_without_the_override_uses_the_base():
+    class PlainWalker(Walker):
+        pass
+
+    class RejectingWalker(Walker):
+        def should_start_transition(self, token):
+            return False
+
+    # Resolving the rejecting sibling first must not leak into PlainWalker.
+    assert not accepts(grammar_with(RejectingWalker), "ab")
+    assert accepts(grammar_with(PlainWalker), "ab")
+    assert not accepts(grammar_with(PlainWalker), "ba")
+
+
+def test_methods_added_after_first_use_are_not_seen():
+    class LateWalker(Walker):
+        pass
+
+    assert accepts(grammar_with(LateWalker), "ab")
+    LateWalker.should_start_transition = lambda self, token: False
+    assert accepts(grammar_with(LateWalker), "ab")
+
+    class EarlyWalker(Walker):
+        pass
+
+    EarlyWalker.should_start_transition = lambda self, token: False
+    assert not accepts(grammar_with(EarlyWalker), "ab")
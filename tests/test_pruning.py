@@ -0,0 +1,68 @@
+from grammars import ChoiceMachine, SequenceMachine, TextMachine, advance
+
+from pse_core.state_machine import StateMachine
+
+
+def ambiguous() -> StateMachine:
+    """After "xa" three walkers are alive, one of them a level deeper than the others."""
+    nested = SequenceMachine([TextMachine("a"), TextMachine("bcd")])
+    return SequenceMachine([TextMachine("x"), ChoiceMachine([TextMachine("ab"), TextMachine("abc"), nested])])
+
+
+def depth(walker) -> float:
+    count = 0
+    while walker.transition_walker is not None:
+        walker = walker.transition_walker
+        count += 1
+    return float(count)
+
+
+def advance_root(root: StateMachine, token: str) -> list:
+    return [advanced for walker in root.get_walkers() for advanced in root.advance(walker, token)]
+
+
+def test_unbounded_by_default():
+    root = ambiguous()
+    assert root.max_walkers == 0
+    assert len(advance_root(root, "xa")) == 3
+    assert root.pruned_walkers == 0
+
+
+def test_keeps_at_most_max_walkers_and_counts_the_rest():
+    root = ambiguous()
+    root.max_walkers = 2
+    assert len(advance_root(root, "xa")) == 2
+    assert root.pruned_walkers == 1
+
+    root.max_walkers = 1
+    assert len(advance_root(root, "xa")) == 1
+    assert root.pruned_walkers == 3
+
+    root.pruned_walkers = 0
+    assert root.pruned_walkers == 0
+
+
+def test_keeps_the_highest_priority_walkers():
+    # The default priority prefers fewer nested transitions, so the deeper
+    # "a" + "bcd" branch is dropped.
+    root = ambiguous()
+    root.max_walkers = 1
+    kept = advance_root(root, "xa")
+    assert advance(kept, ["b"])
+    assert not advance(kept, ["bcd"])
+
+    root = ambiguous()
+    root.max_walkers = 1
+    root.walker_priority = depth
+    kept = advance_root(root, "xa")
+    assert StateMachine.can_end(advance(kept, ["bcd"]))
+    assert not StateMachine.can_end(advance(kept, ["b"]))
+    assert root.pruned_walkers == 2
+
+
+def test_advance_pruned_caps_a_single_call():
+    root = ambiguous()
+    (walker,) = root.get_walkers()
+    assert len(root.advance_pruned(walker, "xa", 1)) == 1
+    assert root.max_walkers == 0
+    assert len(root.advance(walker, "xa")) == 3
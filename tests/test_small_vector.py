@@ -0,0 +1,44 @@
+from grammars import ChoiceMachine, SequenceMachine, TextMachine, advance
+
+from pse_core.state_machine import StateMachine
+
+# Both walker history and per-state transitions keep four entries inline
+PARTS = ["a", "b", "c", "d", "e", "f", "g"]
+
+
+def history(walker) -> list[str]:
+    walker = getattr(walker, "accepted_walker", walker)
+    return [accepted.get_raw_value() for accepted in walker.accepted_history]
+
+
+def test_history_grows_past_the_inline_entries():
+    root = SequenceMachine([TextMachine(part) for part in PARTS])
+    walkers = root.get_walkers()
+    for count, part in enumerate(PARTS, start=1):
+        walkers = advance(walkers, [part])
+        assert walkers
+        assert all(history(walker) == PARTS[:count] for walker in walkers)
+    assert StateMachine.can_end(walkers)
+
+
+def test_history_round_trips_through_python():
+    walker = advance(SequenceMachine([TextMachine(part) for part in PARTS]).get_walkers(), ["abcdef"])[0]
+    entries = walker.accepted_history
+    assert len(entries) == 6
+
+    walker.accepted_history = entries + entries
+    assert [accepted.get_raw_value() for accepted in walker.accepted_history] == PARTS[:6] * 2
+
+    clone = walker.clone()
+    walker.accepted_history = entries[:2]
+    assert len(clone.accepted_history) == 12
+    assert len(walker.accepted_history) == 2
+
+
+def test_states_with_more_than_four_transitions():
+    root = ChoiceMachine([TextMachine(part) for part in PARTS])
+    assert len(root.get_walkers()) == len(PARTS)
+    assert len(root.get_transitions(root.get_new_walker())) == len(PARTS)
+    for part in PARTS:
+        assert StateMachine.can_end(advance(root.get_walkers(), [part]))
+    assert not advance(root.get_walkers(), ["h"])
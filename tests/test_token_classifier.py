@@ -0,0 +1,66 @@
+from grammars import SequenceMachine, TextMachine, advance, boolean_object
+
+from pse_core.state_machine import StateMachine
+from pse_core.token_classifier import TokenClassifier
+from pse_core.walker import Walker
+
+VOCABULARY = ["a", "ab", "abc", "b", "bc", "c", "{", '"a"', ":", "true", "tr", "ue}", "}"]
+
+
+class PickyAdvanceSequence(SequenceMachine):
+    """Rejects every token that contains a "b" in its own advance()."""
+
+    def advance(self, walker: Walker, token: str) -> list[Walker]:
+        if "b" in token:
+            return []
+        return super().advance(walker, token)
+
+
+class PickyWalker(Walker):
+    """Rejects every token that contains a "b"."""
+
+    def consume_token(self, token: str) -> list[Walker]:
+        if "b" in token:
+            return []
+        return super().consume_token(token)
+
+
+class PickySequence(SequenceMachine):
+    def get_new_walker(self, state=None):
+        return PickyWalker(self, state)
+
+
+def brute_force(walkers):
+    return [token_id for token_id, token in enumerate(VOCABULARY) if StateMachine.can_consume(walkers, token)]
+
+
+def test_machine_veto_is_respected():
+    root = PickyAdvanceSequence([TextMachine("ab"), TextMachine("c")])
+    walkers = root.get_walkers()
+    classifier = TokenClassifier(VOCABULARY)
+    classifier.precompute(root)
+
+    allowed = classifier.compute_mask(walkers).allowed_ids()
+    assert allowed == brute_force(walkers)
+    assert allowed == [VOCABULARY.index("a")]
+
+
+def test_python_parent_veto_is_respected():
+    root = PickySequence([TextMachine("ab"), TextMachine("c")])
+    walkers = root.get_walkers()
+    classifier = TokenClassifier(VOCABULARY)
+
+    allowed = classifier.compute_mask(walkers).allowed_ids()
+    assert allowed == brute_force(walkers)
+    assert allowed == [VOCABULARY.index("a")]
+
+
+def test_default_grammar_matches_brute_force():
+    root = boolean_object()
+    classifier = TokenClassifier(VOCABULARY)
+    classifier.precompute(root)
+
+    walkers = root.get_walkers()
+    for token in ["{", '"a"', ":", "tr"]:
+        assert classifier.compute_mask(walkers).allowed_ids() == brute_force(walkers)
+        walkers = advance(walkers, [token])
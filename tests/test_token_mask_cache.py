@@ -0,0 +1,74 @@
+from grammars import advance, boolean_object
+
+from pse_core.token_mask_cache import TokenMaskCache
+
+VOCABULARY = ["{", '"a"', ":", "true", "false", "null", "}", "tr", "ue}", "x", '{"a":']
+
+
+def positions() -> list[list]:
+    start = boolean_object().get_walkers()
+    return [start, advance(start, ["{"]), advance(start, ['{"a":'])]
+
+
+def test_counts_hits_and_misses():
+    cache = TokenMaskCache(VOCABULARY)
+    start, after_brace, at_value = positions()
+
+    first = cache.get_or_compute(start)
+    assert (cache.hits, cache.misses) == (0, 1)
+    assert cache.get_or_compute(start) == first
+    assert (cache.hits, cache.misses) == (1, 1)
+
+    cache.get_or_compute(after_brace)
+    cache.get_or_compute(at_value)
+    assert (cache.hits, cache.misses) == (1, 3)
+    assert len(cache) == 3
+    assert cache.hit_rate == 0.25
+
+
+def test_same_position_shares_a_mask():
+    cache = TokenMaskCache(VOCABULARY)
+    for walkers in positions():
+        mask = cache.get_or_compute(walkers)
+        assert mask == cache.compute(walkers)
+
+    # Separately built grammars advanced the same way are cache hits.
+    misses = cache.misses
+    for walkers in positions():
+        assert TokenMaskCache.signature(walkers) in cache
+        assert cache.get_or_compute(walkers) == cache.compute(walkers)
+    assert cache.misses == misses
+
+    start, after_brace, at_value = positions()
+    assert cache.get_or_compute(start).allowed_ids() == [0, 10]
+    assert cache.get_or_compute(at_value).allowed_ids() == [3, 4, 5, 7]
+    assert cache.get_or_compute(after_brace) != cache.get_or_compute(start)
+
+
+def test_evicts_the_least_recently_used_mask():
+    cache = TokenMaskCache(VOCABULARY)
+    start, after_brace, at_value = positions()
+    cache.get_or_compute(start)
+    cache.get_or_compute(after_brace)
+
+    # Room for two masks, not three.
+    cache.capacity_bytes = cache.memory_usage + 64
+    cache.get_or_compute(start)
+    cache.get_or_compute(at_value)
+
+    assert cache.evictions == 1
+    assert TokenMaskCache.signature(start) in cache
+    assert TokenMaskCache.signature(at_value) in cache
+    assert TokenMaskCache.signature(after_brace) not in cache
+    assert cache.memory_usage <= cache.capacity_bytes
+
+
+def test_shrinking_the_budget_keeps_the_newest_mask():
+    cache = TokenMaskCache(VOCABULARY)
+    for walkers in positions():
+        cache.get_or_compute(walkers)
+
+    cache.capacity_bytes = 1
+    assert len(cache) == 1
+    assert cache.evictions == 2
+    assert TokenMaskCache.signature(positions()[2]) in cache
@@ -0,0 +1,39 @@
+from grammars import TextMachine, advance
+
+from pse_core.token_classifier import TokenClassifier
+from pse_core.token_mask_cache import TokenMaskCache
+from pse_core.token_vocabulary import TokenVocabulary
+
+# "é" is C3 A9 in UTF-8
+PIECES = ["<0xC3>", "<0xA9>", "é", "▁t", "t", "<0x0A>", "<0xFF>", ""]
+
+
+def test_pieces_are_decoded_once():
+    vocabulary = TokenVocabulary(PIECES)
+
+    assert TokenVocabulary.decode_token("<0x0A>") == b"\n"
+    assert TokenVocabulary.decode_token("▁t") == b" t"
+    assert vocabulary.token(0) == b"\xc3"
+    assert vocabulary.token(2) == "é".encode()
+    assert b" t" in vocabulary
+    assert len(vocabulary) == len(PIECES)
+    assert TokenVocabulary(PIECES, decode=False).token(0) == b"<0xC3>"
+
+
+def test_partial_characters_are_masked_without_calling_walkers():
+    root = TextMachine("été")
+    cache = TokenMaskCache(TokenVocabulary(PIECES))
+
+    mask = cache.compute(root.get_walkers())
+    assert mask.allowed_ids() == [2]
+
+    mask = cache.compute(advance(root.get_walkers(), ["é"]))
+    assert mask.allowed_ids() == [4]
+
+
+def test_classifier_precompute_skips_partial_characters():
+    root = TextMachine("\n")
+    classifier = TokenClassifier(TokenVocabulary(PIECES))
+
+    assert classifier.precompute(root) == 1
+    assert classifier.compute_mask(root.get_walkers()).allowed_ids() == [5]
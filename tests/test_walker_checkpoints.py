@@ -0,0 +1,53 @@
+import pytest
+from grammars import advance, boolean_object
+
+from pse_core.state_machine import StateMachine
+from pse_core.walker_checkpoints import WalkerCheckpoints
+
+TOKENS = ["{", '"a"', ":", "fal", "se", "}"]
+
+
+def test_roll_back_and_resume_python_walkers():
+    root = boolean_object()
+    checkpoints = WalkerCheckpoints(window=4)
+    walkers = root.get_walkers()
+    for token in TOKENS[:4]:
+        walkers = advance(walkers, [token])
+        checkpoints.push(walkers)
+
+    assert checkpoints.step == 3
+    assert len(checkpoints) == 4
+    walkers = checkpoints.rollback(1)
+    assert checkpoints.step == 2
+    assert StateMachine.can_end(advance(walkers, ["true", "}"]))
+
+    assert len(checkpoints.peek(2)) == len(advance(root.get_walkers(), ["{"]))
+    with pytest.raises(IndexError):
+        checkpoints.peek(3)
+
+
+def test_window_drops_the_oldest_checkpoints():
+    root = boolean_object()
+    checkpoints = WalkerCheckpoints(window=2)
+    walkers = root.get_walkers()
+    for step, token in enumerate(TOKENS):
+        walkers = advance(walkers, [token])
+        assert checkpoints.push(walkers) == step
+
+    assert len(checkpoints) == 2
+    assert checkpoints.step == len(TOKENS) - 1
+    assert StateMachine.can_end(checkpoints.peek())
+
+
+def test_empty_ring_has_no_step():
+    checkpoints = WalkerCheckpoints(window=3)
+    assert checkpoints.step is None
+
+    checkpoints.push(boolean_object().get_walkers())
+    assert checkpoints.step == 0
+    checkpoints.clear()
+    assert checkpoints.step is None
+    with pytest.raises(IndexError):
+        checkpoints.rollback(0)
+    with pytest.raises(ValueError):
+        WalkerCheckpoints(window=0)
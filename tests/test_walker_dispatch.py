@@ -0,0 +1,137 @@
+import pytest
+from grammars import (
+    ChoiceMachine,
+    SequenceMachine,
+    TextMachine,
+    advance,
+    boolean_object,
+    digit_list,
+    native_boolean_object,
+)
+
+from pse_core.accepted_state import AcceptedState
+from pse_core.state_machine import StateMachine
+from pse_core.walker import Walker
+
+
+class CustomWalker(Walker):
+    """Overrides a method with the default, so every call takes the Python path."""
+
+    def should_complete_transition(self) -> bool:
+        return super().should_complete_transition()
+
+
+class CustomSequence(SequenceMachine):
+    def get_new_walker(self, state=None):
+        return CustomWalker(self, state)
+
+
+class CustomChoice(ChoiceMachine):
+    def get_new_walker(self, state=None):
+        return CustomWalker(self, state)
+
+
+def custom_boolean_object() -> StateMachine:
+    values = CustomChoice([TextMachine("true"), TextMachine("false"), TextMachine("null")])
+    return CustomSequence([TextMachine("{"), TextMachine('"a"'), TextMachine(":"), values, TextMachine("}")])
+
+
+# The same language with native walkers over native machines, native walkers
+# over Python machines, and Python walkers.
+OBJECT_GRAMMARS = [native_boolean_object, boolean_object, custom_boolean_object]
+OBJECT_INPUTS = [
+    ['{"a":true}'],
+    ["{", '"a"', ":", "fa", "lse", "}"],
+    ['{"a":nu', "ll"],
+    ['{"a":tr', "x"],
+    ['{"a":null}', "}"],
+]
+
+
+def summary(walkers: list[Walker]) -> list[tuple]:
+    return sorted(
+        (
+            isinstance(walker, AcceptedState),
+            str(walker.current_state),
+            walker.get_raw_value() or "",
+            walker.remaining_input or "",
+            walker.has_reached_accept_state(),
+            walker.can_accept_more_input(),
+        )
+        for walker in walkers
+    )
+
+
+def complete(walker: Walker, token: str) -> tuple[Walker | None, bool]:
+    (consumed,) = walker.transition_walker.consume_token(token)
+    return walker.complete_transition(consumed)
+
+
+@pytest.mark.parametrize("tokens", OBJECT_INPUTS)
+def test_advance_matches_across_walker_kinds(tokens):
+    native, python, custom = (summary(advance(build().get_walkers(), tokens)) for build in OBJECT_GRAMMARS)
+    assert python == native
+    assert custom == native
+
+
+@pytest.mark.parametrize(
+    ("build", "accepted", "rejected"),
+    [
+        (native_boolean_object, '{"a":false}', '{"a":x'),
+        (boolean_object, '{"a":false}', '{"a":x'),
+        (custom_boolean_object, '{"a":false}', '{"a":x'),
+        (digit_list, "[4096]", "[4x"),
+    ],
+)
+def test_advance_accepts_through_accepted_states(build, accepted, rejected):
+    start = build().get_walkers()
+    walkers = advance(start, [accepted])
+    assert StateMachine.can_end(walkers)
+    assert any(isinstance(walker, AcceptedState) for walker in walkers)
+    for walker in walkers:
+        if isinstance(walker, AcceptedState):
+            assert walker.has_reached_accept_state()
+            assert not walker.should_start_transition("}")
+
+    assert not StateMachine.can_end(advance(start, [accepted[:-1]]))
+    assert not advance(start, [rejected])
+
+
+def test_custom_walkers_read_the_digits():
+    walkers = advance(digit_list().get_walkers(), ["[", "12", "34"])
+    assert walkers
+    assert all(walker.get_raw_value() == "[1234" for walker in walkers)
+    assert StateMachine.can_end(advance(walkers, ["]"]))
+
+
+@pytest.mark.parametrize("build", OBJECT_GRAMMARS)
+def test_branch_at_the_choice(build):
+    (walker,) = advance(build().get_walkers(), ['{"a":'])
+    branches = walker.branch()
+    assert all(type(branch) is type(walker) for branch in branches)
+    assert sum(bool(advance([branch], ["null}"])) for branch in branches) == 1
+
+    (native,) = advance(native_boolean_object().get_walkers(), ['{"a":'])
+    assert summary(branches) == summary(native.branch())
+
+
+@pytest.mark.parametrize("build", OBJECT_GRAMMARS)
+def test_complete_transition(build):
+    (walker,) = build().get_walkers()
+    completed, accepted = complete(walker, "{")
+    assert type(completed) is type(walker)
+    assert completed.current_state == 1
+    assert not completed.has_reached_accept_state()
+    assert not accepted
+
+    (value,) = advance(build().get_walkers(), ['{"a":true'])
+    (closing,) = [
+        branch
+        for branch in value.branch("}")
+        if branch.transition_walker is not None and branch.transition_walker.should_start_transition("}")
+    ]
+    completed, accepted = complete(closing, "}")
+    assert type(completed) is type(walker)
+    assert completed.current_state == 5
+    assert completed.has_reached_accept_state()
+    assert accepted
@@ -0,0 +1,50 @@
+from grammars import advance, boolean_object
+
+
+def walker_with_edges():
+    walkers = advance(boolean_object().get_walkers(), ['{"a":'])
+    walker = walkers[0]
+    assert walker.explored_edges
+    return walker
+
+
+def test_clones_keep_their_own_explored_edges():
+    walker = walker_with_edges()
+    edges = walker.explored_edges
+    clone = walker.clone()
+    assert clone.explored_edges == edges
+
+    clone.explored_edges = edges | {(99, 100, None)}
+    assert walker.explored_edges == edges
+    assert (99, 100, None) in clone.explored_edges
+
+    walker.explored_edges = set()
+    assert walker.explored_edges == set()
+    assert clone.explored_edges == edges | {(99, 100, None)}
+
+
+def test_clones_keep_their_own_strings():
+    walker = walker_with_edges()
+    walker.remaining_input = "rest"
+    walker._raw_value = '{"a":'
+    clone = walker.clone()
+    assert clone.remaining_input == "rest"
+    assert clone._raw_value == '{"a":'
+
+    clone.remaining_input = None
+    clone._raw_value = "other"
+    assert walker.remaining_input == "rest"
+    assert walker._raw_value == '{"a":'
+    assert clone.remaining_input is None
+    assert clone._raw_value == "other"
+
+    walker.remaining_input = ""
+    assert walker.remaining_input == ""
+
+
+def test_advancing_a_clone_leaves_the_original_alone():
+    walker = walker_with_edges()
+    before = (walker.explored_edges, walker.get_raw_value(), walker.consumed_character_count, walker.current_state)
+    assert advance([walker.clone()], ["true}"])
+    after = (walker.explored_edges, walker.get_raw_value(), walker.consumed_character_count, walker.current_state)
+    assert after == before
@@ -0,0 +1,68 @@
+import pytest
+from grammars import SequenceMachine, TextMachine, advance, boolean_object
+
+from pse_core.state_machine import StateMachine
+from pse_core.walker_serializer import WalkerSerializer
+
+
+def test_round_trip_restores_python_walkers():
+    root = boolean_object()
+    walkers = advance(root.get_walkers(), ['{"a":', "tr"])
+    data = WalkerSerializer.serialize(root, walkers)
+
+    restored = WalkerSerializer.deserialize(root, data)
+    assert len(restored) == len(walkers)
+    assert StateMachine.can_end(advance(restored, ["ue}"]))
+
+
+def test_rejects_a_different_root_of_the_same_size():
+    root = SequenceMachine([TextMachine("a"), TextMachine("b")])
+    other = SequenceMachine([TextMachine("a"), TextMachine("b")], is_optional=True)
+    data = WalkerSerializer.serialize(root, advance(root.get_walkers(), ["a"]))
+
+    with pytest.raises(ValueError):
+        WalkerSerializer.deserialize(other, data)
+
+
+def test_rejects_a_node_count_larger_than_the_data():
+    root = boolean_object()
+    data = bytearray(WalkerSerializer.serialize(root, root.get_walkers()))
+    node_count_offset = 4 + 4 + 4 + 8
+    data[node_count_offset : node_count_offset + 4] = (0xFFFFFFFF).to_bytes(4, "little")
+
+    with pytest.raises(RuntimeError):
+        WalkerSerializer.deserialize(root, bytes(data))
+
+
+def test_rejects_a_walker_count_larger_than_the_data():
+    root = boolean_object()
+    walkers = root.get_walkers()
+    data = bytearray(WalkerSerializer.serialize(root, walkers))
+    walker_count_offset = len(data) - 4 * (len(walkers) + 1)
+    data[walker_count_offset : walker_count_offset + 4] = (0xFFFFFFFF).to_bytes(4, "little")
+
+    with pytest.raises(RuntimeError):
+        WalkerSerializer.deserialize(root, bytes(data))
+
+
+def test_rejects_a_state_out_of_int_range():
+    state = 123456
+    root = StateMachine({state: [(TextMachine("a"), 7)]}, state, [7])
+    data = WalkerSerializer.serialize(root, root.get_walkers())
+    encoded = b"\x00" + state.to_bytes(8, "little", signed=True)
+    assert encoded in data
+    data = data.replace(encoded, b"\x00" + (2**40).to_bytes(8, "little", signed=True))
+
+    with pytest.raises(RuntimeError):
+        WalkerSerializer.deserialize(root, data)
+
+
+def test_keeps_character_counts_past_four_gigabytes():
+    root = boolean_object()
+    walkers = advance(root.get_walkers(), ["{"])
+    count = 2**32 + 5
+    for walker in walkers:
+        walker.consumed_character_count = count
+
+    restored = WalkerSerializer.deserialize(root, WalkerSerializer.serialize(root, walkers))
+    assert [walker.consumed_character_count for walker in restored] == [count] * len(walkers)
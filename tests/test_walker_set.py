@@ -0,0 +1,48 @@
+from concurrent.futures import ThreadPoolExecutor
+
+from grammars import advance, boolean_object
+
+from pse_core.state_machine import StateMachine
+from pse_core.walker_set import WalkerSet
+
+VALUES = ["true", "false", "null"]
+
+
+def test_forks_advance_python_walkers_from_threads():
+    root = boolean_object()
+    prefix = WalkerSet(advance(root.get_walkers(), ['{"a":']))
+    handles = prefix.fork(12)
+    assert all(handle.shares_with(prefix) for handle in handles)
+
+    def finish(index):
+        handle = handles[index]
+        return handle.consume_token(VALUES[index % 3]) and handle.consume_token("}")
+
+    with ThreadPoolExecutor(max_workers=4) as pool:
+        assert all(pool.map(finish, range(len(handles))))
+
+    for index, handle in enumerate(handles):
+        assert StateMachine.can_end(handle.walkers)
+        same_value = handles[(index + 3) % len(handles)]
+        assert handle.shares_with(same_value)
+    assert len(prefix) == len(advance(root.get_walkers(), ['{"a":']))
+
+
+def test_rejected_token_empties_only_that_handle():
+    root = boolean_object()
+    first, second = WalkerSet(root.get_walkers()).fork(2)
+
+    assert not first.consume_token("x")
+    assert not first
+    assert second.consume_token("{")
+    assert len(second) == len(advance(root.get_walkers(), ["{"]))
+
+
+def test_consume_bytes_advances_python_walkers():
+    root = boolean_object()
+    handle = WalkerSet(advance(root.get_walkers(), ['{"a":']))
+
+    assert handle.consume_bytes(b"t")
+    assert handle.consume_bytes(b"rue}")
+    assert handle.pending_bytes == b""
+    assert StateMachine.can_end(handle.walkers)